@@ -0,0 +1,146 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Throughput of the rpc hex codec kernels against the libbitcoin base16
+// routines, on hash, transaction and block sized inputs.
+//
+//   bitprim_rpc_benchmark [iterations_scale]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+#include <bitcoin/bitcoin.hpp>
+#include <bitprim/rpc/encoding/hex.hpp>
+
+namespace {
+
+using bitprim::rpc::hex_kernel;
+
+struct workload {
+    char const* name;
+    size_t size;
+    size_t iterations;
+};
+
+// Keeps the optimizer from discarding the measured work.
+volatile size_t sink = 0;
+
+void report(char const* workload, char const* routine, size_t bytes, size_t iterations, std::function<void()> const& run) {
+    run();
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        run();
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto const mbps = double(bytes) * iterations / elapsed / (1024 * 1024);
+    std::printf("%-8s %-28s %10.1f MiB/s %10.1f ns/op\n", workload, routine, mbps, elapsed * 1e9 / iterations);
+}
+
+char const* kernel_name(hex_kernel kernel) {
+    switch (kernel) {
+        case hex_kernel::avx2: return "avx2";
+        case hex_kernel::sse2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t const scale = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+
+    workload const workloads[] = {
+        {"hash", 32, 2000000 * scale},
+        {"tx", 250, 500000 * scale},
+        {"block", 1000000, 100 * scale}
+    };
+
+    hex_kernel const kernels[] = {hex_kernel::scalar, hex_kernel::sse2, hex_kernel::avx2};
+
+    std::printf("best kernel: %s\n", kernel_name(bitprim::rpc::hex_best_kernel()));
+
+    std::mt19937 random(42);
+    for (auto const& load : workloads) {
+        libbitcoin::data_chunk data(load.size);
+        for (auto& byte : data) {
+            byte = static_cast<uint8_t>(random());
+        }
+        auto const text = libbitcoin::encode_base16(data);
+        std::string out(text.size(), '\0');
+        libbitcoin::data_chunk decoded(data.size());
+
+        report(load.name, "libbitcoin encode_base16", load.size, load.iterations, [&]() {
+            sink += libbitcoin::encode_base16(data).size();
+        });
+        report(load.name, "rpc encode_base16", load.size, load.iterations, [&]() {
+            sink += bitprim::rpc::encode_base16(data).size();
+        });
+        for (auto kernel : kernels) {
+            if (!bitprim::rpc::hex_kernel_supported(kernel)) {
+                continue;
+            }
+            std::string const routine = std::string("rpc hex_encode ") + kernel_name(kernel);
+            report(load.name, routine.c_str(), load.size, load.iterations, [&]() {
+                bitprim::rpc::hex_encode(data.data(), data.size(), &out[0], kernel);
+                sink += out[0];
+            });
+        }
+
+        report(load.name, "libbitcoin decode_base16", load.size, load.iterations, [&]() {
+            libbitcoin::decode_base16(decoded, text);
+            sink += decoded.size();
+        });
+        report(load.name, "rpc decode_base16", load.size, load.iterations, [&]() {
+            bitprim::rpc::decode_base16(decoded, text);
+            sink += decoded.size();
+        });
+        for (auto kernel : kernels) {
+            if (!bitprim::rpc::hex_kernel_supported(kernel)) {
+                continue;
+            }
+            std::string const routine = std::string("rpc hex_decode ") + kernel_name(kernel);
+            report(load.name, routine.c_str(), load.size, load.iterations, [&]() {
+                sink += bitprim::rpc::hex_decode(text.data(), text.size(), decoded.data(), kernel);
+            });
+        }
+    }
+
+    auto hash = libbitcoin::bitcoin_hash(libbitcoin::data_chunk{1, 2, 3});
+    auto const hash_text = libbitcoin::encode_hash(hash);
+
+    report("hash", "libbitcoin encode_hash", hash.size(), 2000000 * scale, [&]() {
+        sink += libbitcoin::encode_hash(hash).size();
+    });
+    report("hash", "rpc encode_hash", hash.size(), 2000000 * scale, [&]() {
+        sink += bitprim::rpc::encode_hash(hash).size();
+    });
+    report("hash", "libbitcoin decode_hash", hash.size(), 2000000 * scale, [&]() {
+        sink += libbitcoin::decode_hash(hash, hash_text);
+    });
+    report("hash", "rpc decode_hash", hash.size(), 2000000 * scale, [&]() {
+        sink += bitprim::rpc::decode_hash(hash, hash_text);
+    });
+
+    return 0;
+}
@@ -23,11 +23,22 @@
 #include <bitcoin/blockchain.hpp>
 #include <bitprim/rpc/define.hpp>
 #include <bitprim/rpc/messages.hpp>
+#include <bitprim/rpc/admission_control.hpp>
+#include <bitprim/rpc/cache/output_cache.hpp>
+#include <bitprim/rpc/cache/request_coalescer.hpp>
+#include <bitprim/rpc/cache/response_cache.hpp>
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/json/json.hpp>
+#include <bitprim/rpc/http/compression.hpp>
 #include <bitprim/rpc/http/rpc_server.hpp>
 #include <bitprim/rpc/http/server_http.hpp>
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/index/header_index.hpp>
 #include <bitprim/rpc/zmq/zmq_helper.hpp>
+#include <bitprim/rpc/zmq/zmq_rpc_server.hpp>
 #include <bitprim/rpc/manager.hpp>
+#include <bitprim/rpc/settings.hpp>
+#include <bitprim/rpc/worker_pool.hpp>
 #include <bitprim/rpc/version.hpp>
 
 #endif /* BITPRIM_RPC_HPP_ */
@@ -0,0 +1,99 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_ADMISSION_CONTROL_HPP_
+#define BITPRIM_RPC_ADMISSION_CONTROL_HPP_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Bounds the requests running at the same time per cost class, so a burst
+/// of expensive queries can not take every blockchain thread. Requests
+/// over the bound wait in a queue of their class, or are turned away when
+/// it is full. Mining requests are never held and, while any of them
+/// runs, queued expensive requests wait for it to finish.
+class BCR_API admission_control {
+public:
+    using work = std::function<void()>;
+
+    enum class cost_class {
+        // getblocktemplate, getmininginfo.
+        mining,
+        standard,
+        // Address and spend queries, which walk whole histories.
+        expensive
+    };
+
+    /// Requests of a class running at the same time, zero means no limit,
+    /// and requests waiting for one of them to finish.
+    struct limits {
+        size_t concurrency;
+        size_t queue_size;
+    };
+
+    admission_control(limits standard, limits expensive);
+
+    //non-copyable
+    admission_control(admission_control const&) = delete;
+    admission_control& operator=(admission_control const&) = delete;
+
+    static cost_class classify(std::string const& method);
+
+    /// Runs start now or once its class has room. Returns false, dropping
+    /// start, when the queue of the class is full. Every started request
+    /// calls release() when it is done, which may start the next ones on
+    /// the calling thread.
+    bool admit(cost_class cost, work start);
+    void release(cost_class cost);
+
+    size_t running(cost_class cost) const;
+    size_t queued(cost_class cost) const;
+
+private:
+    struct gate {
+        limits bounds;
+        size_t running;
+        std::deque<work> queue;
+    };
+
+    // Both require the lock.
+    bool has_room(cost_class cost) const;
+    void collect(std::vector<work>& ready);
+
+    static void run(std::vector<work> ready);
+
+    gate& at(cost_class cost);
+    gate const& at(cost_class cost) const;
+
+    mutable std::mutex mutex_;
+    gate gates_[3];
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_ADMISSION_CONTROL_HPP_
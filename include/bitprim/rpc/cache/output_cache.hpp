@@ -0,0 +1,71 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_CACHE_OUTPUT_CACHE_HPP_
+#define BITPRIM_RPC_CACHE_OUTPUT_CACHE_HPP_
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Recently read outputs keyed by their point, evicted least recently
+/// used first beyond the capacity. Outputs never change once their
+/// transaction exists, so entries stay valid across blocks and reorgs.
+class BCR_API output_cache {
+public:
+    /// Capacity in outputs.
+    explicit output_cache(size_t capacity);
+
+    //non-copyable
+    output_cache(output_cache const&) = delete;
+    output_cache& operator=(output_cache const&) = delete;
+
+    bool find(libbitcoin::chain::output_point const& point, libbitcoin::chain::output& out_output);
+    void insert(libbitcoin::chain::output_point const& point, libbitcoin::chain::output const& output);
+
+    /// Outputs in use.
+    size_t size() const;
+
+private:
+    struct point_hash {
+        size_t operator()(libbitcoin::chain::output_point const& point) const;
+    };
+
+    using entry = std::pair<libbitcoin::chain::output_point, libbitcoin::chain::output>;
+    using entry_list = std::list<entry>;
+
+    size_t const capacity_;
+
+    mutable std::mutex mutex_;
+    // Most recently used first.
+    entry_list entries_;
+    std::unordered_map<libbitcoin::chain::output_point, entry_list::iterator, point_hash> index_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_CACHE_OUTPUT_CACHE_HPP_
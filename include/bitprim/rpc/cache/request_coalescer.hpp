@@ -0,0 +1,100 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_CACHE_REQUEST_COALESCER_HPP_
+#define BITPRIM_RPC_CACHE_REQUEST_COALESCER_HPP_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Requests in flight keyed by method, parameters and chain tip. Identical
+/// requests arriving while one of them is computed wait for its response
+/// instead of computing their own.
+class BCR_API request_coalescer {
+public:
+    /// Shared response, null when it can not be shared and every follower
+    /// has to compute its own.
+    using response_ptr = std::shared_ptr<std::string const>;
+    using follower_handler = std::function<void(response_ptr)>;
+
+    struct flight;
+    using flight_ptr = std::shared_ptr<flight>;
+
+    request_coalescer();
+
+    //non-copyable
+    request_coalescer(request_coalescer const&) = delete;
+    request_coalescer& operator=(request_coalescer const&) = delete;
+
+    /// Follows the chain to keep requests made on different tips apart.
+    void start(libbitcoin::blockchain::block_chain& chain);
+    void stop();
+
+    /// Changes on every new block, part of the keys.
+    size_t generation() const;
+
+    /// Joins the request in flight for key, follower then receives its
+    /// response, and returns null. Otherwise the caller leads a new flight,
+    /// which it ends with complete().
+    flight_ptr join(std::string const& key, follower_handler follower);
+
+    /// No more requests join the flight. Returns whether any did.
+    bool seal(flight_ptr const& leader);
+
+    /// Hands the response to the followers of the flight.
+    void complete(flight_ptr const& leader, response_ptr response);
+
+    /// Flights in progress.
+    size_t size() const;
+
+private:
+    bool handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                           libbitcoin::block_const_ptr_list_const_ptr incoming,
+                           libbitcoin::block_const_ptr_list_const_ptr outgoing);
+
+    // Requires the lock.
+    void unregister(flight& leader);
+
+    std::atomic<bool> stopped_;
+    std::atomic<size_t> generation_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, flight_ptr> flights_;
+};
+
+struct request_coalescer::flight {
+    std::string key;
+    bool sealed;
+    std::vector<follower_handler> followers;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_CACHE_REQUEST_COALESCER_HPP_
@@ -0,0 +1,106 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_CACHE_RESPONSE_CACHE_HPP_
+#define BITPRIM_RPC_CACHE_RESPONSE_CACHE_HPP_
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Serialized responses keyed by method and parameters, evicted least
+/// recently used first once their size goes over the capacity.
+/// Entries depending on the chain tip are dropped on every new block.
+class BCR_API response_cache {
+public:
+    enum class lifetime {
+        // Content addressed (by block or transaction hash), never changes.
+        immutable,
+        // Valid until the next block: heights, confirmations, tip data.
+        tip
+    };
+
+    /// Bookkeeping charged to every entry besides its key and response.
+    static constexpr size_t entry_overhead = 96;
+
+    /// Capacity in bytes.
+    explicit response_cache(size_t capacity);
+
+    //non-copyable
+    response_cache(response_cache const&) = delete;
+    response_cache& operator=(response_cache const&) = delete;
+
+    /// Follows the chain to drop the tip entries on new blocks.
+    void start(libbitcoin::blockchain::block_chain& chain);
+    void stop();
+
+    /// Changes whenever the tip entries are dropped. Responses built
+    /// before a change are not stored as tip entries.
+    size_t generation() const;
+
+    bool find(std::string const& key, std::string& out_response);
+    void insert(std::string const& key, std::string response, lifetime life, size_t generation);
+
+    /// Drops every entry depending on the chain tip.
+    void invalidate_tip();
+
+    /// Bytes in use.
+    size_t size() const;
+
+private:
+    struct entry {
+        std::string key;
+        std::string response;
+        lifetime life;
+    };
+
+    using entry_list = std::list<entry>;
+
+    static size_t charge(entry const& value);
+
+    bool handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                           libbitcoin::block_const_ptr_list_const_ptr incoming,
+                           libbitcoin::block_const_ptr_list_const_ptr outgoing);
+
+    // Both require the lock.
+    void erase(entry_list::iterator it);
+    void evict();
+
+    size_t const capacity_;
+    std::atomic<bool> stopped_;
+    std::atomic<size_t> generation_;
+
+    mutable std::mutex mutex_;
+    // Most recently used first.
+    entry_list entries_;
+    std::unordered_map<std::string, entry_list::iterator> index_;
+    size_t size_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_CACHE_RESPONSE_CACHE_HPP_
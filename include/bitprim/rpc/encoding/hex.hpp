@@ -0,0 +1,70 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_ENCODING_HEX_HPP_
+#define BITPRIM_RPC_ENCODING_HEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <bitcoin/bitcoin.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Base16 kernels, selected once at startup from the CPU features.
+/// SSE2 is the x86-64 baseline; AVX2 is used when the CPU and the OS
+/// support it. Other targets use the scalar kernel.
+enum class hex_kernel {
+    scalar,
+    sse2,
+    avx2
+};
+
+/// Widest kernel supported by the running CPU.
+BCR_API hex_kernel hex_best_kernel();
+
+BCR_API bool hex_kernel_supported(hex_kernel kernel);
+
+/// Writes the lowercase hex of [data, data + size) into out, which must
+/// hold 2 * size chars. The reversed form emits the bytes last to first,
+/// as hashes are displayed.
+BCR_API void hex_encode(uint8_t const* data, size_t size, char* out);
+BCR_API void hex_encode_reversed(uint8_t const* data, size_t size, char* out);
+
+/// Decodes size chars (upper or lowercase) into size / 2 bytes.
+/// Returns false on an odd size or a non hex char; out is then undefined.
+BCR_API bool hex_decode(char const* text, size_t size, uint8_t* out);
+
+/// Same as above, forcing a kernel. Unsupported kernels run the scalar one.
+BCR_API void hex_encode(uint8_t const* data, size_t size, char* out, hex_kernel kernel);
+BCR_API void hex_encode_reversed(uint8_t const* data, size_t size, char* out, hex_kernel kernel);
+BCR_API bool hex_decode(char const* text, size_t size, uint8_t* out, hex_kernel kernel);
+
+/// Drop-in replacements of the libbitcoin base16 helpers.
+BCR_API std::string encode_base16(libbitcoin::data_slice data);
+BCR_API std::string encode_hash(libbitcoin::hash_digest const& hash);
+BCR_API bool decode_base16(libbitcoin::data_chunk& out, std::string const& in);
+BCR_API bool decode_hash(libbitcoin::hash_digest& out, std::string const& in);
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_ENCODING_HEX_HPP_
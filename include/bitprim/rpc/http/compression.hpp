@@ -0,0 +1,83 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_HTTP_COMPRESSION_HPP_
+#define BITPRIM_RPC_HTTP_COMPRESSION_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <bitprim/rpc/define.hpp>
+
+struct z_stream_s;
+
+namespace bitprim { namespace rpc {
+
+/// Content codings of the http responses; deflate is the zlib format.
+enum class content_coding {
+    identity,
+    gzip,
+    deflate
+};
+
+/// Coding an Accept-Encoding header prefers among gzip and deflate,
+/// gzip on ties. Identity when it accepts neither.
+BCR_API content_coding negotiate_coding(std::string const& accept_encoding);
+
+/// Content-Encoding value of a coding.
+BCR_API char const* coding_name(content_coding coding);
+
+/// Compresses a whole body, level goes from 1 (fastest) to 9 (smallest).
+BCR_API std::string compress(std::string const& body, content_coding coding, int level);
+
+/// Compresses a body handed over in pieces. Each write returns the
+/// compressed bytes ready so far, which may be none.
+class BCR_API compressor {
+public:
+    compressor(content_coding coding, int level);
+    ~compressor();
+
+    //non-copyable
+    compressor(compressor const&) = delete;
+    compressor& operator=(compressor const&) = delete;
+
+    std::string write(std::string const& piece);
+
+    /// Compresses the last piece and ends the body.
+    std::string finish(std::string const& piece);
+
+private:
+    std::unique_ptr<z_stream_s> stream_;
+};
+
+/// Compresses the beginning of bodies that only differ in their ending,
+/// such as the cached responses followed by the id of each request.
+/// The result is independent of the coding and completed for each body
+/// by complete_prefix() without compressing the prefix again.
+BCR_API std::string compress_prefix(std::string const& prefix, int level);
+
+/// Body compressed in coding made of a compress_prefix() result followed
+/// by ending, which is stored uncompressed.
+BCR_API std::string complete_prefix(std::string const& compressed_prefix, std::string const& ending, content_coding coding);
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_HTTP_COMPRESSION_HPP_
@@ -22,10 +22,13 @@
 #ifndef BITPRIM_RPC_SERVER_HPP_
 #define	BITPRIM_RPC_SERVER_HPP_
 
+#include <bitprim/rpc/http/compression.hpp>
 #include <bitprim/rpc/http/server_http.hpp>
 
 #include <bitprim/rpc/json/json.hpp>
 #include <bitprim/rpc/messages.hpp>         
+#include <bitprim/rpc/settings.hpp>
+#include <bitprim/rpc/worker_pool.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 #include <bitcoin/network/p2p.hpp>
 #include <bitcoin/node/full_node.hpp>
@@ -33,6 +36,7 @@
 #include <zmq.h>
 #include <unordered_set>
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -45,7 +49,9 @@ public:
     rpc_server(bool use_testnet_rules
             , std::shared_ptr<libbitcoin::node::full_node> & node
             , uint32_t rpc_port
-            , const std::unordered_set<std::string> & rpc_allowed_ips);
+            , const std::unordered_set<std::string> & rpc_allowed_ips
+            , settings const& config = settings()
+            , message_context const& context = message_context());
     //non-copyable
     rpc_server(rpc_server const&) = delete;
     rpc_server& operator=(rpc_server const&) = delete;
@@ -55,7 +61,19 @@ public:
     bool stopped() const;
 
 private:        
+    // Owns the only reference to a response until the reply is written,
+    // even when the completion handler holding it has been copied.
+    using pending_response = std::shared_ptr<std::shared_ptr<HttpServer::Response>>;
+
     void configure_server();
+    void process_request(std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request);
+    void reply(pending_response const& pending, std::string const& header, std::string content);
+    void reply_json(pending_response const& pending, HttpServer::Request const& request, content_coding coding, std::string body);
+
+    // Compresses a response, keeping the compressed body of the cacheable
+    // ones (key not empty) without the id ending them.
+    std::string compress_response(std::string const& response, content_coding coding, std::string const& key,
+                                  std::string const& ending, response_cache::lifetime life, size_t generation);
 
     bool use_testnet_rules_;
     bool stopped_;      
@@ -66,6 +84,14 @@ private:
     std::shared_ptr<libbitcoin::node::full_node> & node_;
     signature_map<libbitcoin::blockchain::block_chain> signature_map_;
     std::unordered_set<std::string> rpc_allowed_ips_;
+    // Only when the context brings no dispatch.
+    std::unique_ptr<worker_pool> workers_;
+    work_dispatcher dispatch_;
+    batch_policy batch_;
+    header_index const* headers_;
+    int compression_level_;
+    size_t compression_threshold_;
+    std::unique_ptr<response_cache> compressed_;
 };
 
 }} // namespace bitprim::rpc
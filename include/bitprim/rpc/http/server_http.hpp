@@ -6,12 +6,16 @@
 #include <boost/functional/hash.hpp>
 
 
+#include <array>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <thread>
 #include <functional>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 
 #ifndef CASE_INSENSITIVE_EQUALS_AND_HASH
@@ -43,8 +47,6 @@ public:
 #define REGEX_NS std
 #endif
 
-#include <boost/regex.hpp>
-
 // TODO when switching to c++14, use [[deprecated]] instead
 #ifndef DEPRECATED
 #ifdef __GNUC__
@@ -56,6 +58,39 @@ public:
 #endif
 #endif
 
+namespace SimpleWeb {
+    /// Match condition for async_read_until finding the end of the header:
+    /// an empty line, ended by \r\n or by a bare \n (CKPool uses \n\n).
+    class match_header_end {
+    public:
+        template <typename Iterator>
+        std::pair<Iterator, bool> operator()(Iterator begin, Iterator end) const {
+            for(auto it=begin; it!=end; ++it) {
+                if(*it!='\n')
+                    continue;
+
+                auto next=it;
+                if(++next==end)
+                    return std::make_pair(it, false);
+                if(*next=='\n')
+                    return std::make_pair(++next, true);
+                if(*next=='\r') {
+                    if(++next==end)
+                        return std::make_pair(it, false);
+                    if(*next=='\n')
+                        return std::make_pair(++next, true);
+                }
+            }
+            return std::make_pair(end, false);
+        }
+    };
+}
+
+namespace boost { namespace asio {
+    template <>
+    struct is_match_condition<SimpleWeb::match_header_end> : public boost::true_type {};
+}}
+
 namespace SimpleWeb {
     template <class socket_type>
     class Server;
@@ -70,13 +105,108 @@ namespace SimpleWeb {
 
             boost::asio::streambuf streambuf;
 
+            std::string body;
+
             std::shared_ptr<socket_type> socket;
 
+            /// Chunks sent ahead of the end of the response and not yet
+            /// written, shared with the connection writing them.
+            class Stream {
+            public:
+                std::mutex mutex;
+                size_t queued=0;
+                size_t window=0;
+                // The connection is gone, nothing more will be written.
+                bool closed=false;
+                // Producers holding back until the stream has room again.
+                std::vector<std::function<void()>> waiting;
+                std::function<void(std::string &&)> sink;
+
+                void written(size_t size) {
+                    std::vector<std::function<void()>> ready;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        queued-=size;
+                        if(queued<window)
+                            ready.swap(waiting);
+                    }
+                    for(auto &resume: ready)
+                        resume();
+                }
+
+                void close() {
+                    std::vector<std::function<void()>> ready;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        closed=true;
+                        ready.swap(waiting);
+                    }
+                    for(auto &resume: ready)
+                        resume();
+                }
+            };
+
+            std::shared_ptr<Stream> stream;
+
+            // Some content went out as chunks, the rest ends the chunked body.
+            bool chunked=false;
+
             Response(const std::shared_ptr<socket_type> &socket): std::ostream(&streambuf), socket(socket) {}
 
+            static void append_chunk(std::string &out, const char *data, size_t size) {
+                std::ostringstream header;
+                header << std::hex << size << "\r\n";
+                out+=header.str();
+                out.append(data, size);
+                out+="\r\n";
+            }
+
         public:
+            /// Sends content ahead of the end of the response, as a chunk of
+            /// a chunked transfer encoding the header written to the stream
+            /// (sent with the first chunk) must announce. Only the header
+            /// goes to the stream, content() then holds the last chunk.
+            ///
+            /// Returns false once more than the stream window is unsent: the
+            /// producer should then hold back until resume is called, from
+            /// the write completion that makes room or when the connection
+            /// goes away, so a slow client neither holds a thread nor makes
+            /// the response pile up in memory.
+            bool chunk(std::string &&content, std::function<void()> resume) {
+                if(content.empty() || !stream)
+                    return true;
+
+                std::string data;
+                if(!chunked) {
+                    chunked=true;
+                    auto const header=streambuf.data();
+                    data.assign(boost::asio::buffers_begin(header), boost::asio::buffers_end(header));
+                    streambuf.consume(streambuf.size());
+                }
+                append_chunk(data, content.data(), content.size());
+
+                bool room;
+                {
+                    std::lock_guard<std::mutex> lock(stream->mutex);
+                    if(stream->closed)
+                        return true;
+                    stream->queued+=data.size();
+                    room=stream->queued<stream->window;
+                    if(!room)
+                        stream->waiting.push_back(std::move(resume));
+                }
+                stream->sink(std::move(data));
+                return room;
+            }
+
             size_t size() {
-                return streambuf.size();
+                return streambuf.size() + body.size();
+            }
+
+            /// Content sent after what was written to the stream, without
+            /// copying it into the stream buffer.
+            void content(std::string &&content) {
+                body = std::move(content);
             }
 
             /// If true, force server to close the connection after the response have been sent.
@@ -112,11 +242,16 @@ namespace SimpleWeb {
 
             std::unordered_multimap<std::string, std::string, case_insensitive_hash, case_insensitive_equals> header;
 
+            /// Only set by regex resources, literal ones are matched without it.
             REGEX_NS::smatch path_match;
 
             std::string remote_endpoint_address;
             unsigned short remote_endpoint_port;
 
+            /// Whether the connection stays open for further requests after
+            /// this one, so the response can say so in its Connection header.
+            bool keep_alive=false;
+
         private:
             Request(const socket_type &socket): content(streambuf) {
                 try {
@@ -127,6 +262,9 @@ namespace SimpleWeb {
             }
 
             boost::asio::streambuf streambuf;
+
+            // Position of the request on its connection.
+            size_t sequence=0;
         };
 
         class Config {
@@ -142,6 +280,14 @@ namespace SimpleWeb {
             size_t timeout_request=60;
             /// Timeout on content handling. Defaults to 300 seconds.
             size_t timeout_content=300;
+            /// Timeout waiting for the next request on a persistent connection with no response pending. Defaults to 30 seconds.
+            size_t timeout_idle=30;
+            /// Requests served on one connection before closing it, 0 for no limit.
+            size_t max_requests_per_connection=0;
+            /// Requests read ahead on a connection while earlier responses are pending. Defaults to 16.
+            size_t max_pipelined_requests=16;
+            /// Bytes of a chunked response waiting for the socket before Response::chunk() asks the producer to hold back. Defaults to 256 KiB.
+            size_t stream_window=256*1024;
             /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
             /// If empty, the address will be any address.
             std::string address;
@@ -152,14 +298,56 @@ namespace SimpleWeb {
         Config config;
 
     private:
+        /// Resource path. Patterns with no regex syntax besides the anchors
+        /// and a trailing ".*" (the ones registered by rpc_server, "^/json$")
+        /// are compared as literals, only the others run the regex.
         class regex_orderable : public REGEX_NS::regex {
+        public:
+            enum class kind { exact, prefix, regex };
+        private:
             std::string str;
+            std::string literal;
+            kind match_kind;
+
+            void analyze() {
+                auto pattern=str;
+                if(!pattern.empty() && pattern.front()=='^')
+                    pattern.erase(0, 1);
+                if(!pattern.empty() && pattern.back()=='$' && (pattern.size()<2 || pattern[pattern.size()-2]!='\\'))
+                    pattern.pop_back();
+
+                match_kind=kind::exact;
+                if(pattern.size()>=2 && pattern.compare(pattern.size()-2, 2, ".*")==0) {
+                    pattern.erase(pattern.size()-2);
+                    match_kind=kind::prefix;
+                }
+
+                if(pattern.find_first_of(".[]{}()\\*+?|^$")!=std::string::npos)
+                    match_kind=kind::regex;
+                else
+                    literal=std::move(pattern);
+            }
         public:
-            regex_orderable(const char *regex_cstr) : REGEX_NS::regex(regex_cstr), str(regex_cstr) {}
-            regex_orderable(const std::string &regex_str) : REGEX_NS::regex(regex_str), str(regex_str) {}
+            regex_orderable(const char *regex_cstr) : REGEX_NS::regex(regex_cstr), str(regex_cstr) { analyze(); }
+            regex_orderable(const std::string &regex_str) : REGEX_NS::regex(regex_str), str(regex_str) { analyze(); }
             bool operator<(const regex_orderable &rhs) const {
                 return str<rhs.str;
             }
+
+            kind type() const {
+                return match_kind;
+            }
+
+            bool match(const std::string &path, REGEX_NS::smatch &path_match) const {
+                switch(match_kind) {
+                    case kind::exact:
+                        return path==literal;
+                    case kind::prefix:
+                        return path.compare(0, literal.size(), literal)==0;
+                    default:
+                        return REGEX_NS::regex_match(path, path_match, *this);
+                }
+            }
         };
     public:
         /// Warning: do not add or remove resources after start() is called
@@ -221,7 +409,21 @@ namespace SimpleWeb {
 
         ///Use this function if you need to recursively send parts of a longer message
         void send(const std::shared_ptr<Response> &response, const std::function<void(const boost::system::error_code&)>& callback=nullptr) const {
-            boost::asio::async_write(*response->socket, response->streambuf, [this, response, callback](const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
+            if(response->body.empty()) {
+                boost::asio::async_write(*response->socket, response->streambuf, [this, response, callback](const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
+                    if(callback)
+                        callback(ec);
+                });
+                return;
+            }
+
+            std::array<boost::asio::const_buffer, 2> buffers{{
+                response->streambuf.data(),
+                boost::asio::buffer(static_cast<const std::string&>(response->body))
+            }};
+            boost::asio::async_write(*response->socket, buffers, [this, response, callback](const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
+                response->streambuf.consume(response->streambuf.size());
+                response->body.clear();
                 if(callback)
                     callback(ec);
             });
@@ -238,102 +440,214 @@ namespace SimpleWeb {
 
         virtual void accept()=0;
 
-        std::shared_ptr<boost::asio::deadline_timer> get_timeout_timer(const std::shared_ptr<socket_type> &socket, long seconds) {
+        /// State of a persistent connection. Requests are read ahead while
+        /// earlier ones are being handled (pipelining) and their responses
+        /// written in request order. Only touched from its strand.
+        class Connection {
+        public:
+            Connection(const std::shared_ptr<socket_type> &socket, boost::asio::io_service &io_service): socket(socket), strand(io_service) {}
+
+            std::shared_ptr<socket_type> socket;
+            boost::asio::io_service::strand strand;
+            // Bytes read past the end of the previous request.
+            std::string leftover;
+            // Requests read so far, and the next one to get its response written.
+            size_t requests=0;
+            size_t next_response=0;
+            // Responses completed ahead of an earlier one, with their request
+            // and the timer bounding their handling and writing.
+            struct Completed {
+                std::shared_ptr<Response> response;
+                std::shared_ptr<Request> request;
+                std::shared_ptr<boost::asio::deadline_timer> timer;
+            };
+            std::map<size_t, Completed> completed;
+            // Streams of the responses not written yet, and the chunks
+            // they sent ahead of completing.
+            std::map<size_t, std::shared_ptr<typename Response::Stream>> streams;
+            std::map<size_t, std::deque<std::string>> chunks;
+            bool reading=false;
+            bool writing=false;
+            // Bounds the wait for the header of the request being read.
+            std::shared_ptr<boost::asio::deadline_timer> read_timer;
+            // No more requests are read from the connection.
+            bool closing=false;
+        };
+
+        std::shared_ptr<boost::asio::deadline_timer> get_timeout_timer(const std::shared_ptr<Connection> &connection, long seconds) {
             if(seconds==0)
                 return nullptr;
 
             auto timer=std::make_shared<boost::asio::deadline_timer>(*io_service);
             timer->expires_from_now(boost::posix_time::seconds(seconds));
-            timer->async_wait([socket](const boost::system::error_code& ec){
-                if(!ec) {
-                    boost::system::error_code ec;
-                    socket->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-                    socket->lowest_layer().close();
-                }
-            });
+            timer->async_wait(connection->strand.wrap([connection](const boost::system::error_code& ec){
+                if(!ec)
+                    close(connection);
+            }));
             return timer;
         }
 
+        static void close(const std::shared_ptr<Connection> &connection) {
+            boost::system::error_code ec;
+            connection->closing=true;
+            // Closing a stream may resume its producer right here.
+            auto streams=std::move(connection->streams);
+            connection->streams.clear();
+            connection->chunks.clear();
+            for(auto &stream: streams)
+                stream.second->close();
+            connection->socket->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            connection->socket->lowest_layer().close(ec);
+        }
 
-        void read_request_and_content(const std::shared_ptr<socket_type> &socket) {
+        void read_request_and_content(const std::shared_ptr<Connection> &connection) {
             //Create new streambuf (Request::streambuf) for async_read_until()
             //shared_ptr is used to pass temporary objects to the asynchronous functions
+            auto socket=connection->socket;
             std::shared_ptr<Request> request(new Request(*socket));
+            // Responses still to be written when the read starts.
+            auto const pending=connection->requests-connection->next_response;
+            request->sequence=connection->requests++;
+            connection->reading=true;
+
+            // Pipelined requests may already be (partly) read.
+            if(!connection->leftover.empty()) {
+                auto const size=connection->leftover.size();
+                boost::asio::buffer_copy(request->streambuf.prepare(size), boost::asio::buffer(connection->leftover));
+                request->streambuf.commit(size);
+                connection->leftover.clear();
+            }
 
-            //Set timeout on the following boost::asio::async-read or write function
-            auto timer=this->get_timeout_timer(socket, config.timeout_request);
-
-
+            // The idle timeout only applies to a connection with nothing in
+            // flight, its timer closing the connection would lose responses.
+            auto const timeout=request->sequence==0 ? config.timeout_request : pending==0 ? config.timeout_idle : config.timeout_content;
+            connection->read_timer=this->get_timeout_timer(connection, timeout);
 
-//            std::pair<iterator, bool>
-//            match_whitespace(iterator begin, iterator end) {
-//                iterator i = begin;
-//                while (i != end)
-//                    if (std::isspace(*i++))
-//                        return std::make_pair(i, true);
-//                return std::make_pair(i, false);
-//            }
+            //CKPool uses \n\n instead of \r\n\r\n
+            boost::asio::async_read_until(*socket, request->streambuf, match_header_end(),
+                                          connection->strand.wrap([this, connection, request](const boost::system::error_code& ec, size_t bytes_transferred) {
+                                              if(connection->read_timer) {
+                                                  connection->read_timer->cancel();
+                                                  connection->read_timer=nullptr;
+                                              }
+                                              if(ec) {
+                                                  connection->closing=true;
+                                                  if(on_error)
+                                                      on_error(request, ec);
+                                                  return;
+                                              }
 
+                                              //request->streambuf.size() is not necessarily the same as bytes_transferred, from Boost-docs:
+                                              //"After a successful async_read_until operation, the streambuf may contain additional data beyond the delimiter"
+                                              //The chosen solution is to extract lines from the stream directly when parsing the header. What is left of the
+                                              //streambuf (maybe some bytes of the content) is appended to in the async_read-function below (for retrieving content).
+                                              auto const total_bytes=request->streambuf.size();
 
+                                              if(!this->parse_request(request)) {
+                                                  connection->closing=true;
+                                                  return;
+                                              }
 
-            //CKPool uses \n\n instead of \r\n\r\n
-//            boost::asio::async_read_until(*socket, request->streambuf, "\r\n\r\n",
-//            boost::asio::async_read_until(*socket, request->streambuf, "\n\n",
-//            boost::asio::async_read_until(*socket, request->streambuf, match_double_eol(),
-
-            boost::regex const e("(\\r\\n\\r\\n|\\n\\r\\n|\\r\\n\\n|\\n\\n)");
-
-            boost::asio::async_read_until(*socket, request->streambuf, e,
-                                          [this, socket, request, timer](const boost::system::error_code& ec, size_t bytes_transferred) {
-                                              if(timer)
-                                                  timer->cancel();
-                                              if(!ec) {
-                                                  //request->streambuf.size() is not necessarily the same as bytes_transferred, from Boost-docs:
-                                                  //"After a successful async_read_until operation, the streambuf may contain additional data beyond the delimiter"
-                                                  //The chosen solution is to extract lines from the stream directly when parsing the header. What is left of the
-                                                  //streambuf (maybe some bytes of the content) is appended to in the async_read-function below (for retrieving content).
-                                                  size_t num_additional_bytes=request->streambuf.size()-bytes_transferred;
-
-                                                  if(!this->parse_request(request))
+                                              // Skip what the parser left of the header.
+                                              auto const parsed=total_bytes-request->streambuf.size();
+                                              if(parsed<bytes_transferred)
+                                                  request->streambuf.consume(bytes_transferred-parsed);
+                                              size_t num_additional_bytes=request->streambuf.size();
+
+                                              //If content, read that as well
+                                              unsigned long long content_length=0;
+                                              auto it=request->header.find("Content-Length");
+                                              if(it!=request->header.end()) {
+                                                  try {
+                                                      content_length=stoull(it->second);
+                                                  } catch (std::exception const&) {
+                                                      connection->closing=true;
+                                                      if(on_error)
+                                                          on_error(request, boost::system::error_code(boost::system::errc::protocol_error, boost::system::generic_category()));
                                                       return;
-
-                                                  //If content, read that as well
-                                                  auto it=request->header.find("Content-Length");
-                                                  if(it!=request->header.end()) {
-                                                      unsigned long long content_length;
-                                                      try {
-                                                          content_length=stoull(it->second);
-                                                      } catch (std::exception const&) {
-                                                          if(on_error)
-                                                              on_error(request, boost::system::error_code(boost::system::errc::protocol_error, boost::system::generic_category()));
-                                                          return;
-                                                      }
-
-                                                      if(content_length>num_additional_bytes) {
-//                            std::cout << "content_length > num_additional_bytes" << std::endl;
-                                                          //Set timeout on the following boost::asio::async-read or write function
-                                                          auto timer=this->get_timeout_timer(socket, config.timeout_content);
-                                                          boost::asio::async_read(*socket, request->streambuf,
-                                                                                  boost::asio::transfer_exactly(content_length-num_additional_bytes),
-                                                                                  [this, socket, request, timer]
-                                                                                          (const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
-                                                                                      if(timer)
-                                                                                          timer->cancel();
-                                                                                      if(!ec)
-                                                                                          this->find_resource(socket, request);
-                                                                                      else if(on_error)
-                                                                                          on_error(request, ec);
-                                                                                  });
-                                                      }
-                                                      else
-                                                          this->find_resource(socket, request);
                                                   }
-                                                  else
-                                                      this->find_resource(socket, request);
                                               }
-                                              else if(on_error)
-                                                  on_error(request, ec);
-                                          });
+
+                                              if(content_length>num_additional_bytes) {
+                                                  //Set timeout on the following boost::asio::async-read or write function
+                                                  auto timer=this->get_timeout_timer(connection, config.timeout_content);
+                                                  boost::asio::async_read(*connection->socket, request->streambuf,
+                                                                          boost::asio::transfer_exactly(content_length-num_additional_bytes),
+                                                                          connection->strand.wrap([this, connection, request, timer]
+                                                                                  (const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
+                                                                              if(timer)
+                                                                                  timer->cancel();
+                                                                              if(!ec)
+                                                                                  this->request_read(connection, request, request->streambuf.size());
+                                                                              else {
+                                                                                  connection->closing=true;
+                                                                                  if(on_error)
+                                                                                      on_error(request, ec);
+                                                                              }
+                                                                          }));
+                                              }
+                                              else
+                                                  this->request_read(connection, request, content_length);
+                                          }));
+        }
+
+        // Keeps the bytes following the content for the next request,
+        // decides whether the connection persists and dispatches the request.
+        void request_read(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request, size_t content_length) {
+            connection->reading=false;
+
+            auto const size=request->streambuf.size();
+            if(size>content_length) {
+                auto const data=request->streambuf.data();
+                std::string buffered(boost::asio::buffers_begin(data), boost::asio::buffers_end(data));
+                request->streambuf.consume(size);
+                boost::asio::buffer_copy(request->streambuf.prepare(content_length), boost::asio::buffer(buffered.data(), content_length));
+                request->streambuf.commit(content_length);
+                connection->leftover=buffered.substr(content_length);
+            }
+
+            request->keep_alive=keep_alive(*request);
+            if(!request->keep_alive)
+                connection->closing=true;
+
+            this->find_resource(connection, request);
+            this->read_next(connection);
+        }
+
+        // HTTP/1.1 connections persist unless closed by either side, HTTP/1.0
+        // ones only when asked to.
+        bool keep_alive(const Request &request) const {
+            if(config.max_requests_per_connection!=0 && request.sequence+1>=config.max_requests_per_connection)
+                return false;
+
+            float http_version;
+            try {
+                http_version=stof(request.http_version);
+            }
+            catch(const std::exception &) {
+                return false;
+            }
+
+            bool keep_alive=http_version>1.05;
+            auto range=request.header.equal_range("Connection");
+            for(auto it=range.first;it!=range.second;it++) {
+                if(boost::iequals(it->second, "close"))
+                    return false;
+                if(boost::iequals(it->second, "keep-alive"))
+                    keep_alive=true;
+            }
+            return keep_alive;
+        }
+
+        // Reads the next request unless the connection is closing, a read is
+        // in progress or too many responses are pending.
+        void read_next(const std::shared_ptr<Connection> &connection) {
+            if(connection->closing || connection->reading)
+                return;
+            auto const pending=connection->requests-connection->next_response;
+            if(pending>=std::max<size_t>(config.max_pipelined_requests, 1))
+                return;
+            this->read_request_and_content(connection);
         }
 
         bool parse_request(const std::shared_ptr<Request> &request) const {
@@ -387,12 +701,13 @@ namespace SimpleWeb {
             return true;
         }
 
-        void find_resource(const std::shared_ptr<socket_type> &socket, const std::shared_ptr<Request> &request) {
+        void find_resource(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {
             //Upgrade connection
             if(on_upgrade) {
                 auto it=request->header.find("Upgrade");
                 if(it!=request->header.end()) {
-                    on_upgrade(socket, request);
+                    connection->closing=true;
+                    on_upgrade(connection->socket, request);
                     return;
                 }
             }
@@ -401,57 +716,61 @@ namespace SimpleWeb {
                 auto it=regex_method.second.find(request->method);
                 if(it!=regex_method.second.end()) {
                     REGEX_NS::smatch sm_res;
-                    if(REGEX_NS::regex_match(request->path, sm_res, regex_method.first)) {
+                    if(regex_method.first.match(request->path, sm_res)) {
                         request->path_match=std::move(sm_res);
-                        write_response(socket, request, it->second);
+                        write_response(connection, request, it->second);
                         return;
                     }
                 }
             }
             auto it=default_resource.find(request->method);
             if(it!=default_resource.end()) {
-                write_response(socket, request, it->second);
+                write_response(connection, request, it->second);
+            }
+            else {
+                // Nothing will answer, later responses must not wait for it.
+                connection->closing=true;
             }
         }
 
-        void write_response(const std::shared_ptr<socket_type> &socket, const std::shared_ptr<Request> &request,
+        void write_response(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
                             std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>,
                                                std::shared_ptr<typename ServerBase<socket_type>::Request>)>& resource_function) {
             //Set timeout on the following boost::asio::async-read or write function
-            auto timer=this->get_timeout_timer(socket, config.timeout_content);
+            auto timer=this->get_timeout_timer(connection, config.timeout_content);
 
-            auto response=std::shared_ptr<Response>(new Response(socket), [this, request, timer](Response *response_ptr) {
+            // The response is complete when its last reference goes away, from
+            // whatever thread; it is queued on the connection in request order.
+            auto response=std::shared_ptr<Response>(new Response(connection->socket), [this, connection, request, timer](Response *response_ptr) {
                 auto response=std::shared_ptr<Response>(response_ptr);
-                this->send(response, [this, response, request, timer](const boost::system::error_code& ec) {
-                    if(timer)
-                        timer->cancel();
-                    if(!ec) {
-                        float http_version;
-                        try {
-                            http_version=stof(request->http_version);
-                        }
-                        catch(const std::exception &e){
-                            if(on_error)
-                                on_error(request, boost::system::error_code(boost::system::errc::protocol_error, boost::system::generic_category()));
-                            return;
-                        }
-
-                        if (response->close_connection_after_response)
-                            return;
-
-                        auto range=request->header.equal_range("Connection");
-                        for(auto it=range.first;it!=range.second;it++) {
-                            if(boost::iequals(it->second, "close"))
-                                return;
-                        }
-                        if(http_version>1.05)
-                            this->read_request_and_content(response->socket);
-                    }
-                    else if(on_error)
-                        on_error(request, ec);
+                connection->strand.dispatch([this, connection, request, response, timer]() {
+                    connection->completed[request->sequence]={response, request, timer};
+                    this->write_next(connection);
                 });
             });
 
+            auto const sequence=request->sequence;
+            auto stream=std::make_shared<typename Response::Stream>();
+            stream->window=std::max<size_t>(config.stream_window, 1);
+            std::weak_ptr<Connection> weak_connection=connection;
+            stream->sink=[this, weak_connection, sequence](std::string &&chunk) {
+                auto connection=weak_connection.lock();
+                if(!connection)
+                    return;
+                auto data=std::make_shared<std::string>(std::move(chunk));
+                connection->strand.dispatch([this, connection, sequence, data]() {
+                    if(connection->streams.find(sequence)==connection->streams.end())
+                        return;
+                    connection->chunks[sequence].push_back(std::move(*data));
+                    this->write_next(connection);
+                });
+            };
+            response->stream=stream;
+            if(connection->socket->lowest_layer().is_open())
+                connection->streams[sequence]=stream;
+            else
+                stream->close();
+
             try {
                 resource_function(response, request);
             }
@@ -461,6 +780,88 @@ namespace SimpleWeb {
                 return;
             }
         }
+
+        // Writes the next response in request order, one at a time, and the
+        // chunks it sends ahead of completing as they come.
+        void write_next(const std::shared_ptr<Connection> &connection) {
+            if(connection->writing)
+                return;
+
+            auto const sequence=connection->next_response;
+            auto chunks=connection->chunks.find(sequence);
+            if(chunks!=connection->chunks.end() && !chunks->second.empty()) {
+                auto data=std::make_shared<std::string>(std::move(chunks->second.front()));
+                chunks->second.pop_front();
+                auto stream=connection->streams.at(sequence);
+                connection->writing=true;
+                boost::asio::async_write(*connection->socket, boost::asio::buffer(*data), connection->strand.wrap([this, connection, data, stream](const boost::system::error_code& ec, size_t /*bytes_transferred*/) {
+                    connection->writing=false;
+                    stream->written(data->size());
+                    if(ec) {
+                        close(connection);
+                        return;
+                    }
+                    this->write_next(connection);
+                }));
+                return;
+            }
+
+            auto it=connection->completed.find(sequence);
+            if(it==connection->completed.end())
+                return;
+
+            auto response=it->second.response;
+            auto request=it->second.request;
+            auto timer=it->second.timer;
+            connection->completed.erase(it);
+            connection->chunks.erase(sequence);
+            connection->streams.erase(sequence);
+            connection->writing=true;
+
+            // The content of a chunked response is its last chunk.
+            if(response->chunked) {
+                std::string last;
+                auto const rest=response->streambuf.data();
+                std::string pending(boost::asio::buffers_begin(rest), boost::asio::buffers_end(rest));
+                response->streambuf.consume(response->streambuf.size());
+                pending+=response->body;
+                if(!pending.empty())
+                    Response::append_chunk(last, pending.data(), pending.size());
+                last+="0\r\n\r\n";
+                response->body=std::move(last);
+            }
+
+            this->send(response, connection->strand.wrap([this, connection, response, request, timer](const boost::system::error_code& ec) {
+                if(timer)
+                    timer->cancel();
+                connection->writing=false;
+                ++connection->next_response;
+                if(ec) {
+                    close(connection);
+                    if(on_error)
+                        on_error(request, ec);
+                    return;
+                }
+
+                if(response->close_connection_after_response || !request->keep_alive) {
+                    close(connection);
+                    return;
+                }
+
+                this->write_next(connection);
+                this->read_next(connection);
+                this->idle(connection);
+            }));
+        }
+
+        // Once the last pending response is written, the wait for the next
+        // request is bounded by the idle timeout instead.
+        void idle(const std::shared_ptr<Connection> &connection) {
+            if(!connection->read_timer || connection->requests-connection->next_response>1)
+                return;
+            connection->read_timer->cancel();
+            connection->read_timer=this->get_timeout_timer(connection, config.timeout_idle);
+        }
     };
 
     template<class socket_type>
@@ -496,7 +897,7 @@ namespace SimpleWeb {
                     boost::asio::ip::tcp::no_delay option(true);
                     socket->set_option(option);
 
-                    this->read_request_and_content(socket);
+                    this->read_request_and_content(std::make_shared<Connection>(socket, *io_service));
                 }
                 else if(on_error)
                     on_error(std::shared_ptr<Request>(new Request(*socket)), ec);
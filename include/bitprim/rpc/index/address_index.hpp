@@ -0,0 +1,164 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_INDEX_ADDRESS_INDEX_HPP_
+#define BITPRIM_RPC_INDEX_ADDRESS_INDEX_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// In-memory balance, unspent outputs and deltas of every address of the
+/// confirmed chain, keyed like the chain history (address hash).
+/// Built by walking the chain once on its own thread and kept in sync from
+/// the blockchain subscription, undoing reorganized blocks from their undo
+/// records.
+class BCR_API address_index {
+public:
+    struct utxo {
+        libbitcoin::chain::output_point point;
+        uint64_t value;
+        size_t height;
+        libbitcoin::data_chunk script;
+    };
+
+    struct delta {
+        libbitcoin::hash_digest hash;
+        uint32_t index;
+        size_t height;
+        size_t position;
+        // Negative when the output is spent.
+        int64_t satoshis;
+    };
+
+    /// Blocks kept for undoing reorganizations; a deeper one rebuilds the index.
+    static constexpr size_t undo_depth = 100;
+
+    /// Reads the block at a height, not_found past the top of the chain.
+    using block_fetcher = std::function<void(size_t, libbitcoin::blockchain::safe_chain::block_fetch_handler)>;
+
+    /// Registers the handler of the chain reorganizations.
+    using subscriber = std::function<void(libbitcoin::blockchain::safe_chain::reorganize_handler)>;
+
+    explicit address_index(libbitcoin::blockchain::block_chain& chain);
+    address_index(subscriber subscribe, block_fetcher fetch_block);
+    ~address_index();
+
+    //non-copyable
+    address_index(address_index const&) = delete;
+    address_index& operator=(address_index const&) = delete;
+
+    void start();
+    void stop();
+
+    /// False while the index is still catching up with the chain.
+    bool ready() const;
+
+    // Queries fail while the index is not ready, callers fall back to the chain.
+    bool balance(libbitcoin::short_hash const& address, uint64_t& out_balance, uint64_t& out_received) const;
+    bool unspent(libbitcoin::short_hash const& address, std::vector<utxo>& out_utxos) const;
+    bool deltas(libbitcoin::short_hash const& address, size_t start_height, size_t end_height, std::vector<delta>& out_deltas) const;
+
+    /// Height and hash of the last indexed block.
+    bool top(size_t& out_height, libbitcoin::hash_digest& out_hash) const;
+
+private:
+    struct short_hash_hasher {
+        size_t operator()(libbitcoin::short_hash const& hash) const {
+            size_t value;
+            std::memcpy(&value, hash.data(), sizeof(value));
+            return value;
+        }
+    };
+
+    struct point_hasher {
+        size_t operator()(libbitcoin::chain::output_point const& point) const {
+            size_t value;
+            std::memcpy(&value, point.hash().data(), sizeof(value));
+            return value ^ point.index();
+        }
+    };
+
+    struct output_record {
+        libbitcoin::short_hash address;
+        uint64_t value;
+        size_t height;
+        libbitcoin::data_chunk script;
+    };
+
+    struct address_record {
+        uint64_t balance = 0;
+        uint64_t received = 0;
+        std::unordered_set<libbitcoin::chain::output_point, point_hasher> unspent;
+        std::vector<delta> deltas;
+    };
+
+    struct block_undo {
+        libbitcoin::hash_digest previous;
+        std::vector<std::pair<libbitcoin::chain::output_point, output_record>> spent;
+        std::vector<libbitcoin::chain::output_point> created;
+        std::vector<libbitcoin::short_hash> touched;
+    };
+
+    void load();
+    void build();
+    bool read_block(size_t height, libbitcoin::code& out_ec, libbitcoin::block_const_ptr& out_block) const;
+    bool handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                           libbitcoin::block_const_ptr_list_const_ptr incoming,
+                           libbitcoin::block_const_ptr_list_const_ptr outgoing);
+
+    // Both require the exclusive lock.
+    void apply(libbitcoin::chain::block const& block, size_t height);
+    void undo();
+    void reset();
+
+    subscriber subscribe_;
+    block_fetcher fetch_block_;
+    std::atomic<bool> stopped_;
+    std::atomic<bool> ready_;
+    std::thread loader_;
+
+    mutable boost::shared_mutex mutex_;
+    // Set while the loader walks the chain, it sleeps on wake_ otherwise.
+    bool building_;
+    std::condition_variable_any wake_;
+    size_t next_height_;
+    libbitcoin::hash_digest tip_hash_;
+    std::deque<block_undo> undo_;
+    std::unordered_map<libbitcoin::chain::output_point, output_record, point_hasher> outputs_;
+    std::unordered_map<libbitcoin::short_hash, address_record, short_hash_hasher> addresses_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_INDEX_ADDRESS_INDEX_HPP_
@@ -0,0 +1,119 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_INDEX_HEADER_INDEX_HPP_
+#define BITPRIM_RPC_INDEX_HEADER_INDEX_HPP_
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Timestamp and hash of every block of the chain in contiguous arrays
+/// indexed by height, along with its median time past and chainwork.
+/// Loaded from the header reads at startup and kept in sync from the
+/// blockchain subscription.
+class BCR_API header_index {
+public:
+    struct entry {
+        uint32_t timestamp;
+        libbitcoin::hash_digest hash;
+    };
+
+    /// Big endian, as it is displayed.
+    using work = libbitcoin::byte_array<32>;
+
+    /// What the verbose block and header responses derive from the chain
+    /// around a header, rather than from the header itself.
+    struct record {
+        libbitcoin::hash_digest hash;
+        libbitcoin::hash_digest next_hash;
+        bool has_next;
+        uint32_t median_time;
+        work chainwork;
+        size_t top_height;
+    };
+
+    /// Reads the header at a height, fails past the top of the chain.
+    using header_reader = std::function<bool(libbitcoin::chain::header&, size_t)>;
+
+    /// Registers the handler of the chain reorganizations.
+    using subscriber = std::function<void(libbitcoin::blockchain::safe_chain::reorganize_handler)>;
+
+    explicit header_index(libbitcoin::blockchain::block_chain& chain);
+    header_index(subscriber subscribe, header_reader read_header);
+    ~header_index();
+
+    //non-copyable
+    header_index(header_index const&) = delete;
+    header_index& operator=(header_index const&) = delete;
+
+    void start();
+    void stop();
+
+    /// False while the index is still loading.
+    bool ready() const;
+
+    /// Blocks with low <= timestamp <= high, in height order.
+    /// Fails while the index is not ready, callers fall back to the chain.
+    bool blocks(uint32_t low, uint32_t high, std::vector<entry>& out_blocks) const;
+
+    /// Record of the block at height, if it is the one with this hash.
+    /// Fails while the index is not ready, callers fall back to the chain.
+    bool find(size_t height, libbitcoin::hash_digest const& hash, record& out_record) const;
+
+    /// Height and hash of the last indexed block.
+    bool top(size_t& out_height, libbitcoin::hash_digest& out_hash) const;
+
+private:
+    void load();
+    bool handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                           libbitcoin::block_const_ptr_list_const_ptr incoming,
+                           libbitcoin::block_const_ptr_list_const_ptr outgoing);
+
+    // Both require the exclusive lock. Only headers extending the top are appended.
+    bool append(libbitcoin::chain::header const& header);
+    void truncate(size_t height);
+
+    subscriber subscribe_;
+    header_reader read_header_;
+    std::atomic<bool> stopped_;
+    std::atomic<bool> ready_;
+    std::thread loader_;
+
+    mutable boost::shared_mutex mutex_;
+    std::vector<entry> entries_;
+    // Highest timestamp up to each height. Unlike the block timestamps it
+    // never decreases, so range starts are found by binary search.
+    std::vector<uint32_t> max_timestamps_;
+    std::vector<uint32_t> median_times_;
+    std::vector<work> chainwork_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_INDEX_HEADER_INDEX_HPP_
@@ -0,0 +1,322 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_JSON_JSON_WRITER_HPP_
+#define BITPRIM_RPC_JSON_JSON_WRITER_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/json/json.hpp>
+
+namespace bitprim {
+
+// Serializes JSON as it is emitted, straight into a single string buffer,
+// so large results never exist as a DOM or as intermediate strings.
+// Separators are handled by the writer; callers only keep keys and
+// values balanced.
+class json_writer {
+public:
+    explicit json_writer(size_t capacity = 0) {
+        buffer_.reserve(capacity);
+    }
+
+    // Hands the buffer over to sink each time it reaches chunk_size, so a
+    // large document goes out while it is being written; release() then
+    // only returns what is left.
+    void stream(std::function<void(std::string)> sink, size_t chunk_size) {
+        sink_ = std::move(sink);
+        chunk_size_ = std::max<size_t>(chunk_size, 64);
+    }
+
+    void begin_object() {
+        separator();
+        buffer_.push_back('{');
+        first_.push_back(true);
+    }
+
+    void end_object() {
+        buffer_.push_back('}');
+        first_.pop_back();
+    }
+
+    void begin_array() {
+        separator();
+        buffer_.push_back('[');
+        first_.push_back(true);
+    }
+
+    void end_array() {
+        buffer_.push_back(']');
+        first_.pop_back();
+    }
+
+    void key(char const* name) {
+        separator();
+        quoted(name, std::char_traits<char>::length(name));
+        buffer_.push_back(':');
+        after_key_ = true;
+    }
+
+    void key(std::string const& name) {
+        separator();
+        quoted(name.data(), name.size());
+        buffer_.push_back(':');
+        after_key_ = true;
+    }
+
+    void string(char const* text) {
+        separator();
+        quoted(text, std::char_traits<char>::length(text));
+    }
+
+    void string(std::string const& text) {
+        separator();
+        quoted(text.data(), text.size());
+    }
+
+    template <typename Integer>
+    typename std::enable_if<std::is_integral<Integer>::value && std::is_unsigned<Integer>::value>::type
+    number(Integer value) {
+        separator();
+        append_unsigned(value);
+    }
+
+    template <typename Integer>
+    typename std::enable_if<std::is_integral<Integer>::value && std::is_signed<Integer>::value>::type
+    number(Integer value) {
+        separator();
+        if (value < 0) {
+            buffer_.push_back('-');
+            append_unsigned(0 - static_cast<uint64_t>(value));
+        } else {
+            append_unsigned(static_cast<uint64_t>(value));
+        }
+    }
+
+    // Same formatting as the DOM, so both paths produce the same text.
+    void number(double value) {
+        separator();
+        buffer_ += nlohmann::json(value).dump();
+    }
+
+    void boolean(bool value) {
+        separator();
+        buffer_ += value ? "true" : "false";
+    }
+
+    void null() {
+        separator();
+        buffer_ += "null";
+    }
+
+    void value(nlohmann::json const& value) {
+        separator();
+        buffer_ += value.dump();
+    }
+
+    // Appends a value, or a comma separated run of them, serialized
+    // beforehand by another writer.
+    void raw(std::string const& json) {
+        separator();
+        buffer_ += json;
+    }
+
+    // Quoted lowercase hex of the bytes, in order or reversed (hashes),
+    // encoded in place by the hex codec.
+    void hex(uint8_t const* data, size_t size) {
+        separator();
+        append_hex(data, size, false);
+    }
+
+    template <typename Container>
+    void hex(Container const& data) {
+        hex(data.data(), data.size());
+    }
+
+    void hex_reversed(uint8_t const* data, size_t size) {
+        separator();
+        append_hex(data, size, true);
+    }
+
+    template <typename Container>
+    void hex_reversed(Container const& data) {
+        hex_reversed(data.data(), data.size());
+    }
+
+    // Quoted hex of data written in parts, hex_part() between the quotes.
+    void begin_hex() {
+        separator();
+        buffer_.push_back('"');
+    }
+
+    void hex_part(uint8_t const* data, size_t size) {
+        if (sink_) {
+            append_hex_run(data, size, false);
+            return;
+        }
+        auto const offset = buffer_.size();
+        buffer_.resize(offset + 2 * size);
+        rpc::hex_encode(data, size, &buffer_[offset]);
+    }
+
+    void end_hex() {
+        buffer_.push_back('"');
+    }
+
+    std::string& buffer() {
+        return buffer_;
+    }
+
+    std::string release() {
+        first_.clear();
+        after_key_ = false;
+        return std::move(buffer_);
+    }
+
+private:
+    void flush() {
+        if (sink_ && buffer_.size() >= chunk_size_) {
+            auto const capacity = buffer_.capacity();
+            sink_(std::move(buffer_));
+            buffer_ = std::string();
+            buffer_.reserve(capacity);
+        }
+    }
+
+    void separator() {
+        flush();
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (first_.empty()) {
+            return;
+        }
+        if (first_.back()) {
+            first_.back() = false;
+        } else {
+            buffer_.push_back(',');
+        }
+    }
+
+    void append_unsigned(uint64_t value) {
+        char digits[20];
+        size_t size = 0;
+        do {
+            digits[size++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (size != 0) {
+            buffer_.push_back(digits[--size]);
+        }
+    }
+
+    void append_hex(uint8_t const* data, size_t size, bool reversed) {
+        // Streamed documents encode long data piece by piece.
+        if (sink_ && 2 * size > chunk_size_) {
+            buffer_.push_back('"');
+            append_hex_run(data, size, reversed);
+            buffer_.push_back('"');
+            return;
+        }
+
+        auto const offset = buffer_.size();
+        buffer_.resize(offset + 2 * size + 2);
+        auto const out = &buffer_[offset];
+        out[0] = '"';
+        if (reversed) {
+            rpc::hex_encode_reversed(data, size, out + 1);
+        } else {
+            rpc::hex_encode(data, size, out + 1);
+        }
+        out[2 * size + 1] = '"';
+    }
+
+    // Unquoted hex, flushed whenever the buffer fills up.
+    void append_hex_run(uint8_t const* data, size_t size, bool reversed) {
+        for (size_t done = 0; done < size;) {
+            flush();
+            auto const room = (chunk_size_ - std::min(chunk_size_, buffer_.size())) / 2;
+            auto const count = std::min(std::max<size_t>(room, 1), size - done);
+            auto const offset = buffer_.size();
+            buffer_.resize(offset + 2 * count);
+            if (reversed) {
+                rpc::hex_encode_reversed(data + size - done - count, count, &buffer_[offset]);
+            } else {
+                rpc::hex_encode(data + done, count, &buffer_[offset]);
+            }
+            done += count;
+        }
+    }
+
+    void append_hex_byte(uint8_t byte) {
+        static char const digits[] = "0123456789abcdef";
+        buffer_.push_back(digits[byte >> 4]);
+        buffer_.push_back(digits[byte & 0x0f]);
+    }
+
+    void quoted(char const* text, size_t size) {
+        buffer_.push_back('"');
+        auto run = text;
+        auto const end = text + size;
+        for (auto it = text; it != end; ++it) {
+            auto const c = static_cast<unsigned char>(*it);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+
+            buffer_.append(run, it);
+            run = it + 1;
+            buffer_.push_back('\\');
+            switch (c) {
+                case '"': buffer_.push_back('"'); break;
+                case '\\': buffer_.push_back('\\'); break;
+                case '\b': buffer_.push_back('b'); break;
+                case '\f': buffer_.push_back('f'); break;
+                case '\n': buffer_.push_back('n'); break;
+                case '\r': buffer_.push_back('r'); break;
+                case '\t': buffer_.push_back('t'); break;
+                default:
+                    buffer_ += "u00";
+                    append_hex_byte(c);
+                    break;
+            }
+        }
+        buffer_.append(run, end);
+        buffer_.push_back('"');
+    }
+
+    std::string buffer_;
+    std::vector<bool> first_;
+    bool after_key_ = false;
+    std::function<void(std::string)> sink_;
+    size_t chunk_size_ = 0;
+};
+
+} // namespace bitprim
+
+#endif //BITPRIM_RPC_JSON_JSON_WRITER_HPP_
@@ -21,8 +21,19 @@
 #ifndef BITPRIM_RPC_MANAGER_HPP_
 #define BITPRIM_RPC_MANAGER_HPP_
 
+#include <memory>
+
+#include <bitprim/rpc/admission_control.hpp>
+#include <bitprim/rpc/cache/output_cache.hpp>
+#include <bitprim/rpc/cache/request_coalescer.hpp>
+#include <bitprim/rpc/cache/response_cache.hpp>
 #include <bitprim/rpc/http/rpc_server.hpp>
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/index/header_index.hpp>
+#include <bitprim/rpc/settings.hpp>
+#include <bitprim/rpc/worker_pool.hpp>
 #include <bitprim/rpc/zmq/zmq_helper.hpp>
+#include <bitprim/rpc/zmq/zmq_rpc_server.hpp>
 
 namespace bitprim { namespace rpc {
 class manager {
@@ -31,17 +42,29 @@ public:
             , std::shared_ptr<libbitcoin::node::full_node> & node
             , uint32_t rpc_port
             , uint32_t subscriber_port
-            , const std::unordered_set<std::string> & rpc_allowed_ips);
+            , const std::unordered_set<std::string> & rpc_allowed_ips
+            , settings const& config = settings());
    ~manager();
 
+   /// Blocks serving http until stop() is called from another thread.
    void start();
    void stop();
    bool is_stopped() const;
 
 private:
    bool stopped_;
+   libbitcoin::blockchain::block_chain& chain_;
    zmq zmq_;
+   std::unique_ptr<address_index> address_index_;
+   std::unique_ptr<header_index> header_index_;
+   std::unique_ptr<response_cache> response_cache_;
+   std::unique_ptr<output_cache> output_cache_;
+   std::unique_ptr<admission_control> admission_;
+   std::unique_ptr<request_coalescer> coalescer_;
+   // Shared by both servers through the message context.
+   worker_pool workers_;
    rpc_server http_;
+   std::unique_ptr<zmq_rpc_server> zmq_rpc_;
 };
 
 }} //namespace bitprim::rpc
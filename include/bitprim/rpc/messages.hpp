@@ -22,6 +22,13 @@
 
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
+#include <bitprim/rpc/admission_control.hpp>
+#include <bitprim/rpc/cache/output_cache.hpp>
+#include <bitprim/rpc/cache/request_coalescer.hpp>
+#include <bitprim/rpc/cache/response_cache.hpp>
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/index/header_index.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/messages.hpp>
 #include <bitcoin/node/full_node.hpp>
 
@@ -31,41 +38,360 @@
 
 namespace bitprim {
 
+// Process wide state the messages may answer from, owned by the caller.
+struct message_context {
+    rpc::address_index const* addresses = nullptr;
+    rpc::header_index const* headers = nullptr;
+    rpc::response_cache* cache = nullptr;
+    rpc::output_cache* outputs = nullptr;
+    rpc::admission_control* admission = nullptr;
+    rpc::request_coalescer* coalescer = nullptr;
+
+    // Spreads the work of a single message over the servers' workers.
+    work_dispatcher dispatch;
+};
+
+// How the elements of a batch array are run.
+struct batch_policy {
+    using work = std::function<void()>;
+
+    // Elements of one batch in flight at the same time.
+    size_t parallelism = 1;
+
+    // Larger batches are rejected as a whole, zero means no limit.
+    size_t max_size = 0;
+
+    // Runs an element, for instance on a worker pool; inline when empty.
+    std::function<void(work)> dispatch;
+};
+
 template <typename Blockchain>
-using message_signature = nlohmann::json(*)(nlohmann::json const&, Blockchain const&, bool);
+using message_signature = std::function<void(nlohmann::json const&, Blockchain const&, bool, response_handler)>;
 
 template <typename Blockchain>
 using signature_map = std::unordered_map<std::string, message_signature<Blockchain>>;
 
+// Adapts a message answered entirely from memory or the fast chain reads.
+template <typename Blockchain, nlohmann::json(*Message)(nlohmann::json const&, Blockchain const&, bool)>
+void sync_message(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+    handler(serialize_response(Message(json_in, chain, use_testnet_rules)));
+}
+
+// Adapts a message that completes with its response as a DOM.
+template <typename Blockchain, void(*Message)(nlohmann::json const&, Blockchain const&, bool, json_handler)>
+void dom_message(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+    Message(json_in, chain, use_testnet_rules, [handler](nlohmann::json container) {
+        handler(serialize_response(container));
+    });
+}
 
+// Verbose flag of getblock, getblockheader and getrawtransaction,
+// given as a bool or as a number.
+inline
+bool verbose_param(nlohmann::json const& json_in, bool fallback) {
+    auto const params = json_in.find("params");
+    if (params == json_in.end() || !params->is_array() || params->size() < 2) {
+        return fallback;
+    }
+
+    auto const& verbose = (*params)[1];
+    if (verbose.is_boolean()) {
+        return verbose.get<bool>();
+    }
+    if (verbose.is_number()) {
+        return verbose.get<int>() != 0;
+    }
+    return fallback;
+}
+
+// Whether the response to a request may be cached and for how long.
+// Raw blocks, headers and transactions are addressed by their hash; the
+// verbose forms carry confirmations or the next block and, as the tip
+// queries, only last until the next block. While the header index loads,
+// getblockhashes comes from a walk of the chain headers that may leave out
+// blocks the index returns, so it is not kept until the index answers.
+inline
+bool response_lifetime(std::string const& method, nlohmann::json const& json_in, rpc::response_cache::lifetime& out_lifetime,
+                       rpc::header_index const* headers = nullptr) {
+    using lifetime = rpc::response_cache::lifetime;
+
+    if (method == "getblockhashes" && headers != nullptr && !headers->ready()) {
+        return false;
+    }
+
+    if (method == "getblock" || method == "getblockheader") {
+        out_lifetime = verbose_param(json_in, true) ? lifetime::tip : lifetime::immutable;
+        return true;
+    }
+
+    if (method == "getrawtransaction") {
+        out_lifetime = verbose_param(json_in, false) ? lifetime::tip : lifetime::immutable;
+        return true;
+    }
+
+    if (method == "getblockhash" || method == "getblockhashes" || method == "getblockcount" ||
+        method == "getbestblockhash" || method == "getdifficulty" || method == "getblockchaininfo") {
+        out_lifetime = lifetime::tip;
+        return true;
+    }
+
+    return false;
+}
+
+// Serves a message from the response cache when it can. Responses are kept
+// without their id, which every hit splices back from its own request.
+template <typename Blockchain>
+message_signature<Blockchain> cached_message(rpc::response_cache& cache, std::string const& method, message_signature<Blockchain> message,
+                                             rpc::header_index const* headers = nullptr) {
+    auto const responses = &cache;
+    return [responses, method, message, headers](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+        rpc::response_cache::lifetime life;
+        auto const id_it = json_in.find("id");
+        if (id_it == json_in.end() || !response_lifetime(method, json_in, life, headers)) {
+            message(json_in, chain, use_testnet_rules, std::move(handler));
+            return;
+        }
+
+        // Object keys are sorted, so the dump is canonical.
+        auto const params = json_in.find("params");
+        auto key = method;
+        key.push_back(' ');
+        key += params == json_in.end() ? "null" : params->dump();
+
+        auto const id = id_it->dump();
+        std::string response;
+        if (responses->find(key, response)) {
+            response += id;
+            response.push_back('}');
+            handler(std::move(response));
+            return;
+        }
+
+        // Streamed responses are not kept, the cache needs them whole.
+        auto const streamed = std::make_shared<bool>(false);
+        chunk_handler chunks;
+        if (handler.chunks()) {
+            auto const forward = handler.chunks();
+            chunks = [streamed, forward](std::string chunk, std::function<void()> resume) {
+                *streamed = true;
+                return forward(std::move(chunk), std::move(resume));
+            };
+        }
+
+        auto const generation = responses->generation();
+        message(json_in, chain, use_testnet_rules, response_handler([responses, key, id, life, generation, streamed, handler](std::string response) {
+            // Only successes are kept.
+            static std::string const success = ",\"error\":null,\"id\":";
+            auto const tail = id.size() + 1;
+            if (!*streamed && response.size() > tail + success.size() && response.back() == '}' &&
+                response.compare(response.size() - tail, id.size(), id) == 0 &&
+                response.compare(response.size() - tail - success.size(), success.size(), success) == 0) {
+                responses->insert(key, response.substr(0, response.size() - tail), life, generation);
+            }
+            handler(std::move(response));
+        }, std::move(chunks)));
+    };
+}
+
+// Runs a message once admission control lets its cost class in, answering
+// busy right away when the queue of the class is full.
 template <typename Blockchain>
-signature_map<Blockchain> load_signature_map() {
-
-    return signature_map<Blockchain>  {
-        {"getrawtransaction", process_getrawtransaction},
-        { "getaddressbalance", process_getaddressbalance },
-        { "getspentinfo", process_getspentinfo },
-        { "getaddresstxids", process_getaddresstxids },
-        { "getaddressdeltas", process_getaddressdeltas },
-        { "getaddressutxos", process_getaddressutxos },
-        { "getblockhashes", process_getblockhashes },
-        { "getaddressmempool", process_getaddressmempool },
-        { "getbestblockhash", process_getbestblockhash },
-        { "getblock", process_getblock },
-        { "getblockhash", process_getblockhash },
-        { "getblockchaininfo", process_getblockchaininfo },
-        { "getblockheader", process_getblockheader },
-        { "getblockcount", process_getblockcount },
-        { "getdifficulty", process_getdifficulty },
-        { "getchaintips", process_getchaintips },
-        { "validateaddress", process_validateaddress },
-        { "getblocktemplate", process_getblocktemplate },
-        { "getmininginfo", process_getmininginfo }
+message_signature<Blockchain> admitted_message(rpc::admission_control& admission, std::string const& method, message_signature<Blockchain> message) {
+    auto const gate = &admission;
+    auto const cost = rpc::admission_control::classify(method);
+    return [gate, cost, message](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+        auto const id_it = json_in.find("id");
+        auto const id = id_it == json_in.end() ? nlohmann::json() : *id_it;
+
+        // Queued requests outlive the caller's copy.
+        auto const request = std::make_shared<nlohmann::json>(json_in);
+        auto const blockchain = &chain;
+        auto const admitted = gate->admit(cost, [gate, cost, message, request, id, blockchain, use_testnet_rules, handler]() {
+            auto const done = [gate, cost, handler](std::string response) {
+                handler(std::move(response));
+                gate->release(cost);
+            };
+
+            try {
+                message(*request, *blockchain, use_testnet_rules, response_handler(done, handler.chunks()));
+            } catch (std::exception const& e) {
+                done(serialize_error(id, bitprim::RPC_INVALID_REQUEST, e.what()));
+            }
+        });
+
+        if (!admitted) {
+            handler(serialize_error(id, bitprim::RPC_SERVER_BUSY, "Server busy, too many requests of this kind waiting"));
+        }
     };
 }
 
+// Computes identical concurrent requests once. The response is shared
+// without its id, which each follower appends from its own request. A
+// streamed response stops taking followers at its first piece and keeps
+// the pieces only if someone already joined.
+template <typename Blockchain>
+message_signature<Blockchain> coalesced_message(rpc::request_coalescer& coalescer, std::string const& method, message_signature<Blockchain> message) {
+    auto const flights = &coalescer;
+    return [flights, method, message](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+        auto const id_it = json_in.find("id");
+        if (id_it == json_in.end()) {
+            message(json_in, chain, use_testnet_rules, std::move(handler));
+            return;
+        }
+
+        // Object keys are sorted, so the dump is canonical.
+        auto const params = json_in.find("params");
+        auto key = method;
+        key.push_back(' ');
+        key += params == json_in.end() ? "null" : params->dump();
+        key.push_back(' ');
+        key += std::to_string(flights->generation());
+
+        auto const id = id_it->dump();
+        auto const blockchain = &chain;
+        auto const request = std::make_shared<nlohmann::json>(json_in);
+        auto const leader = flights->join(key, [message, request, id, blockchain, use_testnet_rules, handler](rpc::request_coalescer::response_ptr response) {
+            if (response) {
+                std::string own;
+                own.reserve(response->size() + id.size() + 1);
+                own += *response;
+                own += id;
+                own.push_back('}');
+                handler(std::move(own));
+                return;
+            }
+
+            try {
+                message(*request, *blockchain, use_testnet_rules, handler);
+            } catch (std::exception const& e) {
+                handler(serialize_error(request->at("id"), bitprim::RPC_INVALID_REQUEST, e.what()));
+            }
+        });
+
+        if (!leader) {
+            return;
+        }
+
+        struct stream_state {
+            bool sealed = false;
+            bool kept = false;
+            std::string pieces;
+        };
+
+        auto const stream = std::make_shared<stream_state>();
+        chunk_handler chunks;
+        if (handler.chunks()) {
+            auto const forward = handler.chunks();
+            chunks = [flights, leader, stream, forward](std::string chunk, std::function<void()> resume) {
+                if (!stream->sealed) {
+                    stream->sealed = true;
+                    stream->kept = flights->seal(leader);
+                }
+                if (stream->kept) {
+                    stream->pieces += chunk;
+                }
+                return forward(std::move(chunk), std::move(resume));
+            };
+        }
+
+        try {
+            message(json_in, chain, use_testnet_rules, response_handler([flights, leader, stream, id, handler](std::string response) {
+                static std::string const id_key = "\"id\":";
+                auto const tail = id.size() + 1;
+                rpc::request_coalescer::response_ptr shared;
+                if ((!stream->sealed || stream->kept) && response.size() > tail + id_key.size() && response.back() == '}' &&
+                    response.compare(response.size() - tail, id.size(), id) == 0 &&
+                    response.compare(response.size() - tail - id_key.size(), id_key.size(), id_key) == 0) {
+                    auto whole = std::make_shared<std::string>(std::move(stream->pieces));
+                    whole->append(response, 0, response.size() - tail);
+                    shared = std::move(whole);
+                }
+                flights->complete(leader, std::move(shared));
+                handler(std::move(response));
+            }, std::move(chunks)));
+        } catch (...) {
+            flights->complete(leader, nullptr);
+            throw;
+        }
+    };
+}
+
+template <typename Blockchain>
+signature_map<Blockchain> load_signature_map(message_context const& context = message_context()) {
+
+    auto const addresses = context.addresses;
+    auto const headers = context.headers;
+    auto const outputs = context.outputs;
+    auto const dispatch = context.dispatch;
+
+    signature_map<Blockchain> map {
+        { "getrawtransaction", [outputs, dispatch](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getrawtransaction(json_in, chain, use_testnet_rules, outputs, dispatch, [handler](nlohmann::json container) {
+                handler(serialize_response(container));
+            });
+        }},
+        { "getaddressbalance", [addresses, dispatch](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getaddressbalance(json_in, chain, use_testnet_rules, addresses, dispatch, [handler](nlohmann::json container) {
+                handler(serialize_response(container));
+            });
+        }},
+        { "getspentinfo", dom_message<Blockchain, process_getspentinfo> },
+        { "getaddresstxids", dom_message<Blockchain, process_getaddresstxids> },
+        { "getaddressdeltas", [addresses](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getaddressdeltas(json_in, chain, use_testnet_rules, addresses, std::move(handler));
+        }},
+        { "getaddressutxos", [addresses, headers, outputs, dispatch](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getaddressutxos(json_in, chain, use_testnet_rules, addresses, headers, outputs, dispatch, [handler](nlohmann::json container) {
+                handler(serialize_response(container));
+            });
+        }},
+        { "getblockhashes", [headers](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            handler(serialize_response(process_getblockhashes(json_in, chain, use_testnet_rules, headers)));
+        }},
+        { "getaddressmempool", sync_message<Blockchain, process_getaddressmempool> },
+        { "getbestblockhash", sync_message<Blockchain, process_getbestblockhash> },
+        { "getblock", [headers, dispatch](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getblock(json_in, chain, use_testnet_rules, headers, dispatch, std::move(handler));
+        }},
+        { "getblockhash", sync_message<Blockchain, process_getblockhash> },
+        { "getblockchaininfo", dom_message<Blockchain, process_getblockchaininfo> },
+        { "getblockheader", [headers](nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, response_handler handler) {
+            process_getblockheader(json_in, chain, use_testnet_rules, headers, std::move(handler));
+        }},
+        { "getblockcount", sync_message<Blockchain, process_getblockcount> },
+        { "getdifficulty", sync_message<Blockchain, process_getdifficulty> },
+        { "getchaintips", sync_message<Blockchain, process_getchaintips> },
+        { "validateaddress", sync_message<Blockchain, process_validateaddress> },
+        { "getblocktemplate", sync_message<Blockchain, process_getblocktemplate> },
+        { "getmininginfo", sync_message<Blockchain, process_getmininginfo> }
+    };
+
+    if (context.admission != nullptr) {
+        for (auto& entry : map) {
+            entry.second = admitted_message<Blockchain>(*context.admission, entry.first, std::move(entry.second));
+        }
+    }
+
+    // Followers wait for their leader without taking an admission slot.
+    if (context.coalescer != nullptr) {
+        for (auto& entry : map) {
+            entry.second = coalesced_message<Blockchain>(*context.coalescer, entry.first, std::move(entry.second));
+        }
+    }
+
+    // Outside admission control, cache hits never wait.
+    if (context.cache != nullptr) {
+        for (auto& entry : map) {
+            entry.second = cached_message<Blockchain>(*context.cache, entry.first, std::move(entry.second), context.headers);
+        }
+    }
+
+    return map;
+}
+
+// The handler may run on a blockchain thread, after this function returned.
 template <typename Node, typename Blockchain>
-nlohmann::json process_data_element(nlohmann::json const& json_in, bool use_testnet_rules,  Node & node, signature_map<Blockchain> const& signature_map) {
+void process_data_element(nlohmann::json const& json_in, bool use_testnet_rules,  Node & node, signature_map<Blockchain> const& signature_map, response_handler handler) {
     
     auto key = json_in["method"].get<std::string>();
 
@@ -75,42 +401,121 @@ nlohmann::json process_data_element(nlohmann::json const& json_in, bool use_test
     auto it = signature_map.find(key);
 
     if (it != signature_map.end()) {
-        return it->second(json_in, node->chain_bitprim(), use_testnet_rules);
+        it->second(json_in, node->chain_bitprim(), use_testnet_rules, std::move(handler));
+        return;
     }
     
-    if (key == "submitblock")
-        return process_submitblock(json_in, node->chain_bitprim(), use_testnet_rules);
+    if (key == "submitblock") {
+        process_submitblock(json_in, node->chain_bitprim(), use_testnet_rules, [handler](nlohmann::json container) {
+            handler(serialize_response(container));
+        });
+        return;
+    }
 
-    if (key == "sendrawtransaction")
-        return process_sendrawtransaction(json_in, node->chain_bitprim(), use_testnet_rules);
+    if (key == "sendrawtransaction") {
+        process_sendrawtransaction(json_in, node->chain_bitprim(), use_testnet_rules, [handler](nlohmann::json container) {
+            handler(serialize_response(container));
+        });
+        return;
+    }
 
-    if (key == "getinfo")
-        return process_getinfo(json_in, node, use_testnet_rules);
+    if (key == "getinfo") {
+        handler(serialize_response(process_getinfo(json_in, node, use_testnet_rules)));
+        return;
+    }
     
     //std::cout << key << " Command Not yet implemented." << std::endl;
-    return nlohmann::json(); //TODO: error!
+    handler(serialize_response(nlohmann::json())); //TODO: error!
+}
 
+template <typename Node, typename Blockchain>
+void process_data_element_safe(nlohmann::json const& json_in, bool use_testnet_rules, Node & node, signature_map<Blockchain> const& signature_map, response_handler handler) {
+    try {
+        process_data_element(json_in, use_testnet_rules, node, signature_map, handler);
+    } catch (std::exception const& e) {
+        // Only a malformed element fails, the rest of the batch is still answered.
+        nlohmann::json error;
+        error["id"] = json_in.is_object() ? json_in["id"] : nlohmann::json();
+        error["result"];
+        error["error"]["code"] = bitprim::RPC_INVALID_REQUEST;
+        error["error"]["message"] = e.what();
+        handler(serialize_response(error));
+    }
 }
 
 template <typename Node, typename Blockchain>
-std::string process_data(nlohmann::json const& json_object, bool use_testnet_rules, Node & node, signature_map<Blockchain> const& signature_map) {
+void process_data(nlohmann::json const& json_object, bool use_testnet_rules, Node & node, signature_map<Blockchain> const& signature_map, batch_policy const& batch, response_handler handler) {
     //std::cout << "method: " << json_object["method"].get<std::string>() << "\n";
     //Bitprim-mining process data
 
     if (json_object.is_array()) {
-        nlohmann::json res;
-        size_t i = 0;
-        for (const auto & method : json_object) {
-            res[i] = process_data_element(method, use_testnet_rules, node, signature_map);
-            ++i;
+        if (batch.max_size != 0 && json_object.size() > batch.max_size) {
+            handler(serialize_error(nlohmann::json(), bitprim::RPC_INVALID_REQUEST,
+                "Batch of " + std::to_string(json_object.size()) + " requests exceeds the limit of " + std::to_string(batch.max_size)));
+            return;
         }
-        return res.dump();
+
+        // Elements run concurrently and complete in any order, each one
+        // into its own slot; the batch only joins them once all are done.
+        auto requests = std::make_shared<nlohmann::json>(json_object);
+        auto res = std::make_shared<std::vector<std::string>>(requests->size());
+        auto const dispatch = batch.dispatch;
+        async_parallel::run(requests->size(), batch.parallelism, [requests, res, dispatch, use_testnet_rules, &node, &signature_map](size_t i, async_parallel::next_handler next) {
+            auto element = [requests, res, i, next, use_testnet_rules, &node, &signature_map]() {
+                process_data_element_safe((*requests)[i], use_testnet_rules, node, signature_map, [res, i, next](std::string result) {
+                    (*res)[i] = std::move(result);
+                    next();
+                });
+            };
+
+            if (dispatch) {
+                dispatch(std::move(element));
+            } else {
+                element();
+            }
+        }, [res, handler]() {
+            size_t size = 2 + res->size();
+            for (auto const& element : *res) {
+                size += element.size();
+            }
+
+            std::string batch;
+            batch.reserve(size);
+            batch.push_back('[');
+            for (size_t i = 0; i < res->size(); ++i) {
+                if (i != 0) {
+                    batch.push_back(',');
+                }
+                batch += (*res)[i];
+            }
+            batch.push_back(']');
+            handler(std::move(batch));
+        });
     }
     else {
-        return process_data_element(json_object, use_testnet_rules, node, signature_map).dump();
+        process_data_element(json_object, use_testnet_rules, node, signature_map, std::move(handler));
     }
 }
 
+// Batch elements run one after another, on the calling thread.
+template <typename Node, typename Blockchain>
+void process_data(nlohmann::json const& json_object, bool use_testnet_rules, Node & node, signature_map<Blockchain> const& signature_map, response_handler handler) {
+    process_data(json_object, use_testnet_rules, node, signature_map, batch_policy(), std::move(handler));
+}
+
+// Blocking variant, for callers without an event loop of their own.
+template <typename Node, typename Blockchain>
+std::string process_data(nlohmann::json const& json_object, bool use_testnet_rules, Node & node, signature_map<Blockchain> const& signature_map) {
+    std::string res;
+    boost::latch latch(2);
+    process_data(json_object, use_testnet_rules, node, signature_map, [&](std::string result) {
+        res = std::move(result);
+        latch.count_down();
+    });
+    latch.count_down_and_wait();
+    return res;
+}
+
 } //namespace bitprim
 
 #endif //BITPRIM_RPC_MESSAGES_HPP_
@@ -0,0 +1,393 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_MESSAGES_ASYNC_HPP_
+#define BITPRIM_RPC_MESSAGES_ASYNC_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <bitprim/rpc/json/json.hpp>
+#include <bitprim/rpc/json/json_writer.hpp>
+
+namespace bitprim {
+
+// Completion of a whole message: receives the JSON-RPC response object.
+using json_handler = std::function<void(nlohmann::json)>;
+
+// Receives the pieces of a response as it is serialized, ahead of its end.
+// Returns false when the transport is falling behind: the producer should
+// then hold back until resume() is called, once for that piece, after the
+// transport caught up or went away. resume() never runs inline.
+using chunk_handler = std::function<bool(std::string, std::function<void()>)>;
+
+// Runs a piece of work, for instance on a worker pool; inline when empty.
+using work_dispatcher = std::function<void(std::function<void()>)>;
+
+// Hands work to dispatch, or runs it here when there is none.
+inline
+void run_work(work_dispatcher const& dispatch, std::function<void()> work) {
+    if (dispatch) {
+        dispatch(std::move(work));
+    } else {
+        work();
+    }
+}
+
+// Size of the pieces a streamed response is sent in.
+constexpr size_t response_chunk_size = 64 * 1024;
+
+// Completion of a whole message: receives the serialized response object.
+// When the transport can stream (chunks() is set) a message may hand the
+// response over in pieces to chunks() first, the completion then only
+// receives the last piece. Wrapping the handler in another function drops
+// chunks(), so whoever needs the whole response gets it.
+class response_handler {
+public:
+    response_handler() = default;
+
+    response_handler(std::nullptr_t) {}
+
+    template <typename Handler, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<Handler>::type, response_handler>::value>::type>
+    response_handler(Handler&& handler)
+        : done_(std::forward<Handler>(handler))
+    {}
+
+    response_handler(std::function<void(std::string)> done, chunk_handler chunks)
+        : done_(std::move(done))
+        , chunks_(std::move(chunks))
+    {}
+
+    void operator()(std::string response) const {
+        done_(std::move(response));
+    }
+
+    explicit operator bool() const {
+        return static_cast<bool>(done_);
+    }
+
+    chunk_handler const& chunks() const {
+        return chunks_;
+    }
+
+private:
+    std::function<void(std::string)> done_;
+    chunk_handler chunks_;
+};
+
+// Completion of a message body: receives the result and, when error != 0,
+// the rpc error code and its message.
+using message_result_handler = std::function<void(nlohmann::json, int, std::string)>;
+
+// Serializes a response object built as a DOM, with its fields in the
+// order the streamed responses use (result, error, id).
+inline
+std::string serialize_response(nlohmann::json const& container) {
+    if (!container.is_object()) {
+        return container.dump();
+    }
+
+    static char const* const envelope[] = {"result", "error", "id"};
+
+    json_writer writer;
+    writer.begin_object();
+    for (auto name : envelope) {
+        auto const it = container.find(name);
+        if (it != container.end()) {
+            writer.key(name);
+            writer.value(*it);
+        }
+    }
+    for (auto it = container.begin(); it != container.end(); ++it) {
+        if (it.key() != envelope[0] && it.key() != envelope[1] && it.key() != envelope[2]) {
+            writer.key(it.key());
+            writer.value(it.value());
+        }
+    }
+    writer.end_object();
+    return writer.release();
+}
+
+// Serializes a successful response whose result is emitted by write_result
+// straight into the response buffer.
+template <typename WriteResult>
+std::string serialize_result(nlohmann::json const& id, WriteResult&& write_result, size_t capacity = 0) {
+    json_writer writer(capacity);
+    writer.begin_object();
+    writer.key("result");
+    write_result(writer);
+    writer.key("error");
+    writer.null();
+    writer.key("id");
+    writer.value(id);
+    writer.end_object();
+    return writer.release();
+}
+
+// Serializes an error response.
+inline
+std::string serialize_error(nlohmann::json const& id, int error, std::string const& message) {
+    json_writer writer;
+    writer.begin_object();
+    writer.key("error");
+    writer.begin_object();
+    writer.key("code");
+    writer.number(error);
+    writer.key("message");
+    writer.string(message);
+    writer.end_object();
+    writer.key("id");
+    writer.value(id);
+    writer.end_object();
+    return writer.release();
+}
+
+// Serializes a successful response whose result is emitted an item at a
+// time, write_item(writer, i) for i in [0, count), and hands it to the
+// handler. When the handler can stream (chunks() is set) the response goes
+// out in pieces while being written, and whenever the transport falls
+// behind the next item waits for its resume() instead of holding the
+// thread; the completion then only receives the last piece.
+class streamed_result : public std::enable_shared_from_this<streamed_result> {
+public:
+    using item_writer = std::function<void(json_writer&, size_t)>;
+
+    static
+    void run(nlohmann::json const& id, size_t count, item_writer write_item, size_t capacity, response_handler handler) {
+        std::shared_ptr<streamed_result> result(new streamed_result(id, count, std::move(write_item), capacity, std::move(handler)));
+        result->start();
+    }
+
+private:
+    streamed_result(nlohmann::json const& id, size_t count, item_writer write_item, size_t capacity, response_handler handler)
+        : writer_(handler.chunks() ? std::min(capacity, response_chunk_size + 1024) : capacity)
+        , id_(id)
+        , index_(0)
+        , count_(count)
+        , write_item_(std::move(write_item))
+        , handler_(std::move(handler))
+        , holds_(0)
+    {}
+
+    void start() {
+        if (handler_.chunks()) {
+            // The writer is ours, so the sink does not keep us alive.
+            writer_.stream([this](std::string piece) {
+                ++holds_;
+                auto self = shared_from_this();
+                if (handler_.chunks()(std::move(piece), [self]() { self->resume(); })) {
+                    --holds_;
+                }
+            }, response_chunk_size);
+        }
+        writer_.begin_object();
+        writer_.key("result");
+        pump();
+    }
+
+    // Each item holds the loop while it is written, and so does each piece
+    // the transport took without room for more; whoever releases the last
+    // hold goes on with the next item.
+    void pump() {
+        while (index_ != count_) {
+            holds_ = 1;
+            write_item_(writer_, index_++);
+            if (--holds_ != 0) {
+                return;
+            }
+        }
+
+        // The end is small, it goes out without waiting for room.
+        holds_ = 1;
+        write_item_ = nullptr;
+        writer_.key("error");
+        writer_.null();
+        writer_.key("id");
+        writer_.value(id_);
+        writer_.end_object();
+        handler_(writer_.release());
+    }
+
+    void resume() {
+        if (--holds_ == 0) {
+            pump();
+        }
+    }
+
+    json_writer writer_;
+    nlohmann::json const id_;
+    size_t index_;
+    size_t const count_;
+    item_writer write_item_;
+    response_handler const handler_;
+    std::atomic<size_t> holds_;
+};
+
+// Result being accumulated by a message that needs several chain queries.
+// Shared between the completion handlers of those queries.
+struct message_state {
+    explicit message_state(nlohmann::json initial = nlohmann::json())
+        : result(std::move(initial))
+        , error(0)
+    {}
+
+    void complete(message_result_handler const& handler) {
+        if (error != 0) {
+            handler(nlohmann::json(), error, error_code);
+        } else {
+            handler(std::move(result), 0, "");
+        }
+    }
+
+    nlohmann::json result;
+    int error;
+    std::string error_code;
+};
+
+// Runs step(i, next) for i in [0, count) one after another and then done().
+// Each step must call next() exactly once, either inline or from a chain
+// completion handler; inline calls are trampolined so long loops of cheap
+// steps do not grow the stack.
+class async_loop : public std::enable_shared_from_this<async_loop> {
+public:
+    using next_handler = std::function<void()>;
+    using step_handler = std::function<void(size_t, next_handler)>;
+    using done_handler = std::function<void()>;
+
+    static
+    void run(size_t count, step_handler step, done_handler done) {
+        std::shared_ptr<async_loop> loop(new async_loop(count, std::move(step), std::move(done)));
+        loop->resume();
+    }
+
+private:
+    enum { running, completed, returned };
+
+    async_loop(size_t count, step_handler step, done_handler done)
+        : index_(0)
+        , count_(count)
+        , step_(std::move(step))
+        , done_(std::move(done))
+        , state_(returned)
+    {}
+
+    void resume() {
+        for (;;) {
+            if (index_ == count_) {
+                auto done = std::move(done_);
+                step_ = nullptr;
+                done();
+                return;
+            }
+
+            state_ = running;
+            auto self = shared_from_this();
+            step_(index_++, [self]() {
+                if (self->state_.exchange(completed) == returned) {
+                    self->resume();
+                }
+            });
+
+            // If next() already ran inline keep looping, otherwise it resumes us.
+            if (state_.exchange(returned) != completed) {
+                return;
+            }
+        }
+    }
+
+    size_t index_;
+    size_t const count_;
+    step_handler step_;
+    done_handler done_;
+    std::atomic<int> state_;
+};
+
+// Runs step(i, next) for every i in [0, count) keeping at most width steps
+// in flight, then done(). Steps may complete in any order and on any thread;
+// shared results must be guarded by the caller. Inline completions are queued
+// to the thread already launching steps instead of recursing.
+class async_parallel : public std::enable_shared_from_this<async_parallel> {
+public:
+    using next_handler = std::function<void()>;
+    using step_handler = std::function<void(size_t, next_handler)>;
+    using done_handler = std::function<void()>;
+
+    static
+    void run(size_t count, size_t width, step_handler step, done_handler done) {
+        if (count == 0) {
+            done();
+            return;
+        }
+        width = std::max<size_t>(1, std::min(width, count));
+        std::shared_ptr<async_parallel> loop(new async_parallel(count, width, std::move(step), std::move(done)));
+        loop->pump();
+    }
+
+private:
+    async_parallel(size_t count, size_t width, step_handler step, done_handler done)
+        : count_(count)
+        , step_(std::move(step))
+        , done_(std::move(done))
+        , issued_(0)
+        , completed_(0)
+        , pending_(width)
+    {}
+
+    // Launches one step per pending request until none is left.
+    void pump() {
+        do {
+            auto const index = issued_++;
+            if (index < count_) {
+                auto self = shared_from_this();
+                step_(index, [self]() {
+                    self->finished();
+                });
+            }
+        } while (pending_.fetch_sub(1) != 1);
+    }
+
+    void finished() {
+        if (++completed_ == count_) {
+            done_();
+            return;
+        }
+        if (pending_.fetch_add(1) == 0) {
+            pump();
+        }
+    }
+
+    size_t const count_;
+    step_handler step_;
+    done_handler done_;
+    std::atomic<size_t> issued_;
+    std::atomic<size_t> completed_;
+    std::atomic<size_t> pending_;
+};
+
+} //namespace bitprim
+
+#endif //BITPRIM_RPC_MESSAGES_ASYNC_HPP_
@@ -24,8 +24,10 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
-#include <boost/thread/latch.hpp>
+#include <bitprim/rpc/messages/utils.hpp>
 
 namespace bitprim {
 
@@ -55,63 +57,114 @@ bool json_in_getaddressbalance(nlohmann::json const& json_object, std::vector<st
     return true;
 }
 
-template <typename Blockchain>
-bool getaddressbalance(nlohmann::json& json_result, int& error, std::string& error_code, std::vector<std::string> const& addresses, Blockchain const& chain)
+// Answers from the address index, false when it is not available.
+inline
+bool getaddressbalance_indexed(std::vector<std::string> const& addresses, rpc::address_index const* index, message_result_handler const& handler)
 {
+    if (index == nullptr) {
+        return false;
+    }
+
+    message_state state;
     uint64_t balance = 0;
     uint64_t received = 0;
-    for (const auto & address : addresses) {
+    for (auto const& address : addresses) {
         libbitcoin::wallet::payment_address payment_address(address);
-        if (payment_address)
-        {
-            boost::latch latch(2);
-            chain.fetch_history(payment_address, INT_MAX, 0, [&](const libbitcoin::code &ec, libbitcoin::chain::history_compact::list history_compact_list) {
-                if (ec == libbitcoin::error::success) {
-                    for (const auto & history : history_compact_list) {
-                        if (history.kind == libbitcoin::chain::point_kind::output) {
-                            received += history.value;
-                            boost::latch latch2(2);
-                            chain.fetch_spend(history.point, [&](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
-                                if (ec == libbitcoin::error::not_found) {
-                                    // Output not spent
-                                    balance += history.value;
-                                }
-                                latch2.count_down();
-                            });
-                            latch2.count_down_and_wait();
-                        }
-                    }
-                }
-                else {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available for address " + address;
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+        if (!payment_address) {
+            state.error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state.error_code = "Invalid address";
+            continue;
         }
-        else
-        {
-            error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-            error_code = "Invalid address";
+
+        uint64_t address_balance;
+        uint64_t address_received;
+        if (!index->balance(payment_address.hash(), address_balance, address_received)) {
+            return false;
         }
+        balance += address_balance;
+        received += address_received;
     }
-    if (error != 0)
-        return false;
 
-    json_result["balance"] = balance;
-    json_result["received"] = received;
+    if (state.error == 0) {
+        state.result["balance"] = balance;
+        state.result["received"] = received;
+    }
+    state.complete(handler);
     return true;
 }
 
 template <typename Blockchain>
-nlohmann::json process_getaddressbalance(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void getaddressbalance(std::vector<std::string> const& addresses, Blockchain const& chain, rpc::address_index const* index,
+    work_dispatcher const& dispatch, message_result_handler handler)
 {
-    nlohmann::json container, result;
-    container["id"] = json_in["id"];
+    if (getaddressbalance_indexed(addresses, index, handler)) {
+        return;
+    }
+
+    struct balance_state : message_state {
+        std::atomic<uint64_t> balance{0};
+        uint64_t received = 0;
+    };
 
-    int error = 0;
-    std::string error_code;
+    auto state = std::make_shared<balance_state>();
+    auto payment_addresses = std::make_shared<std::vector<std::string>>(addresses);
+
+    async_loop::run(payment_addresses->size(), [state, payment_addresses, dispatch, &chain](size_t n, async_loop::next_handler next) {
+        libbitcoin::wallet::payment_address payment_address((*payment_addresses)[n]);
+        if (!payment_address) {
+            state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state->error_code = "Invalid address";
+            next();
+            return;
+        }
+
+        chain.fetch_history(payment_address, INT_MAX, 0, [state, payment_address, next, dispatch, &chain](const libbitcoin::code &ec, libbitcoin::chain::history_compact::list history_compact_list) {
+            if (ec != libbitcoin::error::success) {
+                state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+                state->error_code = "No information available for address " + payment_address.encoded();
+                next();
+                return;
+            }
+
+            auto outputs = std::make_shared<libbitcoin::chain::history_compact::list>();
+            for (auto const& row : history_compact_list) {
+                if (row.kind == libbitcoin::chain::point_kind::output) {
+                    state->received += row.value;
+                    outputs->push_back(row);
+                }
+            }
+
+            // Spend lookups are independent, several of them run at once on
+            // the workers. The store answers them inline, so each one is
+            // dispatched on its own.
+            async_parallel::run(outputs->size(), spend_queries_in_flight, [state, outputs, dispatch, &chain](size_t i, async_parallel::next_handler next_output) {
+                run_work(dispatch, [state, outputs, i, next_output, &chain]() {
+                    auto const value = (*outputs)[i].value;
+                    chain.fetch_spend((*outputs)[i].point, [state, value, next_output](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
+                        if (ec == libbitcoin::error::not_found) {
+                            // Output not spent
+                            state->balance += value;
+                        }
+                        next_output();
+                    });
+                });
+            }, next);
+        });
+    }, [state, handler]() {
+        if (state->error == 0) {
+            state->result["balance"] = state->balance.load();
+            state->result["received"] = state->received;
+        }
+        state->complete(handler);
+    });
+}
+
+template <typename Blockchain>
+void process_getaddressbalance(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::address_index const* index,
+    work_dispatcher const& dispatch, json_handler handler)
+{
+    nlohmann::json container;
+    container["id"] = json_in["id"];
 
     std::vector<std::string> payment_addresses;
     if (!json_in_getaddressbalance(json_in, payment_addresses)) //if false return error
@@ -132,20 +185,21 @@ nlohmann::json process_getaddressbalance(nlohmann::json const& json_in, Blockcha
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
             "}\n";
-        return container;
+        handler(std::move(container));
+        return;
     }
 
-    if (getaddressbalance(result, error, error_code, payment_addresses, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
-    }
-
-    return container;
+    getaddressbalance(payment_addresses, chain, index, dispatch, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
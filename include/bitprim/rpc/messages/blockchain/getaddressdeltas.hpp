@@ -24,9 +24,11 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -71,8 +73,83 @@ bool json_in_getaddressdeltas(nlohmann::json const& json_object, std::vector<std
     return true;
 }
 
+// Answers from the address index straight into the response buffer,
+// false when the index is not available.
+inline
+bool getaddressdeltas_indexed(std::vector<std::string> const& payment_addresses, size_t start_height, size_t end_height, rpc::address_index const* index, nlohmann::json const& id, response_handler const& handler)
+{
+    if (index == nullptr) {
+        return false;
+    }
+
+    std::vector<libbitcoin::wallet::payment_address> addresses;
+    for (auto const& payment_address : payment_addresses) {
+        libbitcoin::wallet::payment_address address(payment_address);
+        if (!address) {
+            handler(serialize_error(id, bitprim::RPC_INVALID_ADDRESS_OR_KEY, "Invalid address"));
+            return true;
+        }
+        addresses.push_back(address);
+    }
+
+    size_t count = 0;
+    std::vector<std::vector<rpc::address_index::delta>> deltas(addresses.size());
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        if (!index->deltas(addresses[i].hash(), start_height, end_height, deltas[i])) {
+            return false;
+        }
+        count += deltas[i].size();
+    }
+
+    // Each delta is an item, written in address order.
+    struct cursor {
+        std::vector<std::string> encoded;
+        std::vector<std::vector<rpc::address_index::delta>> deltas;
+        size_t address = 0;
+        size_t entry = 0;
+    };
+
+    auto const state = std::make_shared<cursor>();
+    for (auto const& address : addresses) {
+        state->encoded.push_back(address.encoded());
+    }
+    state->deltas = std::move(deltas);
+
+    streamed_result::run(id, count + 2, [state, count](json_writer& writer, size_t item) {
+        if (item == 0) {
+            writer.begin_array();
+            return;
+        }
+        if (item == count + 1) {
+            writer.end_array();
+            return;
+        }
+
+        while (state->entry == state->deltas[state->address].size()) {
+            ++state->address;
+            state->entry = 0;
+        }
+        auto const& entry = state->deltas[state->address][state->entry++];
+        writer.begin_object();
+        writer.key("address");
+        writer.string(state->encoded[state->address]);
+        writer.key("blockindex");
+        writer.number(entry.position);
+        writer.key("height");
+        writer.number(entry.height);
+        writer.key("index");
+        writer.number(entry.index);
+        writer.key("satoshis");
+        writer.string(std::to_string(entry.satoshis));
+        writer.key("txid");
+        writer.hex_reversed(entry.hash);
+        writer.end_object();
+    }, 64 + count * 192, handler);
+    return true;
+}
+
 template <typename Blockchain>
-bool getaddressdeltas(nlohmann::json& json_object, int& error, std::string& error_code, std::vector<std::string> const& payment_addresses, size_t const& start_height, size_t const& end_height, const bool include_chain_info, Blockchain const& chain)
+void getaddressdeltas(std::vector<std::string> const& payment_addresses, size_t const& start_height, size_t const& end_height, const bool include_chain_info, Blockchain const& chain, message_result_handler handler)
 {
 #ifdef BITPRIM_CURRENCY_BCH
     bool witness = false;
@@ -80,114 +157,109 @@ bool getaddressdeltas(nlohmann::json& json_object, int& error, std::string& erro
     bool witness = true;
 #endif
 
-    int i = 0;
-    for (const auto & payment_address : payment_addresses) {
-        libbitcoin::wallet::payment_address address(payment_address);
-        if (address)
-        {
-            boost::latch latch(2);
-            chain.fetch_history(address, INT_MAX, 0, [&](const libbitcoin::code &ec,
-                libbitcoin::chain::history_compact::list history_compact_list) {
-                if (ec == libbitcoin::error::success) {
-                    for (const auto & history : history_compact_list) {
-                        if (history.kind == libbitcoin::chain::point_kind::output &&
-                            history.height >= start_height && history.height <= end_height) {
-                            //It's an output
-                            boost::latch latch2(2);
-                            //Fetch txn to get the blockindex and height
-                            chain.fetch_transaction(history.point.hash(), false, witness,
-                                [&](const libbitcoin::code &ec,
-                                    libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                                    size_t height) {
-                                if (ec == libbitcoin::error::success) {
-                                    if (height >= start_height && height <= end_height) {
-                                        json_object[i]["txid"] = libbitcoin::encode_hash(
-                                            history.point.hash());
-                                        json_object[i]["index"] = history.point.index();
-                                        json_object[i]["address"] = address.encoded();
-                                        json_object[i]["blockindex"] = index;
-                                        json_object[i]["height"] = height;
-                                        json_object[i]["satoshis"] = std::to_string(history.value);
-                                        ++i;
-                                    }
-                                }
-                                else {
-                                    error = bitprim::RPC_DATABASE_ERROR;
-                                    error_code = "Error fetching transaction.";
-                                }
-                                latch2.count_down();
-                            });
-                            latch2.count_down_and_wait();
-
-                            //Check if it was spent and get the txn data
-                            boost::latch latch3(2);
-                            chain.fetch_spend(history.point, [&](const libbitcoin::code &ec,
-                                libbitcoin::chain::input_point input) {
-                                if (ec == libbitcoin::error::success) {
-                                    boost::latch latch4(2);
-                                    chain.fetch_transaction(input.hash(), false, witness,
-                                        [&](const libbitcoin::code &ec,
-                                            libbitcoin::transaction_const_ptr tx_ptr,
-                                            size_t index,
-                                            size_t height) {
-                                        if (ec == libbitcoin::error::success) {
-                                            if (height >= start_height &&
-                                                height <= end_height) {
-                                                json_object[i]["txid"] = libbitcoin::encode_hash(
-                                                    input.hash());
-                                                json_object[i]["index"] = input.index();
-                                                json_object[i]["address"] = address.encoded();
-                                                json_object[i]["blockindex"] = index;
-                                                json_object[i]["height"] = height;
-                                                json_object[i]["satoshis"] =
-                                                    "-" + std::to_string(history.value);
-                                                ++i;
-                                            }
-                                        }
-                                        else {
-                                            error = bitprim::RPC_DATABASE_ERROR;
-                                            error_code = "Error fetching transaction.";
-                                        }
-                                        latch4.count_down();
-                                    });
-                                    latch4.count_down_and_wait();
-                                }
-                                latch3.count_down();
-                            });
-                            latch3.count_down_and_wait();
+    auto state = std::make_shared<message_state>(nlohmann::json::array());
+    auto addresses = std::make_shared<std::vector<std::string>>(payment_addresses);
+
+    async_loop::run(addresses->size(), [state, addresses, start_height, end_height, witness, &chain](size_t n, async_loop::next_handler next) {
+        libbitcoin::wallet::payment_address address((*addresses)[n]);
+        if (!address) {
+            state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state->error_code = "Invalid address";
+            next();
+            return;
+        }
+
+        chain.fetch_history(address, INT_MAX, 0, [state, address, start_height, end_height, witness, next, &chain](const libbitcoin::code &ec,
+            libbitcoin::chain::history_compact::list history_compact_list) {
+            if (ec != libbitcoin::error::success) {
+                state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+                state->error_code = "No information available for address " + address.encoded();
+                next();
+                return;
+            }
+
+            auto history_list = std::make_shared<libbitcoin::chain::history_compact::list>(std::move(history_compact_list));
+            async_loop::run(history_list->size(), [state, history_list, address, start_height, end_height, witness, &chain](size_t h, async_loop::next_handler next_row) {
+                auto const& history = (*history_list)[h];
+                if (history.kind != libbitcoin::chain::point_kind::output ||
+                    history.height < start_height || history.height > end_height) {
+                    next_row();
+                    return;
+                }
+
+                //It's an output
+                auto const point = history.point;
+                auto const value = history.value;
+
+                //Fetch txn to get the blockindex and height
+                chain.fetch_transaction(point.hash(), false, witness,
+                    [state, point, value, address, start_height, end_height, witness, next_row, &chain](const libbitcoin::code &ec,
+                        libbitcoin::transaction_const_ptr tx_ptr, size_t index,
+                        size_t height) {
+                    if (ec == libbitcoin::error::success) {
+                        if (height >= start_height && height <= end_height) {
+                            nlohmann::json delta;
+                            delta["txid"] = rpc::encode_hash(point.hash());
+                            delta["index"] = point.index();
+                            delta["address"] = address.encoded();
+                            delta["blockindex"] = index;
+                            delta["height"] = height;
+                            delta["satoshis"] = std::to_string(value);
+                            state->result.push_back(std::move(delta));
                         }
                     }
-                }
-                else {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available for address " + address;
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
-        }
-        else {
-            error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-            error_code = "Invalid address";
-        }
-    }
-    if (error != 0)
-        return false;
+                    else {
+                        state->error = bitprim::RPC_DATABASE_ERROR;
+                        state->error_code = "Error fetching transaction.";
+                    }
 
-    return true;
+                    //Check if it was spent and get the txn data
+                    chain.fetch_spend(point, [state, value, address, start_height, end_height, witness, next_row, &chain](const libbitcoin::code &ec,
+                        libbitcoin::chain::input_point input) {
+                        if (ec != libbitcoin::error::success) {
+                            next_row();
+                            return;
+                        }
+
+                        chain.fetch_transaction(input.hash(), false, witness,
+                            [state, input, value, address, start_height, end_height, next_row](const libbitcoin::code &ec,
+                                libbitcoin::transaction_const_ptr tx_ptr,
+                                size_t index,
+                                size_t height) {
+                            if (ec == libbitcoin::error::success) {
+                                if (height >= start_height &&
+                                    height <= end_height) {
+                                    nlohmann::json delta;
+                                    delta["txid"] = rpc::encode_hash(input.hash());
+                                    delta["index"] = input.index();
+                                    delta["address"] = address.encoded();
+                                    delta["blockindex"] = index;
+                                    delta["height"] = height;
+                                    delta["satoshis"] = "-" + std::to_string(value);
+                                    state->result.push_back(std::move(delta));
+                                }
+                            }
+                            else {
+                                state->error = bitprim::RPC_DATABASE_ERROR;
+                                state->error_code = "Error fetching transaction.";
+                            }
+                            next_row();
+                        });
+                    });
+                });
+            }, next);
+        });
+    }, [state, handler]() {
+        state->complete(handler);
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_getaddressdeltas(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void process_getaddressdeltas(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::address_index const* index, response_handler handler)
 {
     nlohmann::json container;
-    nlohmann::json result = nlohmann::json::array();
-
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::vector<std::string> payment_address;
     size_t start_height;
     size_t end_height;
@@ -218,20 +290,25 @@ nlohmann::json process_getaddressdeltas(nlohmann::json const& json_in, Blockchai
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n";
-        return container;
+        handler(serialize_response(container));
+        return;
     }
 
-    if (getaddressdeltas(result, error, error_code, payment_address, start_height, end_height, include_chain_info, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
+    if (getaddressdeltas_indexed(payment_address, start_height, end_height, index, container["id"], handler)) {
+        return;
     }
 
-    return container;
+    getaddressdeltas(payment_address, start_height, end_height, include_chain_info, chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(serialize_response(container));
+    });
 }
 
 } //namespace bitprim
@@ -23,7 +23,6 @@
 
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
-#include <boost/thread/latch.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 
 namespace bitprim {
@@ -24,8 +24,9 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -62,64 +63,46 @@ bool json_in_getaddresstxids(nlohmann::json const& json_object, std::vector<std:
 }
 
 template <typename Blockchain>
-bool getaddresstxids(nlohmann::json& json_object, int& error, std::string& error_code, std::vector<std::string> const& payment_addresses, size_t const& start_height, size_t const& end_height, Blockchain const& chain)
+void getaddresstxids(std::vector<std::string> const& payment_addresses, size_t const& start_height, size_t const& end_height, Blockchain const& chain, message_result_handler handler)
 {
-    int i = 0;
-    for (const auto & payment_address : payment_addresses) {
-        libbitcoin::wallet::payment_address address(payment_address);
-        if (address)
-        {
-            boost::latch latch(2);
-            chain.fetch_confirmed_transactions(address, INT_MAX, start_height,
-                [&](const libbitcoin::code &ec, const std::vector<libbitcoin::hash_digest>& history_list) {
-                if (ec == libbitcoin::error::success) {
-                    // TODO: remove this if the new code pass the tests
-                    //                                    for (const auto & history : history_list) {
-                    //                                        libbitcoin::hash_digest temp;
-                    //                                        if (history.height < end_height) {
-                    //                                            // If a txns spend more than one utxo from the address, just add the first one
-                    //                                            temp = history.point.hash();
-                    //                                            if (std::find (unique_data.begin(), unique_data.end(), history.point.hash()) == unique_data.end()){
-                    //                                                unique_data.push_back(temp);
-                    //                                            }
-                    //                                        }
-                    //                                    }
-                    for (auto it = history_list.rbegin(); it != history_list.rend(); ++it) {
-                        json_object[i] = libbitcoin::encode_hash(*it);
-                        ++i;
-                    }
-                }
-                else
-                {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available for address " + address;
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+    auto state = std::make_shared<message_state>(nlohmann::json::array());
+    auto addresses = std::make_shared<std::vector<std::string>>(payment_addresses);
+
+    async_loop::run(addresses->size(), [state, addresses, start_height, &chain](size_t n, async_loop::next_handler next) {
+        libbitcoin::wallet::payment_address address((*addresses)[n]);
+        if (!address) {
+            state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state->error_code = "Invalid address";
+            next();
+            return;
         }
-        else {
-            error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-            error_code = "Invalid address";
-        }
-    }
-    if (error != 0)
-        return false;
 
-    return true;
+        chain.fetch_confirmed_transactions(address, INT_MAX, start_height,
+            [state, address, next](const libbitcoin::code &ec, const std::vector<libbitcoin::hash_digest>& history_list) {
+            if (ec == libbitcoin::error::success) {
+                auto& json_object = state->result;
+                for (auto it = history_list.rbegin(); it != history_list.rend(); ++it) {
+                    json_object.push_back(rpc::encode_hash(*it));
+                }
+            }
+            else
+            {
+                state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+                state->error_code = "No information available for address " + address.encoded();
+            }
+            next();
+        });
+    }, [state, handler]() {
+        state->complete(handler);
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_getaddresstxids(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void process_getaddresstxids(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, json_handler handler)
 {
     nlohmann::json container;
-    nlohmann::json result = nlohmann::json::array();
-
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::vector<std::string> payment_address;
     size_t start_height;
     size_t end_height;
@@ -143,20 +126,21 @@ nlohmann::json process_getaddresstxids(nlohmann::json const& json_in, Blockchain
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n";
-        return container;
+        handler(std::move(container));
+        return;
     }
 
-    if (getaddresstxids(result, error, error_code, payment_address, start_height, end_height, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
-    }
-
-    return container;
+    getaddresstxids(payment_address, start_height, end_height, chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
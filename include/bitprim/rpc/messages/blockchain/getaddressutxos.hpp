@@ -24,9 +24,18 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/index/address_index.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
+#include <bitprim/rpc/messages/blockchain/header_json.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace bitprim {
 
@@ -62,118 +71,208 @@ bool json_in_getaddressutxos(nlohmann::json const& json_object, std::vector<std:
     return true;
 }
 
-template <typename Blockchain>
-bool getaddressutxos(nlohmann::json& json_object, int& error, std::string& error_code, std::vector<std::string> const& payment_addresses, const bool chain_info, Blockchain const& chain) {
-#ifdef BITPRIM_CURRENCY_BCH
-    bool witness = false;
-#else
-    bool witness = true;
-#endif
-
-    boost::latch latch(2);
-    nlohmann::json utxos;
-    int i = 0;
-    for (const auto & payment_address : payment_addresses) {
+// Answers from the address index, false when it is not available.
+inline
+bool getaddressutxos_indexed(std::vector<std::string> const& payment_addresses, const bool chain_info, rpc::address_index const* index, message_result_handler const& handler) {
+    if (index == nullptr) {
+        return false;
+    }
+
+    message_state state;
+    nlohmann::json utxos = nlohmann::json::array();
+    std::vector<rpc::address_index::utxo> unspent;
+    for (auto const& payment_address : payment_addresses) {
         libbitcoin::wallet::payment_address address(payment_address);
-        if (address)
-        {
-            chain.fetch_history(address, INT_MAX, 0, [&](const libbitcoin::code &ec,
-                libbitcoin::chain::history_compact::list history_compact_list) {
-                if (ec == libbitcoin::error::success) {
-                    for (const auto & history : history_compact_list) {
-                        if (history.kind == libbitcoin::chain::point_kind::output) {
-                            // It's outpoint
-                            boost::latch latch2(2);
-                            chain.fetch_spend(history.point, [&](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
-                                if (ec == libbitcoin::error::not_found) {
-                                    // Output not spent
-                                    utxos[i]["address"] = address.encoded();
-                                    utxos[i]["txid"] = libbitcoin::encode_hash(history.point.hash());
-                                    utxos[i]["outputIndex"] = history.point.index();
-                                    utxos[i]["satoshis"] = history.value;
-                                    utxos[i]["height"] = history.height;
-                                    // We need to fetch the txn to get the script
-                                    boost::latch latch3(2);
-                                    chain.fetch_transaction(history.point.hash(), false, witness,
-                                        [&](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                                            size_t height) {
-                                        if (ec == libbitcoin::error::success) {
-                                            utxos[i]["script"] = libbitcoin::encode_base16(tx_ptr->outputs().at(history.point.index()).script().to_data(0));
-                                        }
-                                        else {
-                                            utxos[i]["script"] = "";
-                                        }
-                                        latch3.count_down();
-                                    });
-                                    latch3.count_down_and_wait();
-                                    ++i;
-                                }
-                                latch2.count_down();
-                            });
-                            latch2.count_down_and_wait();
-                        }
-                    }
-                }
-                else {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available for address " + address;
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+        if (!address) {
+            state.error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state.error_code = "Invalid address";
+            continue;
         }
-        else {
-            error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-            error_code = "Invalid address";
+
+        unspent.clear();
+        if (!index->unspent(address.hash(), unspent)) {
+            return false;
+        }
+
+        for (auto const& entry : unspent) {
+            nlohmann::json utxo;
+            utxo["address"] = address.encoded();
+            utxo["txid"] = rpc::encode_hash(entry.point.hash());
+            utxo["outputIndex"] = entry.point.index();
+            utxo["satoshis"] = entry.value;
+            utxo["height"] = entry.height;
+            utxo["script"] = rpc::encode_base16(entry.script);
+            utxos.push_back(std::move(utxo));
         }
     }
 
     if (chain_info) {
-        json_object["utxos"] = utxos;
+        state.result["utxos"] = std::move(utxos);
 
+        // The tip of the index, so the outputs and the height always agree.
         size_t height;
-        boost::latch latch2(2);
-        chain.fetch_last_height([&](const libbitcoin::code &ec, size_t last_height) {
-            if (ec == libbitcoin::error::success) {
-                height = last_height;
-            }
-            latch2.count_down();
+        libbitcoin::hash_digest hash;
+        if (index->top(height, hash)) {
+            state.result["height"] = height;
+            state.result["hash"] = rpc::encode_hash(hash);
+        }
+    }
+    else {
+        state.result = std::move(utxos);
+    }
+
+    state.complete(handler);
+    return true;
+}
+
+// Output of an address found unspent in its history.
+struct utxo_row {
+    size_t address;
+    libbitcoin::chain::output_point point;
+    uint64_t value;
+    size_t height;
+    bool unspent;
+};
+
+// Unspent output candidates among the history rows of an address. The
+// spends of an address' outputs are in its own history, keyed only by a
+// checksum of the point they spend, so an output is left out only when no
+// other output of the address has its checksum. Outputs sharing one are
+// all kept, the spend checks against the store tell them apart.
+inline
+void unspent_candidates(size_t address, libbitcoin::chain::history_compact::list const& history, std::vector<utxo_row>& rows) {
+    std::unordered_set<uint64_t> spent;
+    std::unordered_map<uint64_t, size_t> outputs;
+    for (auto const& row : history) {
+        if (row.kind == libbitcoin::chain::point_kind::spend) {
+            spent.insert(row.previous_checksum);
+        } else {
+            ++outputs[row.point.checksum()];
+        }
+    }
+
+    for (auto const& row : history) {
+        if (row.kind != libbitcoin::chain::point_kind::output) {
+            continue;
+        }
+        auto const checksum = row.point.checksum();
+        if (spent.count(checksum) == 0 || outputs[checksum] > 1) {
+            rows.push_back(utxo_row{address, row.point, row.value, row.height, false});
+        }
+    }
+}
+
+// Without the address index: the histories are read first, the outputs
+// left then go through a single batch of spend checks and their scripts
+// are read in one pass, ordered by transaction.
+template <typename Blockchain>
+void getaddressutxos(std::vector<std::string> const& payment_addresses, const bool chain_info, Blockchain const& chain, rpc::address_index const* index,
+    rpc::header_index const* headers, rpc::output_cache* outputs, work_dispatcher const& dispatch, message_result_handler handler) {
+    if (getaddressutxos_indexed(payment_addresses, chain_info, index, handler)) {
+        return;
+    }
+
+    auto state = std::make_shared<message_state>();
+    auto addresses = std::make_shared<std::vector<libbitcoin::wallet::payment_address>>();
+    auto rows = std::make_shared<std::vector<utxo_row>>();
+
+    auto finish = [state, addresses, rows, chain_info, headers, outputs, handler, &chain]() {
+        // Outputs of the same transaction are read one after the other.
+        std::vector<size_t> order(rows->size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&rows](size_t a, size_t b) {
+            return (*rows)[a].point < (*rows)[b].point;
         });
-        latch2.count_down_and_wait();
 
-        boost::latch latch3(2);
-        chain.fetch_block(height, witness, [&](const libbitcoin::code &ec, libbitcoin::block_const_ptr block, size_t) {
-            if (ec == libbitcoin::error::success) {
-                json_object["height"] = height;
-                json_object["hash"] = libbitcoin::encode_hash(block->hash());
+        std::vector<std::string> scripts(rows->size());
+        libbitcoin::chain::output output;
+        for (auto const i : order) {
+            auto const& row = (*rows)[i];
+            if (row.unspent && get_prevout(output, row.point, chain, outputs)) {
+                scripts[i] = rpc::encode_base16(output.script().to_data(0));
             }
-            latch3.count_down();
-        });
-        latch3.count_down_and_wait();
+        }
 
-    }
-    else {
-        json_object = utxos;
+        nlohmann::json utxos = nlohmann::json::array();
+        for (size_t i = 0; i < rows->size(); ++i) {
+            auto const& row = (*rows)[i];
+            if (!row.unspent) {
+                continue;
+            }
+            nlohmann::json utxo;
+            utxo["address"] = (*addresses)[row.address].encoded();
+            utxo["txid"] = rpc::encode_hash(row.point.hash());
+            utxo["outputIndex"] = row.point.index();
+            utxo["satoshis"] = row.value;
+            utxo["height"] = row.height;
+            utxo["script"] = std::move(scripts[i]);
+            utxos.push_back(std::move(utxo));
+        }
+
+        if (!chain_info) {
+            state->result = std::move(utxos);
+            state->complete(handler);
+            return;
+        }
+
+        state->result["utxos"] = std::move(utxos);
+        size_t height;
+        libbitcoin::hash_digest hash;
+        if (get_tip(height, hash, chain, headers)) {
+            state->result["height"] = height;
+            state->result["hash"] = rpc::encode_hash(hash);
+        }
+        state->complete(handler);
+    };
+
+    // The store answers the spend checks inline, each one is handed to the
+    // workers so the window really has several of them running.
+    auto check_spends = [rows, finish, dispatch, &chain]() {
+        async_parallel::run(rows->size(), spend_queries_in_flight, [rows, dispatch, &chain](size_t i, async_parallel::next_handler next) {
+            run_work(dispatch, [rows, i, next, &chain]() {
+                chain.fetch_spend((*rows)[i].point, [rows, i, next](const libbitcoin::code &ec, libbitcoin::chain::input_point /*input*/) {
+                    (*rows)[i].unspent = ec == libbitcoin::error::not_found;
+                    next();
+                });
+            });
+        }, finish);
+    };
+
+    for (auto const& payment_address : payment_addresses) {
+        addresses->emplace_back(payment_address);
     }
 
-    if (error != 0)
-        return false;
+    async_loop::run(addresses->size(), [state, addresses, rows, &chain](size_t n, async_loop::next_handler next) {
+        auto const& address = (*addresses)[n];
+        if (!address) {
+            state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+            state->error_code = "Invalid address";
+            next();
+            return;
+        }
 
-    return true;
+        chain.fetch_history(address, INT_MAX, 0, [state, address, rows, n, next](const libbitcoin::code &ec,
+            libbitcoin::chain::history_compact::list history_compact_list) {
+            if (ec != libbitcoin::error::success) {
+                state->error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
+                state->error_code = "No information available for address " + address.encoded();
+            } else {
+                unspent_candidates(n, history_compact_list, *rows);
+            }
+            next();
+        });
+    }, check_spends);
 }
 
 template <typename Blockchain>
-nlohmann::json process_getaddressutxos(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void process_getaddressutxos(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::address_index const* index,
+    rpc::header_index const* headers, rpc::output_cache* outputs, work_dispatcher const& dispatch, json_handler handler)
 {
-
     nlohmann::json container;
-    nlohmann::json result = nlohmann::json::array();
-
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::vector<std::string> payment_address;
     bool chain_info;
     if (!json_in_getaddressutxos(json_in, payment_address, chain_info))
@@ -201,21 +300,21 @@ nlohmann::json process_getaddressutxos(nlohmann::json const& json_in, Blockchain
             "    \"satoshis\"  (number) The number of satoshis of the output\n"
             "  }\n"
             "]\n";
-        return container;
-    }
-
-    if (getaddressutxos(result, error, error_code, payment_address, chain_info, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
+        handler(std::move(container));
+        return;
     }
 
-    return container;
-
+    getaddressutxos(payment_address, chain_info, chain, index, headers, outputs, dispatch, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
@@ -24,8 +24,8 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -36,7 +36,7 @@ namespace bitprim {
         chain.get_last_height(top_height);
         libbitcoin::hash_digest hash;
         if(chain.get_block_hash(hash, top_height)){
-            json_object = libbitcoin::encode_hash(hash);
+            json_object = rpc::encode_hash(hash);
             return true;
         } else return false;
 
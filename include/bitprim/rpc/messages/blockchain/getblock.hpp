@@ -24,31 +24,207 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
+#include <bitprim/rpc/messages/blockchain/getrawtransaction.hpp>
+#include <bitprim/rpc/messages/blockchain/header_json.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 namespace bitprim {
 
+// Transactions serialized by each job of a verbosity 2 block.
+constexpr size_t block_transactions_per_job = 256;
+
 inline
-bool json_in_getblock(nlohmann::json const& json_object, std::string & hash, bool & verbose) {
+bool json_in_getblock(nlohmann::json const& json_object, std::string & hash, int & verbosity) {
     if (json_object["params"].size() == 0)
         return false;
-    verbose = true;
+    verbosity = 1;
     try {
         hash = json_object["params"][0];
         if (json_object["params"].size() == 2) {
-            verbose = json_object["params"][1];
+            auto const& param = json_object["params"][1];
+            if (param.is_boolean()) {
+                verbosity = param.get<bool>() ? 1 : 0;
+            } else if (param.is_number_integer()) {
+                verbosity = param.get<int>();
+            } else {
+                return false;
+            }
         }
     }
     catch (const std::exception & e) {
         return false;
     }
-    return true;
+    return verbosity >= 0 && verbosity <= 2;
+}
+
+// Decoded transaction of a verbosity 2 block. Unlike getrawtransaction its
+// inputs carry no prevout data, the block alone is enough to build it.
+inline
+void write_block_transaction(json_writer& writer, libbitcoin::chain::transaction const& tx, bool use_testnet_rules) {
+    writer.begin_object();
+    writer.key("txid");
+    writer.hex_reversed(tx.hash());
+    writer.key("hash");
+    writer.hex_reversed(tx.hash());
+    writer.key("version");
+    writer.number(tx.version());
+    writer.key("size");
+    writer.number(tx.serialized_size(/*version is not used*/ 0));
+    writer.key("locktime");
+    writer.number(tx.locktime());
+
+    writer.key("vin");
+    writer.begin_array();
+    for (auto const& in : tx.inputs()) {
+        writer.begin_object();
+        if (tx.is_coinbase()) {
+            writer.key("coinbase");
+            writer.hex(in.script().to_data(0));
+        } else {
+            writer.key("txid");
+            writer.hex_reversed(in.previous_output().hash());
+            writer.key("vout");
+            writer.number(in.previous_output().index());
+            writer.key("scriptSig");
+            writer.begin_object();
+            writer.key("asm");
+            writer.string(in.script().to_string(0));
+            writer.key("hex");
+            writer.hex(in.script().to_data(0));
+            writer.end_object();
+        }
+        writer.key("sequence");
+        writer.number(in.sequence());
+        writer.end_object();
+    }
+    writer.end_array();
+
+    writer.key("vout");
+    writer.begin_array();
+    uint32_t n = 0;
+    for (auto const& out : tx.outputs()) {
+        writer.begin_object();
+        writer.key("value");
+        writer.number(out.value() / (double)100000000);
+        writer.key("valueSat");
+        writer.number(out.value());
+        writer.key("n");
+        writer.number(n++);
+        writer.key("scriptPubKey");
+        writer.begin_object();
+        writer.key("asm");
+        writer.string(out.script().to_string(0));
+        writer.key("hex");
+        writer.hex(out.script().to_data(0));
+
+        uint8_t reqsig = 1;
+        auto const type = get_txn_type(out.script());
+        if (type == "pay_multisig" || type == "sign_multisig") {
+            reqsig = static_cast<uint8_t>(out.script().operations()[0].code());
+        }
+        writer.key("reqSigs");
+        writer.number(int(reqsig));
+        writer.key("type");
+        writer.string(type);
+        auto const out_addr = out.address(use_testnet_rules);
+        if (out_addr) {
+            writer.key("addresses");
+            writer.begin_array();
+            writer.string(out_addr.encoded());
+            writer.end_array();
+        }
+        writer.end_object();
+        writer.end_object();
+    }
+    writer.end_array();
+
+    writer.key("hex");
+    writer.hex(tx.to_data(/*version is not used*/ 0));
+    writer.end_object();
 }
 
+// Fields of a verbose block up to its "tx" array, left open for the
+// transactions, and the ones after it.
+inline
+void write_verbose_block_head(json_writer& writer, libbitcoin::chain::header const& header, size_t height, uint64_t serialized_size,
+    rpc::header_index::record const& record) {
+    writer.begin_object();
+    write_header_head(writer, header, height, record, &serialized_size);
+    writer.key("tx");
+    writer.begin_array();
+}
+
+inline
+void write_verbose_block_tail(json_writer& writer, libbitcoin::chain::header const& header, rpc::header_index::record const& record) {
+    writer.end_array();
+    write_header_tail(writer, header, record);
+    writer.end_object();
+}
+
+// The transactions of a block already in memory are decoded by several
+// jobs, spread over the workers by dispatch, each into its own piece of
+// the "tx" array; the pieces are then joined in block order.
 template <typename Blockchain>
-bool getblock(nlohmann::json& json_object, int& error, std::string& error_code, const std::string & block_hash, bool verbose, Blockchain const& chain) {
+void getblock_transactions(libbitcoin::block_const_ptr block, size_t height, libbitcoin::hash_digest const& hash, Blockchain const& chain,
+    rpc::header_index const* headers, bool use_testnet_rules, work_dispatcher const& dispatch, nlohmann::json const& id, response_handler handler) {
+    auto const record = header_record(hash, height, block->header(), chain, headers);
+
+    auto const count = block->transactions().size();
+    auto const jobs = (count + block_transactions_per_job - 1) / block_transactions_per_job;
+    auto pieces = std::make_shared<std::vector<std::string>>(jobs);
+
+    async_parallel::run(jobs, jobs, [block, pieces, count, use_testnet_rules, dispatch](size_t job, async_parallel::next_handler next) {
+        auto work = [block, pieces, count, job, use_testnet_rules, next]() {
+            auto const& txs = block->transactions();
+            auto const first = job * block_transactions_per_job;
+            auto const last = std::min(first + block_transactions_per_job, count);
+
+            json_writer writer;
+            for (auto i = first; i != last; ++i) {
+                if (i != first) {
+                    writer.buffer().push_back(',');
+                }
+                write_block_transaction(writer, txs[i], use_testnet_rules);
+            }
+            (*pieces)[job] = writer.release();
+            next();
+        };
+        run_work(dispatch, std::move(work));
+    }, [block, height, record, pieces, id, handler]() {
+        size_t capacity = 1024;
+        for (auto const& piece : *pieces) {
+            capacity += piece.size();
+        }
+
+        // The fields around the "tx" array and each piece are an item.
+        auto const last = pieces->size() + 1;
+        streamed_result::run(id, last + 1, [block, height, record, pieces, last](json_writer& writer, size_t item) {
+            if (item == 0) {
+                write_verbose_block_head(writer, block->header(), height, block->serialized_size(0), record);
+            } else if (item == last) {
+                write_verbose_block_tail(writer, block->header(), record);
+            } else {
+                auto& piece = (*pieces)[item - 1];
+                writer.raw(piece);
+                std::string().swap(piece);
+            }
+        }, capacity, handler);
+    });
+}
+
+// The result is written straight into the response buffer, blocks with
+// thousands of transactions never go through a DOM, and streamed when the
+// transport allows it.
+template <typename Blockchain>
+void getblock(const std::string & block_hash, int verbosity, Blockchain const& chain, rpc::header_index const* headers, bool use_testnet_rules,
+    work_dispatcher const& dispatch, nlohmann::json const& id, response_handler handler) {
 #ifdef BITPRIM_CURRENCY_BCH
     bool witness = false;
 #else
@@ -56,131 +232,96 @@ bool getblock(nlohmann::json& json_object, int& error, std::string& error_code,
 #endif
 
     libbitcoin::hash_digest hash;
-    if (libbitcoin::decode_hash(hash, block_hash)) {
-        if(verbose)
-        {
+    if (!rpc::decode_hash(hash, block_hash)) {
+        handler(serialize_error(id, bitprim::RPC_INVALID_PARAMETER, "Invalid block hash"));
+        return;
+    }
 
-            boost::latch latch(2);
-            chain.fetch_block_header_txs_size(hash, [&](const libbitcoin::code &ec, libbitcoin::header_const_ptr header,
-                size_t height, const std::shared_ptr<libbitcoin::hash_list> txs, uint64_t serialized_size)
-            {
-                if (ec == libbitcoin::error::success) {
-                        json_object["hash"] = block_hash;
-
-                        size_t top_height;
-                        chain.get_last_height(top_height);
-                        json_object["confirmations"] = top_height - height + 1;
-
-                        json_object["size"] = serialized_size;
-                        json_object["height"] = height;
-                        json_object["version"] = header->version();
-                        // TODO: encode the version to base 16
-                        json_object["versionHex"] = header->version();
-                        json_object["merkleroot"] = libbitcoin::encode_hash(header->merkle());
-
-                        int i = 0;
-                        for (const auto & txns : *txs) {
-                            json_object["tx"][i] = libbitcoin::encode_hash(txns);
-                            ++i;
-                        }
-
-                        json_object["time"] = header->timestamp();
-                        // TODO: get real median time
-                        json_object["mediantime"] = header->timestamp();
-                        json_object["nonce"] = header->nonce();
-                        // TODO: encode bits to base 16
-                        json_object["bits"] = header->bits();
-                        json_object["difficulty"] = bits_to_difficulty(header->bits());
-                        // TODO: validate that proof is chainwork
-                        // Optimizate the encoded to base 16
-                        std::stringstream ss;
-                        ss << std::setfill('0')
-                            << std::nouppercase
-                            << std::hex
-                            << header->proof();
-                        json_object["chainwork"] = ss.str();
-                        json_object["previousblockhash"] = libbitcoin::encode_hash(header->previous_block_hash());
-
-                        json_object["nextblockhash"];
-
-                        libbitcoin::hash_digest nexthash;
-                        if(chain.get_block_hash(nexthash, height+1))
-                            json_object["nextblockhash"] = libbitcoin::encode_hash(nexthash);
-                    
+    if (verbosity == 1) {
+        chain.fetch_block_header_txs_size(hash, [&chain, hash, headers, id, handler](const libbitcoin::code &ec, libbitcoin::header_const_ptr header,
+            size_t height, const std::shared_ptr<libbitcoin::hash_list> txs, uint64_t serialized_size)
+        {
+            if (ec != libbitcoin::error::success) {
+                if (ec == libbitcoin::error::not_found) {
+                    handler(serialize_error(id, bitprim::RPC_INVALID_ADDRESS_OR_KEY, "Block not found"));
+                } else {
+                    handler(serialize_error(id, bitprim::RPC_INTERNAL_ERROR, "Can't read block from disk"));
                 }
-                else {
-                    if (ec == libbitcoin::error::not_found)
-                    {
-                        error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                        error_code = "Block not found";
-                    }
-                    else {
-                        error = bitprim::RPC_INTERNAL_ERROR;
-                        error_code = "Can't read block from disk";
-                    }
+                return;
+            }
+
+            auto const record = header_record(hash, height, *header, chain, headers);
+
+            auto const capacity = 1024 + txs->size() * (2 * libbitcoin::hash_size + 3);
+            auto const last = txs->size() + 1;
+            streamed_result::run(id, last + 1, [header, height, serialized_size, record, txs, last](json_writer& writer, size_t item) {
+                if (item == 0) {
+                    write_verbose_block_head(writer, *header, height, serialized_size, record);
+                } else if (item == last) {
+                    write_verbose_block_tail(writer, *header, record);
+                } else {
+                    writer.hex_reversed((*txs)[item - 1]);
                 }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+            }, capacity, handler);
+        });
     } else {
-        boost::latch latch(2);
-        chain.fetch_block(hash, witness, [&](const libbitcoin::code &ec, libbitcoin::block_const_ptr block, size_t height) {
+        chain.fetch_block(hash, witness, [&chain, verbosity, hash, headers, use_testnet_rules, dispatch, id, handler](const libbitcoin::code &ec, libbitcoin::block_const_ptr block, size_t height) {
             if (ec == libbitcoin::error::success) {
-                json_object = libbitcoin::encode_base16(block->to_data(0));
-            } else {
-                    if (ec == libbitcoin::error::not_found)
-                    {
-                        error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                        error_code = "Block not found";
-                    }
-                    else {
-                        error = bitprim::RPC_INTERNAL_ERROR;
-                        error_code = "Can't read block from disk";
+                if (verbosity == 2) {
+                    getblock_transactions(block, height, hash, chain, headers, use_testnet_rules, dispatch, id, handler);
+                    return;
+                }
+                // The hex string is encoded a chunk at a time, each an item
+                // between its quotes.
+                auto const data = std::make_shared<libbitcoin::data_chunk>(block->to_data(0));
+                auto const part = response_chunk_size / 2;
+                auto const last = (data->size() + part - 1) / part + 1;
+                streamed_result::run(id, last + 1, [data, part, last](json_writer& writer, size_t item) {
+                    if (item == 0) {
+                        writer.begin_hex();
+                    } else if (item == last) {
+                        writer.end_hex();
+                    } else {
+                        auto const offset = (item - 1) * part;
+                        writer.hex_part(data->data() + offset, std::min(part, data->size() - offset));
                     }
+                }, 2 * data->size() + 64, handler);
+            } else if (ec == libbitcoin::error::not_found) {
+                handler(serialize_error(id, bitprim::RPC_INVALID_ADDRESS_OR_KEY, "Block not found"));
+            } else {
+                handler(serialize_error(id, bitprim::RPC_INTERNAL_ERROR, "Can't read block from disk"));
             }
-            latch.count_down();
         });
-        latch.count_down_and_wait();
-
-    }
-    }
-    else {
-        error = bitprim::RPC_INVALID_PARAMETER;
-        error_code = "Invalid block hash";
     }
-
-    if (error != 0)
-        return false;
-    return true;
-
 }
 
 
 template <typename Blockchain>
-nlohmann::json process_getblock(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void process_getblock(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::header_index const* headers,
+    work_dispatcher const& dispatch, response_handler handler)
 {
 
-    nlohmann::json container, result;
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string hash;
-    bool verbose;
-    if (!json_in_getblock(json_in, hash, verbose)) //if false return error
+    int verbosity;
+    if (!json_in_getblock(json_in, hash, verbosity)) //if false return error
     {
         container["error"]["code"] = bitprim::RPC_PARSE_ERROR;
-        container["error"]["message"] = "getblock \"blockhash\" ( verbose )\n"
-            "\nIf verbose is false, returns a string that is serialized, "
+        container["error"]["message"] = "getblock \"blockhash\" ( verbosity )\n"
+            "\nIf verbosity is 0, returns a string that is serialized, "
             "hex-encoded data for block 'hash'.\n"
-            "If verbose is true, returns an Object with information about "
+            "If verbosity is 1, returns an Object with information about "
             "block <hash>.\n"
+            "If verbosity is 2, returns an Object with information about "
+            "block <hash> and information about each transaction.\n"
             "\nArguments:\n"
             "1. \"blockhash\"          (string, required) The block hash\n"
-            "2. verbose                (boolean, optional, default=true) true "
-            "for a json object, false for the hex encoded data\n"
-            "\nResult (for verbose = true):\n"
+            "2. verbosity              (numeric, optional, default=1) 0 for "
+            "hex encoded data, 1 for a json object, and 2 for json object "
+            "with transaction data; true and false stand for 1 and 0\n"
+            "\nResult (for verbosity = 1):\n"
             "{\n"
             "  \"hash\" : \"hash\",     (string) the block hash (same as "
             "provided)\n"
@@ -210,23 +351,24 @@ nlohmann::json process_getblock(nlohmann::json const& json_in, Blockchain const&
             "  \"nextblockhash\" : \"hash\"       (string) The hash of the "
             "next block\n"
             "}\n"
-            "\nResult (for verbose=false):\n"
+            "\nResult (for verbosity = 2):\n"
+            "{\n"
+            "  ...,                     Same output as verbosity = 1.\n"
+            "  \"tx\" : [               (array of Objects) The transactions in "
+            "the format of the getrawtransaction RPC, without prevout and "
+            "spent data.\n"
+            "         ,...\n"
+            "  ],\n"
+            "  ,...                     Same output as verbosity = 1.\n"
+            "}\n"
+            "\nResult (for verbosity = 0):\n"
             "\"data\"             (string) A string that is serialized, "
             "hex-encoded data for block 'hash'.\n";
-        return container;
-    }
-
-    if (getblock(result, error, error_code, hash, verbose, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
+        handler(serialize_response(container));
+        return;
     }
 
-    return container;
+    getblock(hash, verbosity, chain, headers, use_testnet_rules, dispatch, container["id"], std::move(handler));
 }
 
 } //namespace bitprim
@@ -24,12 +24,13 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
     template <typename Blockchain>
-    bool getblockchaininfo(nlohmann::json& json_object, int& error, std::string& error_code, Blockchain const& chain)
+    void getblockchaininfo(Blockchain const& chain, message_result_handler handler)
     {
 
 #ifdef BITPRIM_CURRENCY_BCH
@@ -37,18 +38,16 @@ namespace bitprim {
 #else
     bool witness = true;
 #endif
-        json_object["chain"] = "main";
-
         size_t top_height;
-        libbitcoin::message::header::ptr top;
         chain.get_last_height(top_height);
 
-        boost::latch latch(2);
-        chain.fetch_block(top_height, witness, [&](const libbitcoin::code &ec, libbitcoin::block_const_ptr block, size_t height) {
+        chain.fetch_block(top_height, witness, [handler](const libbitcoin::code &ec, libbitcoin::block_const_ptr block, size_t height) {
+            nlohmann::json json_object;
+            json_object["chain"] = "main";
             if (ec == libbitcoin::error::success) {
                 json_object["blocks"] = height;
                 json_object["headers"] = height;
-                json_object["bestblockhash"] = libbitcoin::encode_hash(block->hash());
+                json_object["bestblockhash"] = rpc::encode_hash(block->hash());
                 json_object["difficulty"] = bits_to_difficulty(block->header().bits());
                 json_object["mediantime"] = block->header().timestamp(); //TODO Get medianpasttime
                 json_object["verificationprogress"] = 1;
@@ -64,32 +63,27 @@ namespace bitprim {
                 json_object["bip9_softforks"] = nlohmann::json::array(); //TODO Check softforks
 
             }
-            latch.count_down();
+            handler(std::move(json_object), 0, "");
         });
-        latch.count_down_and_wait();
-        return true;
     }
 
     template <typename Blockchain>
-    nlohmann::json process_getblockchaininfo(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+    void process_getblockchaininfo(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, json_handler handler)
     {
-        nlohmann::json container, result;
+        nlohmann::json container;
         container["id"] = json_in["id"];
 
-        int error = 0;
-        std::string error_code;
-
-        if (getblockchaininfo(result, error, error_code, chain))
-        {
-            container["result"] = result;
-            container["error"];
-        }
-        else {
-            container["error"]["code"] = error;
-            container["error"]["message"] = error_code;
-        }
-
-        return container;
+        getblockchaininfo(chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+            if (error == 0) {
+                container["result"] = std::move(result);
+                container["error"];
+            }
+            else {
+                container["error"]["code"] = error;
+                container["error"]["message"] = error_code;
+            }
+            handler(std::move(container));
+        });
     }
 
 }
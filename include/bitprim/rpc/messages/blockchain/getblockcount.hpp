@@ -25,7 +25,6 @@
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -24,9 +24,9 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -49,7 +49,7 @@ bool getblockhash(nlohmann::json& json_object, int& error, std::string& error_co
 {
     libbitcoin::hash_digest hash;
     if(chain.get_block_hash(hash, height)){
-        json_object = libbitcoin::encode_hash(hash);
+        json_object = rpc::encode_hash(hash);
         return true;
     } else return false;
 }
@@ -21,12 +21,16 @@
 #ifndef BITPRIM_RPC_MESSAGES_BLOCKCHAIN_GETBLOCKHASHES_HPP_
 #define BITPRIM_RPC_MESSAGES_BLOCKCHAIN_GETBLOCKHASHES_HPP_
 
+#include <deque>
+#include <vector>
+
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/index/header_index.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -66,22 +70,17 @@ bool update_mid(size_t top_height, size_t low_height, size_t& mid, libbitcoin::m
     return true;
 }
 
+// Without the header index: binary search on the chain headers, then walk
+// both ways from the block found.
 template <typename Blockchain>
-bool getblockhashes(nlohmann::json& json_object, int& error, std::string& error_code, uint32_t time_high, uint32_t time_low, bool no_orphans, bool logical_times, Blockchain const& chain)
+void getblockhashes_scan(uint32_t time_high, uint32_t time_low, std::vector<rpc::header_index::entry>& blocks, Blockchain const& chain)
 {
-    json_object = nlohmann::json::array();
-    if (time_high < time_low) {
-        error = RPC_INVALID_PARAMETER;
-        error_code = "Parameter \"HIGH\" is smaller than \"LOW\"";
-        return false;
-    }
-
     libbitcoin::message::header::ptr genesis, top, mid_header;
     getblockheader(0, genesis, chain);
     uint32_t time_genesis = genesis->timestamp();
 
     if (time_high < time_genesis) {
-        return true;
+        return;
     }
 
     if (time_low < time_genesis) time_low = time_genesis;
@@ -93,7 +92,7 @@ bool getblockhashes(nlohmann::json& json_object, int& error, std::string& error_
     uint32_t time_top = top->timestamp();
 
     if (time_top < time_low) {
-        return true;
+        return;
     }
 
     if (time_high > time_top) time_high = time_top;
@@ -116,44 +115,61 @@ bool getblockhashes(nlohmann::json& json_object, int& error, std::string& error_
     }
 
     if(!valid_blocks) {
-        return true;
+        return;
     }
 
-    libbitcoin::message::header::ptr last_header_found = mid_header;
+    std::deque<rpc::header_index::entry> hashes;
+
     uint32_t last_time_found = mid_header->timestamp();
     size_t last_height = mid;
-
-    libbitcoin::hash_digest last_hash = last_header_found->hash();
-
-    std::deque<std::pair<libbitcoin::hash_digest, uint32_t>> hashes;
+    libbitcoin::hash_digest last_hash = mid_header->hash();
 
     while (last_time_found <= time_high && last_height < top_height) {
-        hashes.push_back(std::make_pair(last_hash, last_time_found));
+        hashes.push_back(rpc::header_index::entry{last_time_found, last_hash});
         last_height++;
         getblockhash_time(last_height, last_hash, last_time_found, chain);
     }
 
-    last_height = mid - 1;
-    if(getblockheader(last_height, last_header_found, chain) == libbitcoin::error::success) {
-        last_time_found = last_header_found->timestamp();
-        while (last_time_found >= time_low && last_height >= 0) {
-            hashes.push_front(std::make_pair(last_hash, last_time_found));
-            last_height--;
-            getblockhash_time(last_height, last_hash, last_time_found, chain);
+    last_height = mid;
+    while (last_height > 0) {
+        last_height--;
+        if (getblockhash_time(last_height, last_hash, last_time_found, chain) != libbitcoin::error::success ||
+            last_time_found < time_low) {
+            break;
         }
+        hashes.push_front(rpc::header_index::entry{last_time_found, last_hash});
+    }
+
+    blocks.assign(hashes.begin(), hashes.end());
+}
+
+template <typename Blockchain>
+bool getblockhashes(nlohmann::json& json_object, int& error, std::string& error_code, uint32_t time_high, uint32_t time_low, bool no_orphans, bool logical_times, Blockchain const& chain, rpc::header_index const* index)
+{
+    json_object = nlohmann::json::array();
+    if (time_high < time_low) {
+        error = RPC_INVALID_PARAMETER;
+        error_code = "Parameter \"HIGH\" is smaller than \"LOW\"";
+        return false;
+    }
+
+    // The index answers from memory, a lower bound and a short scan.
+    std::vector<rpc::header_index::entry> blocks;
+    if (index == nullptr || !index->blocks(time_low, time_high, blocks)) {
+        getblockhashes_scan(time_high, time_low, blocks, chain);
     }
 
     int i = 0;
     if (!logical_times) {
-        for (const auto & h : hashes) {
-            json_object[i] = libbitcoin::encode_hash(h.first);
+        for (const auto & block : blocks) {
+            json_object[i] = rpc::encode_hash(block.hash);
             ++i;
         }
     }
     else {
-        for (const auto & h : hashes) {
-            json_object[i]["blockhash"] = libbitcoin::encode_hash(h.first);
-            json_object[i]["timestamp"] = h.second;
+        for (const auto & block : blocks) {
+            json_object[i]["blockhash"] = rpc::encode_hash(block.hash);
+            json_object[i]["timestamp"] = block.timestamp;
             ++i;
         }
     }
@@ -161,7 +177,7 @@ bool getblockhashes(nlohmann::json& json_object, int& error, std::string& error_
 }
 
 template <typename Blockchain>
-nlohmann::json process_getblockhashes(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+nlohmann::json process_getblockhashes(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::header_index const* index)
 {
     nlohmann::json container, result;
     container["id"] = json_in["id"];
@@ -200,7 +216,7 @@ nlohmann::json process_getblockhashes(nlohmann::json const& json_in, Blockchain
         return container;
     }
 
-    if (getblockhashes(result, error, error_code, time_high, time_low, no_orphans, logical_times, chain))
+    if (getblockhashes(result, error, error_code, time_high, time_low, no_orphans, logical_times, chain, index))
     {
         container["result"] = result;
         container["error"];
@@ -24,9 +24,11 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
+#include <bitprim/rpc/messages/blockchain/header_json.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -47,85 +49,50 @@ bool json_in_getblockheader(nlohmann::json const& json_object, std::string & has
     return true;
 }
 
+// Besides the header itself, read along with the block's height, every
+// field comes from the header index.
 template <typename Blockchain>
-bool rpc_getblockheader(nlohmann::json& json_object, int& error, std::string& error_code, const std::string & block_hash, bool verbose, Blockchain const& chain) {
+void rpc_getblockheader(const std::string & block_hash, bool verbose, Blockchain const& chain, rpc::header_index const* headers, nlohmann::json const& id, response_handler handler) {
     libbitcoin::hash_digest hash;
-    if (libbitcoin::decode_hash(hash, block_hash)) {
-
-        boost::latch latch(2);
-        chain.fetch_block_header_txs_size(hash, [&](const libbitcoin::code &ec, libbitcoin::header_const_ptr header, 
-            size_t height, const std::shared_ptr<libbitcoin::hash_list> txs, uint64_t serialized_size) {
-            if (ec == libbitcoin::error::success) {
-                if (!verbose) {
-                    json_object = libbitcoin::encode_base16(header->to_data(0));
-                }
-                else {
-                    json_object["hash"] = block_hash;
-
-                    size_t top_height;
-                    chain.get_last_height(top_height);
-                    json_object["confirmations"] = top_height - height + 1;
-
-                    json_object["size"] = serialized_size;
-                    json_object["height"] = height;
-                    json_object["version"] = header->version();
-                    // TODO: encode the version to base 16
-                    json_object["versionHex"] = header->version();
-                    json_object["merkleroot"] = libbitcoin::encode_hash(header->merkle());
-                    json_object["time"] = header->timestamp();
-                    // TODO: get real median time
-                    json_object["mediantime"] = header->timestamp();
-                    json_object["nonce"] = header->nonce();
-                    // TODO: encode bits to base 16
-                    json_object["bits"] = header->bits();
-                    json_object["difficulty"] = bits_to_difficulty(header->bits());
-                    // TODO: validate that proof is chainwork
-                    // Optimizate the encoded to base 16
-                    std::stringstream ss;
-                    ss << std::setfill('0')
-                        << std::nouppercase
-                        << std::hex
-                        << header->proof();
-                    json_object["chainwork"] = ss.str();
-                    json_object["previousblockhash"] = libbitcoin::encode_hash(header->previous_block_hash());
-
-                    json_object["nextblockhash"];
+    if (!rpc::decode_hash(hash, block_hash)) {
+        handler(serialize_error(id, bitprim::RPC_INVALID_PARAMETER, "Invalid block hash"));
+        return;
+    }
 
-                    libbitcoin::hash_digest nexthash;
-                    if(chain.get_block_hash(nexthash, height+1))
-                        json_object["nextblockhash"] = libbitcoin::encode_hash(nexthash);
-                }
+    chain.fetch_block_header_txs_size(hash, [&chain, hash, verbose, headers, id, handler](const libbitcoin::code &ec, libbitcoin::header_const_ptr header,
+        size_t height, const std::shared_ptr<libbitcoin::hash_list> txs, uint64_t serialized_size) {
+        if (ec != libbitcoin::error::success) {
+            if (ec == libbitcoin::error::not_found) {
+                handler(serialize_error(id, bitprim::RPC_INVALID_ADDRESS_OR_KEY, "Block not found"));
             } else {
-                if (ec == libbitcoin::error::not_found) {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "Block not found";
-                } else {
-                    error = bitprim::RPC_INTERNAL_ERROR;
-                    error_code = "Can't read block from disk";
-                }
+                handler(serialize_error(id, bitprim::RPC_INTERNAL_ERROR, "Can't read block from disk"));
             }
-            latch.count_down();
-        });
-        latch.count_down_and_wait();
-    } else {
-        error = bitprim::RPC_INVALID_PARAMETER;
-        error_code = "Invalid block hash";
-    }
+            return;
+        }
 
-    if (error != 0)
-        return false;
+        if (!verbose) {
+            auto const data = header->to_data(0);
+            handler(serialize_result(id, [&data](json_writer& writer) {
+                writer.hex(data);
+            }, 2 * data.size() + 64));
+            return;
+        }
 
-    return true;
+        auto const record = header_record(hash, height, *header, chain, headers);
+        handler(serialize_result(id, [&](json_writer& writer) {
+            writer.begin_object();
+            write_header_head(writer, *header, height, record, &serialized_size);
+            write_header_tail(writer, *header, record);
+            writer.end_object();
+        }, 1024));
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_getblockheader(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules) {
-    nlohmann::json container, result;
+void process_getblockheader(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::header_index const* headers, response_handler handler) {
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string hash;
     bool verbose;
     if (!json_in_getblockheader(json_in, hash, verbose)) { //if false return error
@@ -167,20 +134,11 @@ nlohmann::json process_getblockheader(nlohmann::json const& json_in, Blockchain
             "\nResult (for verbose=false):\n"
             "\"data\"             (string) A string that is serialized, "
             "hex-encoded data for block 'hash'.\n";
-        return container;
-    }
-
-    if (rpc_getblockheader(result, error, error_code, hash, verbose, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
+        handler(serialize_response(container));
+        return;
     }
 
-    return container;
+    rpc_getblockheader(hash, verbose, chain, headers, container["id"], std::move(handler));
 }
 
 } //namespace bitprim
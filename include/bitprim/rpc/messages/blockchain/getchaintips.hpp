@@ -24,8 +24,8 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -79,7 +79,7 @@ namespace bitprim {
             return false;
         }
         active["height"] = top_height;
-        active["hash"] = libbitcoin::encode_hash(top->hash());
+        active["hash"] = rpc::encode_hash(top->hash());
         active["branchlen"] = 0;
         active["status"] = "active";
         json_object[0] = active;
@@ -24,9 +24,14 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/blockchain/getspentinfo.hpp>
-#include <boost/thread/latch.hpp>
+#include <bitprim/rpc/messages/utils.hpp>
+
+#include <memory>
+#include <vector>
 
 namespace bitprim {
     
@@ -91,7 +96,134 @@ bool json_in_getrawtransaction(nlohmann::json const& json_object, std::string& t
 }
 
 template <typename Blockchain>
-bool getrawtransaction(nlohmann::json& json_object, int& error, std::string& error_code, std::string const& txid, const bool verbose, Blockchain const& chain, bool use_testnet_rules) {
+void getrawtransaction_verbose(std::shared_ptr<message_state> state, libbitcoin::transaction_const_ptr tx_ptr, size_t index, size_t height, std::string const& txid,
+    Blockchain const& chain, bool use_testnet_rules, rpc::output_cache* outputs, work_dispatcher const& dispatch, message_result_handler handler) {
+    auto& json_object = state->result;
+    json_object["hex"] = rpc::encode_base16(tx_ptr->to_data(/*version is not used*/ 0));
+    json_object["txid"] = txid;
+    json_object["hash"] = txid;
+    json_object["size"] = tx_ptr->serialized_size(/*version is not used*/ 0);
+    json_object["version"] = tx_ptr->version();
+    json_object["locktime"] = tx_ptr->locktime();
+
+    int vin = 0;
+    for (const auto & in : tx_ptr->inputs()) {
+        if (tx_ptr->is_coinbase()) {
+            json_object["vin"][vin]["coinbase"] = rpc::encode_base16(in.script().to_data(0));
+        }
+        else {
+            json_object["vin"][vin]["txid"] = rpc::encode_hash(in.previous_output().hash());
+            json_object["vin"][vin]["vout"] = in.previous_output().index();
+            json_object["vin"][vin]["scriptSig"]["asm"] = in.script().to_string(0);
+            json_object["vin"][vin]["scriptSig"]["hex"] = rpc::encode_base16(in.script().to_data(0));
+        }
+        json_object["vin"][vin]["sequence"] = in.sequence();
+        ++vin;
+    }
+
+    int i = 0;
+    for (const auto & out : tx_ptr->outputs()) {
+        json_object["vout"][i]["value"] = out.value() / (double)100000000;
+        json_object["vout"][i]["valueSat"] = out.value();
+        json_object["vout"][i]["n"] = i;
+        json_object["vout"][i]["scriptPubKey"]["asm"] = out.script().to_string(0);
+        json_object["vout"][i]["scriptPubKey"]["hex"] = rpc::encode_base16(out.script().to_data(0));
+
+        uint8_t reqsig = 1;
+        std::string type = get_txn_type(out.script());
+        if (type == "pay_multisig" || type == "sign_multisig") {
+            // TODO: check if it's working for multisig (see ExtractDestinations in bitcoind)
+            reqsig = static_cast<uint8_t>(out.script().operations()[0].code());
+        }
+
+        auto out_addr = out.address(use_testnet_rules);
+        json_object["vout"][i]["scriptPubKey"]["reqSigs"] = (int)reqsig;
+        json_object["vout"][i]["scriptPubKey"]["type"] = type;
+        if (out_addr){
+            json_object["vout"][i]["scriptPubKey"]["addresses"][0] = out_addr.encoded();
+        }
+        ++i;
+    }
+
+    // The spent outputs of the inputs and the spends of the outputs are
+    // independent store lookups. The store answers them inline, so each one
+    // is handed to the workers, several at a time; each writes only its own
+    // slot. Only the spent output is read, not its whole transaction.
+    struct lookups {
+        std::vector<libbitcoin::chain::output> prevouts;
+        std::vector<char> found;
+        std::vector<char> unspent;
+    };
+    auto const inputs = tx_ptr->is_coinbase() ? 0 : tx_ptr->inputs().size();
+    auto reads = std::make_shared<lookups>();
+    auto const tx_hash = tx_ptr->hash();
+    reads->prevouts.resize(inputs);
+    reads->found.resize(inputs, 0);
+    reads->unspent.resize(tx_ptr->outputs().size(), 0);
+
+    async_parallel::run(inputs + reads->unspent.size(), spend_queries_in_flight, [tx_ptr, tx_hash, inputs, reads, outputs, dispatch, &chain](size_t n, async_parallel::next_handler next) {
+        run_work(dispatch, [tx_ptr, tx_hash, inputs, reads, outputs, n, next, &chain]() {
+            if (n < inputs) {
+                auto const& point = tx_ptr->inputs()[n].previous_output();
+                reads->found[n] = get_prevout(reads->prevouts[n], point, chain, outputs);
+                next();
+                return;
+            }
+
+            auto const output = n - inputs;
+            chain.fetch_spend(libbitcoin::chain::output_point(tx_hash, static_cast<uint32_t>(output)), [reads, output, next](const libbitcoin::code &ec, libbitcoin::chain::input_point /*input*/) {
+                reads->unspent[output] = ec == libbitcoin::error::not_found;
+                next();
+            });
+        });
+    }, [state, reads, index, height, use_testnet_rules, handler, &chain]() {
+        auto& json_object = state->result;
+        for (size_t n = 0; n < reads->prevouts.size(); ++n) {
+            if (reads->found[n]) {
+                auto const& prevout = reads->prevouts[n];
+                json_object["vin"][n]["address"] = prevout.address(use_testnet_rules).encoded();
+                json_object["vin"][n]["value"] = prevout.value() / (double)100000000;
+                json_object["vin"][n]["valueSat"] = prevout.value();
+            }
+        }
+
+        for (size_t n = 0; n < reads->unspent.size(); ++n) {
+            if (reads->unspent[n]) {
+                // Output not spent
+                json_object["vout"][n]["spentTxId"] = nullptr;
+                json_object["vout"][n]["spentIndex"] = nullptr;
+                json_object["vout"][n]["spentHeight"] = nullptr;
+            }
+        }
+
+        if (index == libbitcoin::database::transaction_database::unconfirmed) {
+            //unconfirmed txn
+            json_object["height"] = -1;
+            json_object["confirmations"] = 0;
+            state->complete(handler);
+            return;
+        }
+
+        //confirmed txn, the block data comes from the store
+        libbitcoin::hash_digest block_hash;
+        uint32_t time;
+        if (getblockhash_time(height, block_hash, time, chain) == libbitcoin::error::success) {
+            json_object["blockhash"] = rpc::encode_hash(block_hash);
+            json_object["height"] = height;
+            json_object["time"] = time;
+            json_object["blocktime"] = time;
+        }
+        size_t last_height;
+        if (chain.get_last_height(last_height)) {
+            json_object["confirmations"] = 1 + last_height - height;
+        }
+        state->complete(handler);
+    });
+}
+
+template <typename Blockchain>
+void getrawtransaction(std::string const& txid, const bool verbose, Blockchain const& chain, bool use_testnet_rules, rpc::output_cache* outputs,
+    work_dispatcher const& dispatch, message_result_handler handler) {
     libbitcoin::hash_digest hash;
 
 #ifdef BITPRIM_CURRENCY_BCH
@@ -100,162 +232,35 @@ bool getrawtransaction(nlohmann::json& json_object, int& error, std::string& err
     bool witness = true;
 #endif
 
-    if (libbitcoin::decode_hash(hash, txid)) {
+    if (!rpc::decode_hash(hash, txid)) {
+        handler(nlohmann::json(), bitprim::RPC_INVALID_PARAMETER, "Invalid transaction hash");
+        return;
+    }
+
+    chain.fetch_transaction(hash, false, witness,
+        [txid, verbose, use_testnet_rules, outputs, dispatch, handler, &chain](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
+            size_t height) {
+        if (ec != libbitcoin::error::success) {
+            handler(nlohmann::json(), bitprim::RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+            return;
+        }
 
         if (verbose) {
-            boost::latch latch(2);
-            chain.fetch_transaction(hash, false, witness,
-                [&](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                    size_t height) {
-                if (ec == libbitcoin::error::success) {
-                    json_object["hex"] = libbitcoin::encode_base16(tx_ptr->to_data(/*version is not used*/ 0));
-                    json_object["txid"] = txid;
-                    json_object["hash"] = txid;
-                    json_object["size"] = tx_ptr->serialized_size(/*version is not used*/ 0);
-                    json_object["version"] = tx_ptr->version();
-                    json_object["locktime"] = tx_ptr->locktime();
-
-                    int vin = 0;
-                    for (const auto & in : tx_ptr->inputs()) {
-                        if (tx_ptr->is_coinbase()) {
-                            json_object["vin"][vin]["coinbase"] = libbitcoin::encode_base16(in.script().to_data(0));
-                        }
-                        else {
-                            json_object["vin"][vin]["txid"] = libbitcoin::encode_hash(in.previous_output().hash());
-                            json_object["vin"][vin]["vout"] = in.previous_output().index();
-                            json_object["vin"][vin]["scriptSig"]["asm"] = in.script().to_string(0);
-                            json_object["vin"][vin]["scriptSig"]["hex"] = libbitcoin::encode_base16(in.script().to_data(0));
-
-                            boost::latch latch_address(2);
-                            chain.fetch_transaction(in.previous_output().hash(), false, witness,
-                                [&](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                                    size_t height) {
-                                if (ec == libbitcoin::error::success) {
-                                    auto const & output = tx_ptr->outputs()[in.previous_output().index()];
-                                    json_object["vin"][vin]["address"] = output.address(use_testnet_rules).encoded();
-                                    json_object["vin"][vin]["value"] = output.value() / (double)100000000;
-                                    json_object["vin"][vin]["valueSat"] = output.value();
-                                }
-                                latch_address.count_down();
-                            });
-                            latch_address.count_down_and_wait();
-                        }
-                        json_object["vin"][vin]["sequence"] = in.sequence();
-                        ++vin;
-                    }
-
-                    int i = 0;
-                    for (const auto & out : tx_ptr->outputs()) {
-                        json_object["vout"][i]["value"] = out.value() / (double)100000000;
-                        json_object["vout"][i]["valueSat"] = out.value();
-                        json_object["vout"][i]["n"] = i;
-                        json_object["vout"][i]["scriptPubKey"]["asm"] = out.script().to_string(0);
-                        json_object["vout"][i]["scriptPubKey"]["hex"] = libbitcoin::encode_base16(out.script().to_data(0));
-
-                        uint8_t reqsig = 1;
-                        std::string type = get_txn_type(out.script());
-                        if (type == "pay_multisig" || type == "sign_multisig") {
-                            // TODO: check if it's working for multisig (see ExtractDestinations in bitcoind)
-                            reqsig = static_cast<uint8_t>(out.script().operations()[0].code());
-                        }
-
-                        auto out_addr = out.address(use_testnet_rules);
-                        json_object["vout"][i]["scriptPubKey"]["reqSigs"] = (int)reqsig;
-                        json_object["vout"][i]["scriptPubKey"]["type"] = type;
-                        if (out_addr){
-                            json_object["vout"][i]["scriptPubKey"]["addresses"][0] = out_addr.encoded();
-                        }
-
-                        // SPENT INFO
-                        nlohmann::json spent;
-                        boost::latch latch2(2);
-                        chain.fetch_spend(libbitcoin::chain::output_point(tx_ptr->hash(), i), [&](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
-                            if (ec == libbitcoin::error::not_found) {
-                                // Output not spent
-                                json_object["vout"][i]["spentTxId"] = spent["txid"];
-                                json_object["vout"][i]["spentIndex"] = spent["index"];
-                                json_object["vout"][i]["spentHeight"] = spent["height"];
-
-                            }
-                            latch2.count_down();
-                        });
-                        latch2.count_down_and_wait();
-                        ++i;
-                    }
-
-                    if (index != libbitcoin::database::transaction_database::unconfirmed) {
-                        //confirmed txn
-                        boost::latch latch(2);
-                        chain.fetch_block_hash_timestamp(height, [&](const libbitcoin::code &ec, const libbitcoin::hash_digest& h, uint32_t time, size_t block_height) {
-                            if (ec == libbitcoin::error::success) {
-                                json_object["blockhash"] = libbitcoin::encode_hash(h);
-                                json_object["height"] = height;
-                                json_object["time"] = time;
-                                json_object["blocktime"] = time;
-                            }
-                            latch.count_down();
-                        });
-                        latch.count_down_and_wait();
-                        boost::latch latch3(2);
-                        chain.fetch_last_height(
-                            [&](std::error_code const &ec, size_t last_height) {
-                            json_object["confirmations"] = 1 + last_height - height;
-                            latch3.count_down();
-                        });
-                        latch3.count_down_and_wait();
-                    }
-
-                    else {
-                        //unconfirmed txn
-                        json_object["height"] = -1;
-                        json_object["confirmations"] = 0;
-                    }
-                }
-                else {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available about transaction";
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+            getrawtransaction_verbose(std::make_shared<message_state>(), tx_ptr, index, height, txid, chain, use_testnet_rules, outputs, dispatch, handler);
         }
         else {
             // No verbose
-            boost::latch latch(2);
-            chain.fetch_transaction(hash, false, witness, 
-                [&](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                    size_t height) {
-                if (ec == libbitcoin::error::success) {
-                    json_object = libbitcoin::encode_base16(tx_ptr->to_data(/*version is not used*/ 0));
-                }
-                else {
-                    error = bitprim::RPC_INVALID_ADDRESS_OR_KEY;
-                    error_code = "No information available about transaction";
-                }
-                latch.count_down();
-            });
-            latch.count_down_and_wait();
+            handler(rpc::encode_base16(tx_ptr->to_data(/*version is not used*/ 0)), 0, "");
         }
-    }
-    else {
-        error = bitprim::RPC_INVALID_PARAMETER;
-        error_code = "Invalid transaction hash";
-    }
-
-    if (error != 0)
-        return false;
-    return true;
-
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_getrawtransaction(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules) {
-    nlohmann::json container, result;
+void process_getrawtransaction(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, rpc::output_cache* outputs,
+    work_dispatcher const& dispatch, json_handler handler) {
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string tx_id;
     bool verbose;
     if (!json_in_getrawtransaction(json_in, tx_id, verbose)) //if false return error
@@ -334,18 +339,20 @@ nlohmann::json process_getrawtransaction(nlohmann::json const& json_in, Blockcha
             "  \"blocktime\" : ttt         (numeric) The block time in seconds "
             "since epoch (Jan 1 1970 GMT)\n"
             "}\n";
-        return container;
+        handler(std::move(container));
+        return;
     }
 
-    if (getrawtransaction(result, error, error_code, tx_id, verbose, chain, use_testnet_rules)) {
-        container["result"] = result;
-        container["error"];
-    } else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
-    }
-
-    return container;
+    getrawtransaction(tx_id, verbose, chain, use_testnet_rules, outputs, dispatch, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        } else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
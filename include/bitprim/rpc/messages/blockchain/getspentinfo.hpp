@@ -24,8 +24,10 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
-#include <boost/thread/latch.hpp>
+#include <bitprim/rpc/messages/utils.hpp>
 
 namespace bitprim {
 
@@ -48,64 +50,41 @@ bool json_in_getspentinfo(nlohmann::json const& json_object, std::string& tx_id,
 }
 
 template <typename Blockchain>
-bool getspentinfo(nlohmann::json& json_object, int& error, std::string& error_code, std::string const& txid, size_t const& index, Blockchain const& chain)
+void getspentinfo(std::string const& txid, size_t const& index, Blockchain const& chain, message_result_handler handler)
 {
-#ifdef BITPRIM_CURRENCY_BCH
-    bool witness = false;
-#else
-    bool witness = true;
-#endif
-
     libbitcoin::hash_digest hash;
-    if (libbitcoin::decode_hash(hash, txid)) {
-        libbitcoin::chain::output_point point(hash, index);
-        boost::latch latch(2);
-
-        chain.fetch_spend(point, [&](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
-            if (ec == libbitcoin::error::success) {
-                json_object["txid"] = libbitcoin::encode_hash(input.hash());
-                json_object["index"] = input.index();
-                {
-                    boost::latch latch2(2);
-                    chain.fetch_transaction(input.hash(), false, witness,
-                        [&](const libbitcoin::code &ec, libbitcoin::transaction_const_ptr tx_ptr, size_t index,
-                            size_t height) {
-                        if (ec == libbitcoin::error::success) {
-                            json_object["height"] = height;
-                        }
-                        latch2.count_down();
-                    });
-                    latch2.count_down_and_wait();
-                }
-
-            }
-            else {
-                error = bitprim::RPC_INVALID_PARAMETER;
-                error_code = "Unable to get spent info";
-            }
-            latch.count_down();
-        });
-        latch.count_down_and_wait();
-    }
-    else {
-        error = bitprim::RPC_INVALID_PARAMETER;
-        error_code = "Invalid transaction hash";
+    if (!rpc::decode_hash(hash, txid)) {
+        handler(nlohmann::json(), bitprim::RPC_INVALID_PARAMETER, "Invalid transaction hash");
+        return;
     }
 
-    if (error != 0)
-        return false;
-    return true;
+    libbitcoin::chain::output_point point(hash, index);
+    chain.fetch_spend(point, [&chain, handler](const libbitcoin::code &ec, libbitcoin::chain::input_point input) {
+        if (ec != libbitcoin::error::success) {
+            handler(nlohmann::json(), bitprim::RPC_INVALID_PARAMETER, "Unable to get spent info");
+            return;
+        }
+
+        nlohmann::json json_object;
+        json_object["txid"] = rpc::encode_hash(input.hash());
+        json_object["index"] = input.index();
+
+        // The height comes from the position of the spender in the store,
+        // the transaction itself is not needed.
+        size_t height;
+        if (get_transaction_height(height, input.hash(), chain)) {
+            json_object["height"] = height;
+        }
+        handler(std::move(json_object), 0, "");
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_getspentinfo(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules)
+void process_getspentinfo(nlohmann::json const& json_in, Blockchain const& chain, bool use_testnet_rules, json_handler handler)
 {
-    nlohmann::json container, result;
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string tx_id;
     size_t index;
     if (!json_in_getspentinfo(json_in, tx_id, index)) //if false return error
@@ -124,20 +103,21 @@ nlohmann::json process_getspentinfo(nlohmann::json const& json_in, Blockchain co
             "  \"index\"  (number) The spending input index\n"
             "  ,...\n"
             "}\n";
-        return container;
+        handler(std::move(container));
+        return;
     }
 
-    if (getspentinfo(result, error, error_code, tx_id, index, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
-    }
-
-    return container;
+    getspentinfo(tx_id, index, chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 
 }
 
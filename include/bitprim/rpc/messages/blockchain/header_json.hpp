@@ -0,0 +1,130 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_MESSAGES_BLOCKCHAIN_HEADER_JSON_HPP_
+#define BITPRIM_RPC_MESSAGES_BLOCKCHAIN_HEADER_JSON_HPP_
+
+#include <bitcoin/blockchain/interface/block_chain.hpp>
+
+#include <bitprim/rpc/index/header_index.hpp>
+#include <bitprim/rpc/json/json_writer.hpp>
+#include <bitprim/rpc/messages/utils.hpp>
+
+namespace bitprim {
+
+// Fields of the verbose getblock and getblockheader responses that come
+// from around the header. From the header index when it has the block;
+// otherwise read from the chain, with the median time and chainwork only
+// approximated by the block's own timestamp and proof.
+template <typename Blockchain>
+rpc::header_index::record header_record(libbitcoin::hash_digest const& hash, size_t height, libbitcoin::chain::header const& header,
+    Blockchain const& chain, rpc::header_index const* headers) {
+    rpc::header_index::record record;
+    if (headers != nullptr && headers->find(height, hash, record)) {
+        return record;
+    }
+
+    record.hash = hash;
+    record.has_next = chain.get_block_hash(record.next_hash, height + 1);
+    record.median_time = header.timestamp();
+    record.chainwork = rpc::header_index::work{};
+    auto const proof = header.proof();
+    for (size_t i = 0; i < record.chainwork.size(); ++i) {
+        record.chainwork[record.chainwork.size() - 1 - i] = static_cast<uint8_t>(proof >> (8 * i));
+    }
+    if (!chain.get_last_height(record.top_height)) {
+        record.top_height = height;
+    }
+    return record;
+}
+
+// Height and hash of the top block, from the header index when it is
+// loaded, otherwise from the header store; never from a block read.
+template <typename Blockchain>
+bool get_tip(size_t& out_height, libbitcoin::hash_digest& out_hash, Blockchain const& chain, rpc::header_index const* headers) {
+    if (headers != nullptr && headers->top(out_height, out_hash)) {
+        return true;
+    }
+    return chain.get_last_height(out_height) && chain.get_block_hash(out_hash, out_height);
+}
+
+// Eight hex digits, as the version and bits are displayed.
+inline
+void write_hex32(json_writer& writer, uint32_t value) {
+    uint8_t const bytes[] = {
+        static_cast<uint8_t>(value >> 24),
+        static_cast<uint8_t>(value >> 16),
+        static_cast<uint8_t>(value >> 8),
+        static_cast<uint8_t>(value)
+    };
+    writer.hex(bytes, sizeof(bytes));
+}
+
+// The verbose header is written in two parts, getblock puts its block
+// fields in between: hash to merkleroot first, then time to nextblockhash.
+// block_size, when given, is written as the "size" of the block.
+inline
+void write_header_head(json_writer& writer, libbitcoin::chain::header const& header, size_t height,
+    rpc::header_index::record const& record, uint64_t const* block_size = nullptr) {
+    writer.key("hash");
+    writer.hex_reversed(record.hash);
+    writer.key("confirmations");
+    writer.number(record.top_height - height + 1);
+    if (block_size != nullptr) {
+        writer.key("size");
+        writer.number(*block_size);
+    }
+    writer.key("height");
+    writer.number(height);
+    writer.key("version");
+    writer.number(header.version());
+    writer.key("versionHex");
+    write_hex32(writer, header.version());
+    writer.key("merkleroot");
+    writer.hex_reversed(header.merkle());
+}
+
+inline
+void write_header_tail(json_writer& writer, libbitcoin::chain::header const& header, rpc::header_index::record const& record) {
+    writer.key("time");
+    writer.number(header.timestamp());
+    writer.key("mediantime");
+    writer.number(record.median_time);
+    writer.key("nonce");
+    writer.number(header.nonce());
+    writer.key("bits");
+    write_hex32(writer, header.bits());
+    writer.key("difficulty");
+    writer.number(bits_to_difficulty(header.bits()));
+    writer.key("chainwork");
+    writer.hex(record.chainwork);
+    writer.key("previousblockhash");
+    writer.hex_reversed(header.previous_block_hash());
+    writer.key("nextblockhash");
+    if (record.has_next) {
+        writer.hex_reversed(record.next_hash);
+    } else {
+        writer.null();
+    }
+}
+
+} //namespace bitprim
+
+#endif //BITPRIM_RPC_MESSAGES_BLOCKCHAIN_HEADER_JSON_HPP_
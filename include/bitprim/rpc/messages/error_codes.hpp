@@ -55,5 +55,9 @@ namespace bitprim {
     int const RPC_INTERNAL_ERROR = -32603;
     int const RPC_PARSE_ERROR = -32700;
 
+    //! Implementation defined server errors
+    //!< Too many requests of the same cost waiting, retry later
+    int const RPC_SERVER_BUSY = -32000;
+
 }
 #endif
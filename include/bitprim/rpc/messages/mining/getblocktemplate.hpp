@@ -25,8 +25,10 @@
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
 #include <bitcoin/bitcoin/multi_crypto_support.hpp>
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
+
+#include <chrono>
 
 namespace bitprim {
 
@@ -85,7 +87,7 @@ bool getblocktemplate(nlohmann::json& json_object, int& error, std::string& erro
     auto const bits = chain.chain_state()->get_next_work_required(time_now);
     auto const height = last_height + 1;
 
-    json_object["previousblockhash"] = libbitcoin::encode_hash(header->hash());
+    json_object["previousblockhash"] = rpc::encode_hash(header->hash());
 
     json_object["sigoplimit"] = libbitcoin::get_max_block_sigops(); //OLD max_block_sigops; //TODO: this value is hardcoded using bitcoind pcap
 
@@ -119,9 +121,9 @@ bool getblocktemplate(nlohmann::json& json_object, int& error, std::string& erro
         auto const& tx = std::get<0>(tx_mem);
         const auto tx_data = tx.to_data(true, witness, false);
     
-        transactions_json[i]["data"] = libbitcoin::encode_base16(tx_data);
-        transactions_json[i]["txid"] = libbitcoin::encode_hash(tx.hash());
-        transactions_json[i]["hash"] = libbitcoin::encode_hash(tx.hash());
+        transactions_json[i]["data"] = rpc::encode_base16(tx_data);
+        transactions_json[i]["txid"] = rpc::encode_hash(tx.hash());
+        transactions_json[i]["hash"] = rpc::encode_hash(tx.hash());
         transactions_json[i]["depends"] = nlohmann::json::array(); //TODO CARGAR DEPS
         transactions_json[i]["fee"] = std::get<1>(tx_mem);
         transactions_json[i]["sigops"] = std::get<2>(tx_mem);
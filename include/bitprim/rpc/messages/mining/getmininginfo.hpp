@@ -26,7 +26,6 @@
 
 #include <bitprim/rpc/messages/utils.hpp>
 #include <bitcoin/bitcoin/multi_crypto_support.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -24,9 +24,10 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -51,56 +52,51 @@ void handle_organize(const libbitcoin::code& ec) {
 }
 
 template <typename Blockchain>
-bool submitblock(nlohmann::json& json_object, int& error, std::string& error_code, std::string const& incoming_hex, bool use_testnet_rules, Blockchain& chain) {
+void submitblock(std::string const& incoming_hex, bool use_testnet_rules, Blockchain& chain, message_result_handler handler) {
     const auto block = std::make_shared<bc::message::block>();
     libbitcoin::data_chunk out;
-    libbitcoin::decode_base16(out, incoming_hex);
-    if (block->from_data(1, out)) {
-        chain.organize(block, [&](const libbitcoin::code & ec) {
-            if (ec) {
-                error = bitprim::RPC_VERIFY_ERROR;
-                error_code = "Failed to submit block.";
-            }
-        });
-    }
-    else {
-        error = bitprim::RPC_DESERIALIZATION_ERROR;
-        error_code = "Block decode failed";
+    rpc::decode_base16(out, incoming_hex);
+    if (!block->from_data(1, out)) {
+        handler(nlohmann::json(), bitprim::RPC_DESERIALIZATION_ERROR, "Block decode failed");
+        return;
     }
 
-    if (error != 0)
-        return false;
-    return true;
+    chain.organize(block, [handler](const libbitcoin::code & ec) {
+        if (ec) {
+            handler(nlohmann::json(), bitprim::RPC_VERIFY_ERROR, "Failed to submit block.");
+        }
+        else {
+            handler(nlohmann::json(), 0, "");
+        }
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_submitblock(nlohmann::json const& json_in, Blockchain& chain, bool use_testnet_rules) {
-    nlohmann::json container, result;
+void process_submitblock(nlohmann::json const& json_in, Blockchain& chain, bool use_testnet_rules, json_handler handler) {
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string block_str;
     if (!json_in_submitblock(json_in, block_str)) //if false return error
     {
         container["result"];
         container["error"]["code"] = bitprim::RPC_MISC_ERROR;
         container["error"]["message"] = "submitblock \"hexdata\" ( \"jsonparametersobject\" )\n\nAttempts to submit new block to network.\nThe 'jsonparametersobject' parameter is currently ignored.\nSee https://en.bitcoin.it/wiki/BIP_0022 for full specification.\n\nArguments\n1. \"hexdata\"    (string, required) the hex-encoded block data to submit\n2. \"jsonparametersobject\"     (string, optional) object of optional parameters\n    {\n      \"workid\" : \"id\"    (string, optional) if the server provided a workid, it MUST be included with submissions\n    }\n\nResult:\n\nExamples:\n> bitcoin-cli submitblock \"mydata\"\n> curl --user myusername --data-binary '{\"jsonrpc\": \"1.0\", \"id\":\"curltest\", \"method\": \"submitblock\", \"params\": [\"mydata\"] }' -H 'content-type: text/plain;' http://127.0.0.1:8332/\n";
-        return container;
-    }
-
-    if (submitblock(result, error, error_code, block_str, use_testnet_rules, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
+        handler(std::move(container));
+        return;
     }
 
-    return container;
+    submitblock(block_str, use_testnet_rules, chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
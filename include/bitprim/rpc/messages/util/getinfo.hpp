@@ -26,7 +26,6 @@
 #include <bitcoin/node/full_node.hpp>
 
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
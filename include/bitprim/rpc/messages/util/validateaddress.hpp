@@ -24,9 +24,9 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 
 namespace bitprim {
@@ -52,12 +52,12 @@ bool validateaddress(nlohmann::json& json_object, int& error, std::string& error
         //PAY TO PUBLIC KEY HASH
         json_object["isvalid"] = true;
         json_object["address"] = raw_address;
-        json_object["scriptPubKey"] = "76a914" + libbitcoin::encode_base16(payment_address.hash()) + "88ac";
+        json_object["scriptPubKey"] = "76a914" + rpc::encode_base16(payment_address.hash()) + "88ac";
     } else if (ver == 196 /*testnet*/ || ver == 5 /*mainnet btc*/ || ver == 5 /*mainnet ltc*/) {
         //PAY TO SCRIPT HASH
         json_object["isvalid"] = true;
         json_object["address"] = raw_address;
-        json_object["scriptPubKey"] = "a914" + libbitcoin::encode_base16(payment_address.hash()) + "87";
+        json_object["scriptPubKey"] = "a914" + rpc::encode_base16(payment_address.hash()) + "87";
     } else {
         //TODO: VALIDATE WIF
         json_object["isvalid"] = false;
@@ -22,7 +22,7 @@
 #define BITPRIM_RPC_MESSAGES_UTILS_HPP_
 
 #include <bitcoin/blockchain/interface/block_chain.hpp>
-#include <boost/thread/latch.hpp>
+#include <bitprim/rpc/cache/output_cache.hpp>
 
 namespace bitprim {
 
@@ -30,39 +30,61 @@ namespace bitprim {
 
     //libbitcoin::chain::history::list expand(libbitcoin::chain::history_compact::list& compact);
 
+    // Upper bound of spend and prevout lookups a single message keeps in flight.
+    constexpr size_t spend_queries_in_flight = 64;
 
 
+
+    // Header reads go straight to the store through the fast chain interface,
+    // so they never wait on the blockchain threadpool.
+
     template <typename Blockchain>
     libbitcoin::code getblockhash_time(size_t i, libbitcoin::hash_digest& out_hash, uint32_t& out_time,Blockchain const& chain) {
-        libbitcoin::code result;
-        boost::latch latch(2);
-        chain.fetch_block_hash_timestamp(i, [&](const libbitcoin::code &ec, const libbitcoin::hash_digest& h, uint32_t time, size_t height) {
-            result = ec;
-            if (ec == libbitcoin::error::success) {
-                out_hash = h;
-                out_time= time;
-            }
-            latch.count_down();
-        });
-        latch.count_down_and_wait();
-        return result;
+        libbitcoin::chain::header header;
+        if (!chain.get_header(header, i)) {
+            return libbitcoin::error::not_found;
+        }
+        out_hash = header.hash();
+        out_time = header.timestamp();
+        return libbitcoin::error::success;
     }
 
     template <typename Blockchain>
     libbitcoin::code getblockheader(size_t i, libbitcoin::message::header::ptr& header, Blockchain const& chain) {
-        libbitcoin::code result;
-        boost::latch latch(2);
+        auto result = std::make_shared<libbitcoin::message::header>();
+        if (!chain.get_header(*result, i)) {
+            return libbitcoin::error::not_found;
+        }
+        header = result;
+        return libbitcoin::error::success;
+    }
 
-        chain.fetch_block_header(i, [&](const libbitcoin::code &ec, libbitcoin::message::header::ptr h, size_t height) {
-            result = ec;
-            if (ec == libbitcoin::error::success) {
-                header = h;
-            }
-            latch.count_down();
-        });
-        latch.count_down_and_wait();
+    // Output of a point, read alone from the store rather than deserializing
+    // its whole transaction. Recently read outputs come from the cache.
+    template <typename Blockchain>
+    bool get_prevout(libbitcoin::chain::output& out_output, libbitcoin::chain::output_point const& point, Blockchain const& chain, rpc::output_cache* cache) {
+        if (cache != nullptr && cache->find(point, out_output)) {
+            return true;
+        }
+
+        size_t height;
+        uint32_t median_time_past;
+        bool coinbase;
+        if (!chain.get_output(out_output, height, median_time_past, coinbase, point, libbitcoin::max_size_t, false)) {
+            return false;
+        }
 
-        return result;
+        if (cache != nullptr) {
+            cache->insert(point, out_output);
+        }
+        return true;
+    }
+
+    // Height of a transaction, from its position in the store.
+    template <typename Blockchain>
+    bool get_transaction_height(size_t& out_height, libbitcoin::hash_digest const& hash, Blockchain const& chain) {
+        size_t position;
+        return chain.get_transaction_position(out_height, position, hash, false);
     }
 
     template <typename Blockchain>
@@ -24,9 +24,10 @@
 #include <bitprim/rpc/json/json.hpp>
 #include <bitcoin/blockchain/interface/block_chain.hpp>
 
+#include <bitprim/rpc/encoding/hex.hpp>
+#include <bitprim/rpc/messages/async.hpp>
 #include <bitprim/rpc/messages/error_codes.hpp>
 #include <bitprim/rpc/messages/utils.hpp>
-#include <boost/thread/latch.hpp>
 
 namespace bitprim {
 
@@ -49,47 +50,33 @@ bool json_in_sendrawtransaction(nlohmann::json const& json_object, std::string&
 }
 
 template <typename Blockchain>
-bool sendrawtransaction(nlohmann::json& json_object, int& error, std::string& error_code, std::string const & incoming_hex, bool allowhighfees, bool use_testnet_rules, Blockchain& chain)
+void sendrawtransaction(std::string const & incoming_hex, bool allowhighfees, bool use_testnet_rules, Blockchain& chain, message_result_handler handler)
 {
     //TODO: use allowhighfees
     const auto tx = std::make_shared<bc::message::transaction>();
     libbitcoin::data_chunk out;
-    libbitcoin::decode_base16(out, incoming_hex);
-    if (tx->from_data(1, out)) {
-        boost::latch latch(2);
-        chain.organize(tx, [&](const libbitcoin::code & ec) {
-            if (ec) {
-                error = bitprim::RPC_VERIFY_ERROR;
-                error_code = "Failed to submit transaction.";
-                json_object;
-            }
-            else {
-                json_object = libbitcoin::encode_hash(tx->hash());
-            }
-            latch.count_down();
-        });
-        latch.count_down_and_wait();
+    rpc::decode_base16(out, incoming_hex);
+    if (!tx->from_data(1, out)) {
+        handler(nlohmann::json(), bitprim::RPC_DESERIALIZATION_ERROR, "TX decode failed.");
+        return;
     }
-    else {
-        error = bitprim::RPC_DESERIALIZATION_ERROR;
-        error_code = "TX decode failed.";
-    }
-
-    if (error != 0)
-        return false;
 
-    return true;
+    chain.organize(tx, [tx, handler](const libbitcoin::code & ec) {
+        if (ec) {
+            handler(nlohmann::json(), bitprim::RPC_VERIFY_ERROR, "Failed to submit transaction.");
+        }
+        else {
+            handler(rpc::encode_hash(tx->hash()), 0, "");
+        }
+    });
 }
 
 template <typename Blockchain>
-nlohmann::json process_sendrawtransaction(nlohmann::json const& json_in, Blockchain& chain, bool use_testnet_rules)
+void process_sendrawtransaction(nlohmann::json const& json_in, Blockchain& chain, bool use_testnet_rules, json_handler handler)
 {
-    nlohmann::json container, result;
+    nlohmann::json container;
     container["id"] = json_in["id"];
 
-    int error = 0;
-    std::string error_code;
-
     std::string tx_str;
     bool allowhighfees = false;
     if (!json_in_sendrawtransaction(json_in, tx_str, allowhighfees)) //if false return error
@@ -107,20 +94,21 @@ nlohmann::json process_sendrawtransaction(nlohmann::json const& json_in, Blockch
             "fees\n"
             "\nResult:\n"
             "\"hex\"             (string) The transaction hash in hex\n";
-        return container;
+        handler(std::move(container));
+        return;
     }
 
-    if (sendrawtransaction(result, error, error_code, tx_str, allowhighfees, use_testnet_rules, chain))
-    {
-        container["result"] = result;
-        container["error"];
-    }
-    else {
-        container["error"]["code"] = error;
-        container["error"]["message"] = error_code;
-    }
-
-    return container;
+    sendrawtransaction(tx_str, allowhighfees, use_testnet_rules, chain, [container, handler](nlohmann::json result, int error, std::string error_code) mutable {
+        if (error == 0) {
+            container["result"] = std::move(result);
+            container["error"];
+        }
+        else {
+            container["error"]["code"] = error;
+            container["error"]["message"] = error_code;
+        }
+        handler(std::move(container));
+    });
 }
 
 } //namespace bitprim
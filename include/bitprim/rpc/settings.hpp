@@ -0,0 +1,138 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_SETTINGS_HPP_
+#define BITPRIM_RPC_SETTINGS_HPP_
+
+#include <cstdint>
+#include <string>
+
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Common rpc configuration settings, properties not thread safe.
+class BCR_API settings {
+public:
+    settings();
+
+    /// Threads running the socket I/O of the http server.
+    uint32_t io_threads;
+
+    /// Seconds a persistent http connection waits for its next request.
+    uint32_t http_idle_timeout;
+
+    /// Requests served on one http connection, zero means no limit.
+    uint32_t http_max_requests;
+
+    /// Requests of one http connection read ahead of their responses.
+    uint32_t http_max_pipelined;
+
+    /// Compression of the http responses to clients accepting gzip or
+    /// deflate, from 1 (fastest) to 9 (smallest), zero disables it.
+    uint32_t compression_level;
+
+    /// Smallest http response compressed, in bytes.
+    uint32_t compression_threshold;
+
+    /// Memory for compressed cacheable responses in MiB, zero disables it.
+    uint32_t compression_cache_size;
+
+    /// Threads parsing requests and building responses,
+    /// zero uses one thread per hardware thread.
+    uint32_t worker_threads;
+
+    /// Pin each worker thread to its own core.
+    bool pin_threads;
+
+    /// Elements of one batch request run at the same time.
+    uint32_t batch_parallelism;
+
+    /// Largest batch request accepted, zero means no limit.
+    uint32_t max_batch_size;
+
+    /// Address and spend queries running at the same time, shared by the
+    /// http and zmq servers; zero means no limit. Mining requests are never
+    /// held and go ahead of the waiting ones.
+    uint32_t expensive_concurrency;
+
+    /// Address and spend queries waiting to run, beyond it the requests
+    /// are answered busy right away.
+    uint32_t expensive_queue_size;
+
+    /// Same as above for the rest of the requests.
+    uint32_t standard_concurrency;
+    uint32_t standard_queue_size;
+
+    /// Keep an in-memory address index for the address queries,
+    /// built from the whole chain at startup.
+    bool address_index;
+
+    /// Keep the timestamp and hash of every block in memory for
+    /// getblockhashes, loaded from the headers at startup.
+    bool header_index;
+
+    /// Memory for cached responses in MiB, zero disables the cache.
+    uint32_t response_cache_size;
+
+    /// Outputs read for the inputs and utxos kept in memory, zero disables
+    /// the cache.
+    uint32_t output_cache_size;
+
+    /// Identical requests arriving while one of them is computed share
+    /// its response.
+    bool coalesce_requests;
+
+    /// Endpoint of the zmq JSON-RPC socket (e.g. tcp://*:8335), empty
+    /// disables it. Takes the same allowed ips as the http server.
+    std::string zmq_rpc_endpoint;
+
+    /// Endpoints of the zmq topics, as bitcoind -zmqpub<topic>. Empty
+    /// publishes on the subscriber port, "none" disables the topic.
+    std::string zmq_hashblock_endpoint;
+    std::string zmq_hashtx_endpoint;
+    std::string zmq_rawblock_endpoint;
+    std::string zmq_rawtx_endpoint;
+    std::string zmq_blockdisconnect_endpoint;
+
+    /// Publications waiting for the zmq publisher thread, up to 65534.
+    uint32_t zmq_queue_size;
+
+    /// When the zmq queue is full hold the blockchain notifications
+    /// instead of dropping the publication.
+    bool zmq_block_when_full;
+
+    /// Messages kept per zmq topic until it has a subscriber; the oldest
+    /// are dropped beyond it.
+    uint32_t zmq_pending_size;
+
+    /// Bytes of those messages kept per zmq topic, and the seconds each is
+    /// kept for. Zero keeps nothing.
+    uint32_t zmq_pending_bytes;
+    uint32_t zmq_pending_age;
+
+    /// Keep rawblock and rawtx messages too; otherwise only the current
+    /// subscribers of those topics get them.
+    bool zmq_pending_raw;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_SETTINGS_HPP_
@@ -0,0 +1,69 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_WORKER_POOL_HPP_
+#define BITPRIM_RPC_WORKER_POOL_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Threads running CPU bound work (request parsing, response building)
+/// away from the threads doing socket I/O.
+class BCR_API worker_pool {
+public:
+    /// Zero threads uses one thread per hardware thread.
+    explicit worker_pool(size_t threads, bool pin_threads = false);
+    ~worker_pool();
+
+    //non-copyable
+    worker_pool(worker_pool const&) = delete;
+    worker_pool& operator=(worker_pool const&) = delete;
+
+    void start();
+    void stop();
+
+    size_t size() const;
+
+    template <typename Handler>
+    void post(Handler&& handler) {
+        service_.post(std::forward<Handler>(handler));
+    }
+
+private:
+    void pin(std::thread& thread, size_t index) const;
+
+    size_t const size_;
+    bool const pin_threads_;
+    boost::asio::io_service service_;
+    std::unique_ptr<boost::asio::io_service::work> work_;
+    std::vector<std::thread> threads_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_WORKER_POOL_HPP_
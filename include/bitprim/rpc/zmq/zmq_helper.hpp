@@ -21,18 +21,59 @@
 #ifndef BITPRIM_ZMQ_HELPER_HPP
 #define BITPRIM_ZMQ_HELPER_HPP
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include <boost/lockfree/queue.hpp>
 
 #include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/settings.hpp>
+#include <bitprim/rpc/zmq/zmq_topic.hpp>
 
 #include <zmq.h>
 
 namespace bitprim { namespace rpc {
 
+/// Publishes the bitcoind notification topics (hashblock, hashtx, rawblock,
+/// rawtx), each with its own sequence number and on its own endpoint or
+/// on the shared subscriber port. On a reorganization blockdisconnect
+/// carries the hash and height of every block removed, from the old tip
+/// down, and the transactions they return to the mempool are published
+/// again before the new blocks.
+///
+/// Sockets are XPUB: messages of a topic nobody subscribes to yet are kept
+/// (within zmq_pending_size, zmq_pending_bytes and zmq_pending_age, and for
+/// rawblock and rawtx only with zmq_pending_raw) and sent once a
+/// subscription arrives, instead of being lost while subscribers connect.
 class zmq {
 public:
-    zmq(uint32_t subscriber_port, libbitcoin::blockchain::block_chain & chain);
+    enum topic_id {
+        hashblock,
+        hashtx,
+        rawblock,
+        rawtx,
+        blockdisconnect,
+        topic_count
+    };
+
+    struct counters {
+        // Messages handed to the socket.
+        uint64_t published;
+        // Publications discarded because the queue was full, and messages
+        // dropped beyond the pending limits of their topic.
+        uint64_t dropped;
+        // Messages the socket refused.
+        uint64_t failed;
+    };
+
+    zmq(uint32_t subscriber_port, libbitcoin::blockchain::block_chain & chain, settings const& config = settings());
     //non-copyable
     zmq(zmq const&) = delete;
     zmq& operator=(zmq const&) = delete;
@@ -41,7 +82,10 @@ public:
     void start();
     void start_sending_messages();
 
+    counters statistics() const;
+
 public:
+    // Queued, sent by the publisher thread.
     bool send_message(const char *command, const void *data, size_t size);
 
     //Publisher methods
@@ -56,12 +100,64 @@ public:
     };
 
 private:
-    // ZMQ
+    // Work for the publisher thread. Blocks and transactions are
+    // serialized there, off the blockchain notification threads.
+    struct publication {
+        topic_id topic;
+        libbitcoin::data_chunk data;
+        libbitcoin::block_const_ptr block;
+        libbitcoin::transaction_const_ptr transaction;
+        // Reorganization: blocks removed above fork_height and the ones replacing them.
+        size_t fork_height;
+        libbitcoin::block_const_ptr_list_const_ptr outgoing;
+        libbitcoin::block_const_ptr_list_const_ptr incoming;
+    };
+
+    using shared_chunk = zmq_topic::shared_chunk;
+
+    // Socket of an endpoint and the topic prefixes its subscribers asked for.
+    struct endpoint {
+        void* socket;
+        std::vector<std::string> subscriptions;
+    };
+
+    void bind(settings const& config, uint32_t subscriber_port);
+    bool enabled(topic_id id) const;
+
+    bool enqueue(publication* item);
+    void publish();
+    void publish(publication& item);
+    void publish_block(libbitcoin::message::block const& block);
+    void publish_transaction(libbitcoin::chain::transaction const& transaction);
+    void publish_disconnect(size_t fork_height, libbitcoin::block_const_ptr_list const& outgoing,
+                            libbitcoin::block_const_ptr_list const* incoming);
+    bool send_hash(topic_id id, libbitcoin::hash_digest const& hash);
+    bool send(topic_id id, shared_chunk const& buffer, size_t offset, size_t size);
+    bool transmit(topic_id id, zmq_topic::message const& message, uint32_t sequence);
+    void receive_subscriptions();
+    void expire_pending();
+
+    // ZMQ, only used from the publisher thread once started.
     void *context_;
-    void *publisher_;
-    uint32_t nSequence;
+    std::vector<endpoint> endpoints_;
+    // Socket of each topic, null when it is not published.
+    std::array<void*, topic_count> sockets_;
+    std::vector<zmq_topic> topics_;
     // BITPRIM
     libbitcoin::blockchain::block_chain & chain_;
+
+    // Publisher thread.
+    bool const block_when_full_;
+    std::atomic<bool> stopped_;
+    boost::lockfree::queue<publication*, boost::lockfree::fixed_sized<true>> queue_;
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::condition_variable dequeued_;
+    std::thread thread_;
+
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> failed_;
 };
 
 }}
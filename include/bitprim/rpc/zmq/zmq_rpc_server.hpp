@@ -0,0 +1,111 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_ZMQ_RPC_SERVER_HPP_
+#define BITPRIM_RPC_ZMQ_RPC_SERVER_HPP_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <bitcoin/blockchain/interface/block_chain.hpp>
+#include <bitcoin/node/full_node.hpp>
+#include <bitprim/rpc/messages.hpp>
+#include <bitprim/rpc/settings.hpp>
+#include <bitprim/rpc/worker_pool.hpp>
+
+#include <zmq.h>
+
+namespace bitprim { namespace rpc {
+
+/// JSON-RPC over a zmq ROUTER socket. Every message carries one request
+/// (or batch) in its last frame and gets the response in a message with
+/// the same routing frames, so DEALER clients can keep many requests in
+/// flight on one connection and match the responses by id; REQ clients
+/// work as well, one request at a time.
+///
+/// Requests run through process_data on the same workers as the http ones,
+/// handed over by the context's dispatch;
+/// the socket itself is only touched by the server thread.
+class zmq_rpc_server {
+public:
+    zmq_rpc_server(bool use_testnet_rules
+            , std::shared_ptr<libbitcoin::node::full_node> & node
+            , std::string const& endpoint
+            , const std::unordered_set<std::string> & rpc_allowed_ips
+            , settings const& config = settings()
+            , message_context const& context = message_context());
+    //non-copyable
+    zmq_rpc_server(zmq_rpc_server const&) = delete;
+    zmq_rpc_server& operator=(zmq_rpc_server const&) = delete;
+    ~zmq_rpc_server();
+
+    bool start();
+    bool stop();
+    bool stopped() const;
+
+private:
+    // Frames ahead of the request: the peer identity and, from REQ
+    // clients, the empty delimiter. Sent back ahead of the response.
+    using routing = std::vector<std::string>;
+
+    struct reply {
+        routing route;
+        std::string content;
+    };
+
+    void run();
+    void receive();
+    void process_request(routing route, std::string content);
+    void post_reply(routing route, std::string content);
+    void send_replies();
+    void close_sockets();
+
+    bool use_testnet_rules_;
+    std::atomic<bool> stopped_;
+    std::string const endpoint_;
+    std::shared_ptr<libbitcoin::node::full_node> & node_;
+    signature_map<libbitcoin::blockchain::block_chain> signature_map_;
+    std::unordered_set<std::string> rpc_allowed_ips_;
+    // Only when the context brings no dispatch.
+    std::unique_ptr<worker_pool> workers_;
+    work_dispatcher dispatch_;
+    batch_policy batch_;
+
+    void* context_;
+    // Server thread only.
+    void* router_;
+    void* wakeup_receiver_;
+    // Replies completed by the workers, and the socket waking the server
+    // thread up to send them; both guarded by mutex_.
+    std::mutex mutex_;
+    void* wakeup_sender_;
+    std::deque<reply> replies_;
+    std::thread thread_;
+};
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_ZMQ_RPC_SERVER_HPP_
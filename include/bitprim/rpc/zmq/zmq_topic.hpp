@@ -0,0 +1,107 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITPRIM_RPC_ZMQ_ZMQ_TOPIC_HPP_
+#define BITPRIM_RPC_ZMQ_ZMQ_TOPIC_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <bitcoin/blockchain.hpp>
+#include <bitprim/rpc/define.hpp>
+
+namespace bitprim { namespace rpc {
+
+/// Messages of a published zmq topic, numbered per topic in the order they
+/// go out. Until the topic has a subscriber they wait in a pending list
+/// bounded in messages, bytes and age, the oldest dropped first.
+class BCR_API zmq_topic {
+public:
+    using shared_chunk = std::shared_ptr<libbitcoin::data_chunk const>;
+    using clock = std::chrono::steady_clock;
+
+    struct message {
+        shared_chunk buffer;
+        size_t offset;
+        size_t size;
+        clock::time_point time;
+    };
+
+    /// What the pending list may hold; a zero limit keeps nothing.
+    struct limits {
+        size_t messages;
+        size_t bytes;
+        std::chrono::seconds age;
+    };
+
+    /// Hands a message and its sequence number to the socket, false when
+    /// it was refused. The number is only used up by sent messages.
+    using transmitter = std::function<bool(message const&, uint32_t)>;
+
+    zmq_topic(char const* command, limits const& pending, transmitter transmit);
+
+    char const* command() const;
+    bool subscribed() const;
+
+    /// Sequence number of the next message sent.
+    uint32_t sequence() const;
+
+    /// Messages waiting for a subscriber and the bytes they hold.
+    size_t pending() const;
+    size_t pending_bytes() const;
+
+    /// Sends the message, or keeps it while nobody is subscribed. Returns
+    /// the messages dropped to respect the limits, this one included.
+    size_t send(shared_chunk const& buffer, size_t offset, size_t size, clock::time_point now = clock::now());
+
+    /// Once subscribed the pending messages still young enough are sent.
+    /// Returns the messages dropped for their age.
+    size_t subscribe(bool subscribed, clock::time_point now = clock::now());
+
+    /// Drops the pending messages older than the age limit, returns how many.
+    size_t expire(clock::time_point now = clock::now());
+
+    void clear();
+
+private:
+    void drop_front();
+
+    char const* command_;
+    limits limits_;
+    transmitter transmit_;
+    uint32_t sequence_;
+    bool subscribed_;
+    std::deque<message> pending_;
+    size_t pending_bytes_;
+};
+
+/// Bodies of the blockdisconnect messages of a reorganization: outgoing
+/// holds the blocks removed above fork_height by height, the bodies go
+/// from the old tip down, each the block hash in display order followed
+/// by its little endian 4 byte height.
+BCR_API std::vector<libbitcoin::data_chunk> block_disconnect_bodies(size_t fork_height, libbitcoin::block_const_ptr_list const& outgoing);
+
+}} // namespace bitprim::rpc
+
+#endif //BITPRIM_RPC_ZMQ_ZMQ_TOPIC_HPP_
@@ -0,0 +1,144 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/admission_control.hpp>
+
+#include <iterator>
+#include <utility>
+
+namespace bitprim { namespace rpc {
+
+using lock_guard = std::lock_guard<std::mutex>;
+
+namespace {
+
+// Requests started on a thread while it is already running admitted work.
+thread_local std::deque<admission_control::work>* deferred = nullptr;
+
+} // namespace
+
+admission_control::admission_control(limits standard, limits expensive)
+    : gates_{{limits{0, 0}, 0, {}}, {standard, 0, {}}, {expensive, 0, {}}}
+{}
+
+admission_control::cost_class admission_control::classify(std::string const& method) {
+    if (method == "getblocktemplate" || method == "getmininginfo" || method == "submitblock") {
+        return cost_class::mining;
+    }
+
+    if (method == "getaddressbalance" || method == "getaddressdeltas" || method == "getaddresstxids" ||
+        method == "getaddressutxos" || method == "getaddressmempool" || method == "getspentinfo") {
+        return cost_class::expensive;
+    }
+
+    return cost_class::standard;
+}
+
+bool admission_control::admit(cost_class cost, work start) {
+    {
+        lock_guard lock(mutex_);
+        auto& target = at(cost);
+        if (!target.queue.empty() || !has_room(cost)) {
+            if (target.queue.size() >= target.bounds.queue_size) {
+                return false;
+            }
+            target.queue.push_back(std::move(start));
+            return true;
+        }
+        ++target.running;
+    }
+
+    std::vector<work> ready;
+    ready.push_back(std::move(start));
+    run(std::move(ready));
+    return true;
+}
+
+void admission_control::release(cost_class cost) {
+    std::vector<work> ready;
+    {
+        lock_guard lock(mutex_);
+        --at(cost).running;
+        collect(ready);
+    }
+    run(std::move(ready));
+}
+
+size_t admission_control::running(cost_class cost) const {
+    lock_guard lock(mutex_);
+    return at(cost).running;
+}
+
+size_t admission_control::queued(cost_class cost) const {
+    lock_guard lock(mutex_);
+    return at(cost).queue.size();
+}
+
+bool admission_control::has_room(cost_class cost) const {
+    auto const& target = at(cost);
+    if (target.bounds.concurrency != 0 && target.running >= target.bounds.concurrency) {
+        return false;
+    }
+    return cost != cost_class::expensive || at(cost_class::mining).running == 0;
+}
+
+void admission_control::collect(std::vector<work>& ready) {
+    for (auto cost : {cost_class::mining, cost_class::standard, cost_class::expensive}) {
+        auto& source = at(cost);
+        while (!source.queue.empty() && has_room(cost)) {
+            ++source.running;
+            ready.push_back(std::move(source.queue.front()));
+            source.queue.pop_front();
+        }
+    }
+}
+
+void admission_control::run(std::vector<work> ready) {
+    // A request completing inline releases its slot from inside the loop
+    // below; what that starts is run by the loop instead of recursing.
+    if (deferred != nullptr) {
+        std::move(ready.begin(), ready.end(), std::back_inserter(*deferred));
+        return;
+    }
+
+    std::deque<work> pending(std::make_move_iterator(ready.begin()), std::make_move_iterator(ready.end()));
+    deferred = &pending;
+    struct reset {
+        ~reset() {
+            deferred = nullptr;
+        }
+    } const guard;
+
+    while (!pending.empty()) {
+        auto next = std::move(pending.front());
+        pending.pop_front();
+        next();
+    }
+}
+
+admission_control::gate& admission_control::at(cost_class cost) {
+    return gates_[static_cast<size_t>(cost)];
+}
+
+admission_control::gate const& admission_control::at(cost_class cost) const {
+    return gates_[static_cast<size_t>(cost)];
+}
+
+}} // namespace bitprim::rpc
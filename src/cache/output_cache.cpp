@@ -0,0 +1,78 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/cache/output_cache.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+namespace bitprim { namespace rpc {
+
+using lock_guard = std::lock_guard<std::mutex>;
+
+output_cache::output_cache(size_t capacity)
+    : capacity_(capacity)
+{}
+
+bool output_cache::find(libbitcoin::chain::output_point const& point, libbitcoin::chain::output& out_output) {
+    lock_guard lock(mutex_);
+    auto const it = index_.find(point);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    out_output = it->second->second;
+    return true;
+}
+
+void output_cache::insert(libbitcoin::chain::output_point const& point, libbitcoin::chain::output const& output) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    lock_guard lock(mutex_);
+    auto const it = index_.find(point);
+    if (it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+
+    entries_.emplace_front(point, output);
+    index_.emplace(point, entries_.begin());
+    if (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
+
+size_t output_cache::size() const {
+    lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+size_t output_cache::point_hash::operator()(libbitcoin::chain::output_point const& point) const {
+    // Transaction hashes are uniformly distributed, a few bytes are enough.
+    uint64_t prefix;
+    std::memcpy(&prefix, point.hash().data(), sizeof(prefix));
+    return static_cast<size_t>(prefix ^ (uint64_t(point.index()) * 0x9e3779b97f4a7c15ull));
+}
+
+}} // namespace bitprim::rpc
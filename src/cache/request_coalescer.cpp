@@ -0,0 +1,113 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/cache/request_coalescer.hpp>
+
+#include <utility>
+
+namespace bitprim { namespace rpc {
+
+using lock_guard = std::lock_guard<std::mutex>;
+
+request_coalescer::request_coalescer()
+    : stopped_(true)
+    , generation_(0)
+{}
+
+void request_coalescer::start(libbitcoin::blockchain::block_chain& chain) {
+    stopped_ = false;
+    chain.subscribe_blockchain([this](libbitcoin::code ec, size_t fork_height,
+                                      libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                      libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+        return handle_reorganize(ec, fork_height, incoming, outgoing);
+    });
+}
+
+void request_coalescer::stop() {
+    stopped_ = true;
+}
+
+size_t request_coalescer::generation() const {
+    return generation_;
+}
+
+request_coalescer::flight_ptr request_coalescer::join(std::string const& key, follower_handler follower) {
+    lock_guard lock(mutex_);
+    auto const it = flights_.find(key);
+    if (it != flights_.end()) {
+        it->second->followers.push_back(std::move(follower));
+        return nullptr;
+    }
+
+    auto leader = std::make_shared<flight>();
+    leader->key = key;
+    leader->sealed = false;
+    flights_.emplace(key, leader);
+    return leader;
+}
+
+bool request_coalescer::seal(flight_ptr const& leader) {
+    lock_guard lock(mutex_);
+    unregister(*leader);
+    return !leader->followers.empty();
+}
+
+void request_coalescer::complete(flight_ptr const& leader, response_ptr response) {
+    std::vector<follower_handler> followers;
+    {
+        lock_guard lock(mutex_);
+        unregister(*leader);
+        followers.swap(leader->followers);
+    }
+
+    for (auto const& follower : followers) {
+        follower(response);
+    }
+}
+
+size_t request_coalescer::size() const {
+    lock_guard lock(mutex_);
+    return flights_.size();
+}
+
+bool request_coalescer::handle_reorganize(libbitcoin::code ec, size_t /*fork_height*/,
+                                          libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                          libbitcoin::block_const_ptr_list_const_ptr /*outgoing*/) {
+    if (stopped_ || ec == libbitcoin::error::service_stopped) {
+        return false;
+    }
+
+    if (!ec && incoming && !incoming->empty()) {
+        ++generation_;
+    }
+    return true;
+}
+
+void request_coalescer::unregister(flight& leader) {
+    // Once sealed its key may already belong to a newer flight.
+    if (leader.sealed) {
+        return;
+    }
+
+    leader.sealed = true;
+    flights_.erase(leader.key);
+}
+
+}} // namespace bitprim::rpc
@@ -0,0 +1,135 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/cache/response_cache.hpp>
+
+#include <iterator>
+
+namespace bitprim { namespace rpc {
+
+using lock_guard = std::lock_guard<std::mutex>;
+
+response_cache::response_cache(size_t capacity)
+    : capacity_(capacity)
+    , stopped_(true)
+    , generation_(0)
+    , size_(0)
+{}
+
+void response_cache::start(libbitcoin::blockchain::block_chain& chain) {
+    stopped_ = false;
+    chain.subscribe_blockchain([this](libbitcoin::code ec, size_t fork_height,
+                                      libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                      libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+        return handle_reorganize(ec, fork_height, incoming, outgoing);
+    });
+}
+
+void response_cache::stop() {
+    stopped_ = true;
+}
+
+size_t response_cache::generation() const {
+    return generation_;
+}
+
+bool response_cache::find(std::string const& key, std::string& out_response) {
+    lock_guard lock(mutex_);
+    auto const it = index_.find(key);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    out_response = it->second->response;
+    return true;
+}
+
+void response_cache::insert(std::string const& key, std::string response, lifetime life, size_t generation) {
+    lock_guard lock(mutex_);
+
+    // The tip moved while the response was being built.
+    if (life == lifetime::tip && generation != generation_) {
+        return;
+    }
+
+    auto const it = index_.find(key);
+    if (it != index_.end()) {
+        erase(it->second);
+    }
+
+    entries_.push_front(entry{key, std::move(response), life});
+    auto const charged = charge(entries_.front());
+    if (charged > capacity_) {
+        entries_.pop_front();
+        return;
+    }
+
+    index_.emplace(key, entries_.begin());
+    size_ += charged;
+    evict();
+}
+
+void response_cache::invalidate_tip() {
+    lock_guard lock(mutex_);
+    ++generation_;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        auto const current = it++;
+        if (current->life == lifetime::tip) {
+            erase(current);
+        }
+    }
+}
+
+size_t response_cache::size() const {
+    lock_guard lock(mutex_);
+    return size_;
+}
+
+size_t response_cache::charge(entry const& value) {
+    return 2 * value.key.size() + value.response.size() + entry_overhead;
+}
+
+bool response_cache::handle_reorganize(libbitcoin::code ec, size_t /*fork_height*/,
+                                       libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                       libbitcoin::block_const_ptr_list_const_ptr /*outgoing*/) {
+    if (stopped_ || ec == libbitcoin::error::service_stopped) {
+        return false;
+    }
+
+    if (!ec && incoming && !incoming->empty()) {
+        invalidate_tip();
+    }
+    return true;
+}
+
+void response_cache::erase(entry_list::iterator it) {
+    size_ -= charge(*it);
+    index_.erase(it->key);
+    entries_.erase(it);
+}
+
+void response_cache::evict() {
+    while (size_ > capacity_ && !entries_.empty()) {
+        erase(std::prev(entries_.end()));
+    }
+}
+
+}} // namespace bitprim::rpc
@@ -0,0 +1,379 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/encoding/hex.hpp>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BITPRIM_RPC_HEX_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BITPRIM_RPC_TARGET_AVX2
+#else
+#define BITPRIM_RPC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace bitprim { namespace rpc {
+
+namespace {
+
+// Scalar
+//-----------------------------------------------------------------------------
+
+char const digits[] = "0123456789abcdef";
+
+struct decode_table {
+    decode_table() {
+        std::fill(values, values + 256, int8_t(-1));
+        for (int i = 0; i < 10; ++i) {
+            values['0' + i] = int8_t(i);
+        }
+        for (int i = 0; i < 6; ++i) {
+            values['a' + i] = int8_t(10 + i);
+            values['A' + i] = int8_t(10 + i);
+        }
+    }
+
+    int8_t values[256];
+};
+
+decode_table const& decode_values() {
+    static decode_table const table;
+    return table;
+}
+
+void scalar_encode(uint8_t const* data, size_t size, char* out) {
+    for (size_t i = 0; i < size; ++i) {
+        *out++ = digits[data[i] >> 4];
+        *out++ = digits[data[i] & 0x0f];
+    }
+}
+
+// Bytes [data, data + size) last to first.
+void scalar_encode_reversed(uint8_t const* data, size_t size, char* out) {
+    while (size != 0) {
+        auto const byte = data[--size];
+        *out++ = digits[byte >> 4];
+        *out++ = digits[byte & 0x0f];
+    }
+}
+
+bool scalar_decode(char const* text, size_t size, uint8_t* out) {
+    auto const& values = decode_values().values;
+    for (size_t i = 0; i < size; i += 2) {
+        auto const high = values[static_cast<uint8_t>(text[i])];
+        auto const low = values[static_cast<uint8_t>(text[i + 1])];
+        if ((high | low) < 0) {
+            return false;
+        }
+        *out++ = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+
+#if defined(BITPRIM_RPC_HEX_X86_64)
+
+// SSE2
+//-----------------------------------------------------------------------------
+
+// Nibbles (0-15) to their lowercase hex digit.
+inline
+__m128i sse2_digits(__m128i nibbles) {
+    auto const letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+// 16 bytes to 32 chars.
+inline
+void sse2_encode_block(__m128i bytes, char* out) {
+    auto const mask = _mm_set1_epi8(0x0f);
+    auto const high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    auto const low = _mm_and_si128(bytes, mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), sse2_digits(_mm_unpacklo_epi8(high, low)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), sse2_digits(_mm_unpackhi_epi8(high, low)));
+}
+
+inline
+__m128i sse2_reverse(__m128i bytes) {
+    bytes = _mm_or_si128(_mm_slli_epi16(bytes, 8), _mm_srli_epi16(bytes, 8));
+    bytes = _mm_shufflelo_epi16(bytes, _MM_SHUFFLE(0, 1, 2, 3));
+    bytes = _mm_shufflehi_epi16(bytes, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(bytes, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+// 16 chars to their nibbles; false if any of them is not a hex digit.
+// Chars above 0x7f compare as negative and are rejected by both ranges.
+inline
+bool sse2_nibbles(__m128i chars, __m128i& nibbles) {
+    auto const lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    auto const digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    auto const letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                           _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return _mm_movemask_epi8(_mm_or_si128(digit, letter)) == 0xffff;
+}
+
+// Pairs of nibbles to bytes, one per 16 bit lane.
+inline
+__m128i sse2_join(__m128i nibbles) {
+    auto const high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4);
+    return _mm_or_si128(high, _mm_srli_epi16(nibbles, 8));
+}
+
+void sse2_encode(uint8_t const* data, size_t size, char* out) {
+    for (; size >= 16; size -= 16, data += 16, out += 32) {
+        sse2_encode_block(_mm_loadu_si128(reinterpret_cast<__m128i const*>(data)), out);
+    }
+    scalar_encode(data, size, out);
+}
+
+void sse2_encode_reversed(uint8_t const* data, size_t size, char* out) {
+    for (; size >= 16; size -= 16, out += 32) {
+        auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + size - 16));
+        sse2_encode_block(sse2_reverse(bytes), out);
+    }
+    scalar_encode_reversed(data, size, out);
+}
+
+bool sse2_decode(char const* text, size_t size, uint8_t* out) {
+    for (; size >= 32; size -= 32, text += 32, out += 16) {
+        __m128i first;
+        __m128i second;
+        if (!sse2_nibbles(_mm_loadu_si128(reinterpret_cast<__m128i const*>(text)), first) ||
+            !sse2_nibbles(_mm_loadu_si128(reinterpret_cast<__m128i const*>(text + 16)), second)) {
+            return false;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(sse2_join(first), sse2_join(second)));
+    }
+    return scalar_decode(text, size, out);
+}
+
+// AVX2
+//-----------------------------------------------------------------------------
+
+// 256 bit unpack, pack and shuffle work per 128 bit lane, hence the
+// permutes restoring the byte order. Tails go to the SSE2 kernels, which
+// are legacy encoded: clear the upper halves first to avoid the AVX/SSE
+// transition penalty.
+
+BITPRIM_RPC_TARGET_AVX2 inline
+__m256i avx2_digits(__m256i nibbles) {
+    auto const letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+// 32 bytes to 64 chars.
+BITPRIM_RPC_TARGET_AVX2 inline
+void avx2_encode_block(__m256i bytes, char* out) {
+    auto const mask = _mm256_set1_epi8(0x0f);
+    auto const high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask);
+    auto const low = _mm256_and_si256(bytes, mask);
+    auto const first = _mm256_unpacklo_epi8(high, low);
+    auto const second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), avx2_digits(_mm256_permute2x128_si256(first, second, 0x20)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), avx2_digits(_mm256_permute2x128_si256(first, second, 0x31)));
+}
+
+BITPRIM_RPC_TARGET_AVX2 inline
+__m256i avx2_reverse(__m256i bytes) {
+    auto const mask = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                       15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    bytes = _mm256_shuffle_epi8(bytes, mask);
+    return _mm256_permute2x128_si256(bytes, bytes, 0x01);
+}
+
+BITPRIM_RPC_TARGET_AVX2 inline
+bool avx2_nibbles(__m256i chars, __m256i& nibbles) {
+    auto const lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    auto const digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    auto const letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    nibbles = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+                              _mm256_and_si256(letter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+    return _mm256_movemask_epi8(_mm256_or_si256(digit, letter)) == -1;
+}
+
+BITPRIM_RPC_TARGET_AVX2 inline
+__m256i avx2_join(__m256i nibbles) {
+    auto const high = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00ff)), 4);
+    return _mm256_or_si256(high, _mm256_srli_epi16(nibbles, 8));
+}
+
+BITPRIM_RPC_TARGET_AVX2
+void avx2_encode(uint8_t const* data, size_t size, char* out) {
+    for (; size >= 32; size -= 32, data += 32, out += 64) {
+        avx2_encode_block(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(data)), out);
+    }
+    _mm256_zeroupper();
+    sse2_encode(data, size, out);
+}
+
+BITPRIM_RPC_TARGET_AVX2
+void avx2_encode_reversed(uint8_t const* data, size_t size, char* out) {
+    for (; size >= 32; size -= 32, out += 64) {
+        auto const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + size - 32));
+        avx2_encode_block(avx2_reverse(bytes), out);
+    }
+    _mm256_zeroupper();
+    sse2_encode_reversed(data, size, out);
+}
+
+BITPRIM_RPC_TARGET_AVX2
+bool avx2_decode(char const* text, size_t size, uint8_t* out) {
+    for (; size >= 64; size -= 64, text += 64, out += 32) {
+        __m256i first;
+        __m256i second;
+        if (!avx2_nibbles(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(text)), first) ||
+            !avx2_nibbles(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(text + 32)), second)) {
+            return false;
+        }
+        auto const bytes = _mm256_packus_epi16(avx2_join(first), avx2_join(second));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute4x64_epi64(bytes, 0xd8));
+    }
+    _mm256_zeroupper();
+    return sse2_decode(text, size, out);
+}
+
+bool cpu_supports_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    auto const osxsave = (info[2] & (1 << 27)) != 0;
+    auto const avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // BITPRIM_RPC_HEX_X86_64
+
+hex_kernel detect_kernel() {
+#if defined(BITPRIM_RPC_HEX_X86_64)
+    return cpu_supports_avx2() ? hex_kernel::avx2 : hex_kernel::sse2;
+#else
+    return hex_kernel::scalar;
+#endif
+}
+
+hex_kernel usable(hex_kernel kernel) {
+    return hex_kernel_supported(kernel) ? kernel : hex_kernel::scalar;
+}
+
+} // namespace
+
+hex_kernel hex_best_kernel() {
+    static hex_kernel const kernel = detect_kernel();
+    return kernel;
+}
+
+bool hex_kernel_supported(hex_kernel kernel) {
+    return kernel <= hex_best_kernel();
+}
+
+void hex_encode(uint8_t const* data, size_t size, char* out, hex_kernel kernel) {
+    switch (usable(kernel)) {
+#if defined(BITPRIM_RPC_HEX_X86_64)
+        case hex_kernel::avx2: avx2_encode(data, size, out); return;
+        case hex_kernel::sse2: sse2_encode(data, size, out); return;
+#endif
+        default: scalar_encode(data, size, out); return;
+    }
+}
+
+void hex_encode_reversed(uint8_t const* data, size_t size, char* out, hex_kernel kernel) {
+    switch (usable(kernel)) {
+#if defined(BITPRIM_RPC_HEX_X86_64)
+        case hex_kernel::avx2: avx2_encode_reversed(data, size, out); return;
+        case hex_kernel::sse2: sse2_encode_reversed(data, size, out); return;
+#endif
+        default: scalar_encode_reversed(data, size, out); return;
+    }
+}
+
+bool hex_decode(char const* text, size_t size, uint8_t* out, hex_kernel kernel) {
+    if (size % 2 != 0) {
+        return false;
+    }
+
+    switch (usable(kernel)) {
+#if defined(BITPRIM_RPC_HEX_X86_64)
+        case hex_kernel::avx2: return avx2_decode(text, size, out);
+        case hex_kernel::sse2: return sse2_decode(text, size, out);
+#endif
+        default: return scalar_decode(text, size, out);
+    }
+}
+
+void hex_encode(uint8_t const* data, size_t size, char* out) {
+    hex_encode(data, size, out, hex_best_kernel());
+}
+
+void hex_encode_reversed(uint8_t const* data, size_t size, char* out) {
+    hex_encode_reversed(data, size, out, hex_best_kernel());
+}
+
+bool hex_decode(char const* text, size_t size, uint8_t* out) {
+    return hex_decode(text, size, out, hex_best_kernel());
+}
+
+std::string encode_base16(libbitcoin::data_slice data) {
+    std::string out(data.size() * 2, '\0');
+    hex_encode(data.data(), data.size(), &out[0]);
+    return out;
+}
+
+std::string encode_hash(libbitcoin::hash_digest const& hash) {
+    std::string out(hash.size() * 2, '\0');
+    hex_encode_reversed(hash.data(), hash.size(), &out[0]);
+    return out;
+}
+
+bool decode_base16(libbitcoin::data_chunk& out, std::string const& in) {
+    libbitcoin::data_chunk result(in.size() / 2);
+    if (!hex_decode(in.data(), in.size(), result.data())) {
+        return false;
+    }
+    out = std::move(result);
+    return true;
+}
+
+bool decode_hash(libbitcoin::hash_digest& out, std::string const& in) {
+    libbitcoin::hash_digest result;
+    if (in.size() != 2 * result.size() || !hex_decode(in.data(), in.size(), result.data())) {
+        return false;
+    }
+    std::reverse(result.begin(), result.end());
+    out = result;
+    return true;
+}
+
+}} // namespace bitprim::rpc
@@ -0,0 +1,271 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/http/compression.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <zlib.h>
+
+namespace bitprim { namespace rpc {
+
+namespace {
+
+constexpr int max_window_bits = 15;
+constexpr int memory_level = 8;
+
+// Compressed prefixes start with the checksums and size of the prefix.
+constexpr size_t prefix_header_size = 12;
+
+constexpr size_t max_stored_block = 65535;
+
+char const gzip_header[] = {'\x1f', '\x8b', '\x08', 0, 0, 0, 0, 0, 0, '\xff'};
+char const zlib_header[] = {'\x78', '\x9c'};
+
+// Negative window bits give a raw deflate stream, without header or trailer.
+void initialize(z_stream& stream, int window_bits, int level) {
+    stream = z_stream();
+    level = std::max(1, std::min(level, 9));
+    auto const status = deflateInit2(&stream, level, Z_DEFLATED, window_bits, memory_level, Z_DEFAULT_STRATEGY);
+    if (status == Z_MEM_ERROR) {
+        throw std::bad_alloc();
+    }
+    if (status != Z_OK) {
+        throw std::runtime_error("deflate initialization failed");
+    }
+}
+
+int window_bits(content_coding coding) {
+    // Gzip is asked to zlib by adding 16 to the window bits.
+    return coding == content_coding::gzip ? max_window_bits + 16 : max_window_bits;
+}
+
+// Compresses [data, data + size) appending to out, flush applies after the last byte.
+void deflate_into(z_stream& stream, char const* data, size_t size, int flush, std::string& out) {
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    do {
+        auto const piece = std::min<size_t>(size, std::numeric_limits<uInt>::max());
+        stream.avail_in = static_cast<uInt>(piece);
+        size -= piece;
+        auto const mode = size == 0 ? flush : Z_NO_FLUSH;
+
+        int status;
+        do {
+            auto const offset = out.size();
+            auto const room = std::max<size_t>(piece / 4, 16 * 1024);
+            out.resize(offset + room);
+            stream.next_out = reinterpret_cast<Bytef*>(&out[offset]);
+            stream.avail_out = static_cast<uInt>(room);
+            status = deflate(&stream, mode);
+            out.resize(offset + room - stream.avail_out);
+            if (status == Z_STREAM_ERROR) {
+                throw std::runtime_error("deflate failed");
+            }
+        } while (stream.avail_out == 0 || (mode == Z_FINISH && status != Z_STREAM_END));
+    } while (size != 0);
+}
+
+void put_little_endian(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void put_big_endian(std::string& out, uint32_t value) {
+    for (int i = 3; i >= 0; --i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+uint32_t get_little_endian(std::string const& in, size_t offset) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | static_cast<uint8_t>(in[offset + i]);
+    }
+    return value;
+}
+
+Bytef const* bytes(std::string const& data) {
+    return reinterpret_cast<Bytef const*>(data.data());
+}
+
+} // namespace
+
+content_coding negotiate_coding(std::string const& accept_encoding) {
+    // Quality of each coding, negative when not listed.
+    double gzip = -1;
+    double deflate = -1;
+    double any = -1;
+
+    std::vector<std::string> elements;
+    boost::algorithm::split(elements, accept_encoding, boost::algorithm::is_any_of(","));
+    for (auto& element : elements) {
+        boost::algorithm::to_lower(element);
+        auto const semicolon = element.find(';');
+        auto const name = boost::algorithm::trim_copy(element.substr(0, semicolon));
+
+        double quality = 1;
+        if (semicolon != std::string::npos) {
+            auto const q = element.find("q=", semicolon);
+            if (q != std::string::npos) {
+                quality = std::strtod(element.c_str() + q + 2, nullptr);
+            }
+        }
+
+        if (name == "gzip" || name == "x-gzip") {
+            gzip = quality;
+        } else if (name == "deflate") {
+            deflate = quality;
+        } else if (name == "*") {
+            any = quality;
+        }
+    }
+
+    if (gzip < 0) {
+        gzip = any;
+    }
+    if (deflate < 0) {
+        deflate = any;
+    }
+
+    if (gzip > 0 && gzip >= deflate) {
+        return content_coding::gzip;
+    }
+    if (deflate > 0) {
+        return content_coding::deflate;
+    }
+    return content_coding::identity;
+}
+
+char const* coding_name(content_coding coding) {
+    switch (coding) {
+        case content_coding::gzip: return "gzip";
+        case content_coding::deflate: return "deflate";
+        default: return "identity";
+    }
+}
+
+std::string compress(std::string const& body, content_coding coding, int level) {
+    if (coding == content_coding::identity) {
+        return body;
+    }
+    compressor deflater(coding, level);
+    return deflater.finish(body);
+}
+
+compressor::compressor(content_coding coding, int level)
+    : stream_(new z_stream())
+{
+    initialize(*stream_, window_bits(coding), level);
+}
+
+compressor::~compressor() {
+    deflateEnd(stream_.get());
+}
+
+std::string compressor::write(std::string const& piece) {
+    std::string out;
+    deflate_into(*stream_, piece.data(), piece.size(), Z_NO_FLUSH, out);
+    return out;
+}
+
+std::string compressor::finish(std::string const& piece) {
+    std::string out;
+    deflate_into(*stream_, piece.data(), piece.size(), Z_FINISH, out);
+    return out;
+}
+
+std::string compress_prefix(std::string const& prefix, int level) {
+    // Crc and adler only take sizes in uInt steps.
+    uLong crc = crc32(0, Z_NULL, 0);
+    uLong adler = adler32(0, Z_NULL, 0);
+    for (size_t done = 0; done < prefix.size();) {
+        auto const piece = std::min<size_t>(prefix.size() - done, std::numeric_limits<uInt>::max());
+        crc = crc32(crc, bytes(prefix) + done, static_cast<uInt>(piece));
+        adler = adler32(adler, bytes(prefix) + done, static_cast<uInt>(piece));
+        done += piece;
+    }
+    std::string out;
+    put_little_endian(out, static_cast<uint32_t>(crc));
+    put_little_endian(out, static_cast<uint32_t>(adler));
+    put_little_endian(out, static_cast<uint32_t>(prefix.size()));
+
+    // A raw stream ended by a full flush is byte aligned and does not
+    // refer back to the prefix, so any deflate block may follow it.
+    z_stream stream;
+    initialize(stream, -max_window_bits, level);
+    try {
+        deflate_into(stream, prefix.data(), prefix.size(), Z_FULL_FLUSH, out);
+    } catch (...) {
+        deflateEnd(&stream);
+        throw;
+    }
+    deflateEnd(&stream);
+    return out;
+}
+
+std::string complete_prefix(std::string const& compressed_prefix, std::string const& ending, content_coding coding) {
+    if (compressed_prefix.size() < prefix_header_size || coding == content_coding::identity) {
+        throw std::invalid_argument("complete_prefix");
+    }
+
+    std::string out;
+    out.reserve(compressed_prefix.size() + ending.size() + 32);
+    if (coding == content_coding::gzip) {
+        out.append(gzip_header, sizeof(gzip_header));
+    } else {
+        out.append(zlib_header, sizeof(zlib_header));
+    }
+    out.append(compressed_prefix, prefix_header_size, std::string::npos);
+
+    // The ending goes in stored blocks, the last one closes the stream.
+    size_t done = 0;
+    do {
+        auto const count = std::min(ending.size() - done, max_stored_block);
+        auto const last = done + count == ending.size();
+        out.push_back(last ? 1 : 0);
+        out.push_back(static_cast<char>(count & 0xff));
+        out.push_back(static_cast<char>(count >> 8));
+        out.push_back(static_cast<char>(~count & 0xff));
+        out.push_back(static_cast<char>((~count >> 8) & 0xff));
+        out.append(ending, done, count);
+        done += count;
+    } while (done != ending.size());
+
+    auto const size = static_cast<uInt>(ending.size());
+    if (coding == content_coding::gzip) {
+        auto const crc = crc32_combine(get_little_endian(compressed_prefix, 0), crc32(0, bytes(ending), size), size);
+        put_little_endian(out, static_cast<uint32_t>(crc));
+        put_little_endian(out, get_little_endian(compressed_prefix, 8) + static_cast<uint32_t>(ending.size()));
+    } else {
+        auto const adler = adler32_combine(get_little_endian(compressed_prefix, 4), adler32(1, bytes(ending), size), size);
+        put_big_endian(out, static_cast<uint32_t>(adler));
+    }
+    return out;
+}
+
+}} // namespace bitprim::rpc
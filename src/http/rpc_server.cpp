@@ -20,21 +20,105 @@
 
 #include <bitprim/rpc/http/rpc_server.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <sstream>
 
 namespace bitprim { namespace rpc {
 
+namespace {
+
+template <typename Request>
+char const* connection_header(Request const& request) {
+    return request.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+template <typename Request>
+std::string header_value(Request const& request, char const* name) {
+    auto const it = request.header.find(name);
+    return it == request.header.end() ? std::string() : it->second;
+}
+
+std::string encoding_header(content_coding coding) {
+    if (coding == content_coding::identity) {
+        return std::string();
+    }
+    return std::string("Content-Encoding: ") + coding_name(coding) + "\r\nVary: Accept-Encoding\r\n";
+}
+
+// Key of the compressed body of a cacheable request, empty otherwise.
+std::string compressed_key(nlohmann::json const& json_in, content_coding coding, header_index const* headers, response_cache::lifetime& out_lifetime) {
+    auto const method = json_in.find("method");
+    if (json_in.find("id") == json_in.end() || method == json_in.end() || !method->is_string()) {
+        return std::string();
+    }
+
+    auto const name = method->get<std::string>();
+    if (!response_lifetime(name, json_in, out_lifetime, headers)) {
+        return std::string();
+    }
+
+    auto const params = json_in.find("params");
+    std::string key = coding_name(coding);
+    key.push_back(' ');
+    key += name;
+    key.push_back(' ');
+    key += params == json_in.end() ? "null" : params->dump();
+    return key;
+}
+
+// A response going out in chunks, compressed as it is produced.
+struct response_stream {
+    bool started = false;
+    std::unique_ptr<compressor> deflater;
+};
+
+} // namespace
+
 rpc_server::rpc_server(bool use_testnet_rules
         , std::shared_ptr<libbitcoin::node::full_node> & node
         , uint32_t rpc_port
-        , const std::unordered_set<std::string> & rpc_allowed_ips)
+        , const std::unordered_set<std::string> & rpc_allowed_ips
+        , settings const& config
+        , message_context const& context)
     : use_testnet_rules_(use_testnet_rules)
     , stopped_(true)
     , node_(node)
     , rpc_allowed_ips_(rpc_allowed_ips)
-    , signature_map_(load_signature_map<libbitcoin::blockchain::block_chain>())
+    , workers_(context.dispatch ? nullptr : new worker_pool(config.worker_threads, config.pin_threads))
+    , dispatch_(context.dispatch)
+    , headers_(context.headers)
+    , compression_level_(std::min<uint32_t>(config.compression_level, 9))
+    , compression_threshold_(config.compression_threshold)
+    , compressed_(config.compression_level != 0 && config.compression_cache_size != 0 ? new response_cache(size_t(config.compression_cache_size) << 20) : nullptr)
 {
     server_.config.port = rpc_port;
+    server_.config.thread_pool_size = config.io_threads == 0 ? 1 : config.io_threads;
+    server_.config.timeout_idle = config.http_idle_timeout;
+    server_.config.max_requests_per_connection = config.http_max_requests;
+    server_.config.max_pipelined_requests = config.http_max_pipelined;
+
+    // The manager shares its workers through the context, a server used
+    // on its own runs a pool of its own.
+    if (!dispatch_) {
+        auto const workers = workers_.get();
+        dispatch_ = [workers](std::function<void()> work) {
+            workers->post(std::move(work));
+        };
+    }
+
+    // Batch elements are spread over the workers as well.
+    batch_.parallelism = config.batch_parallelism == 0 ? 1 : config.batch_parallelism;
+    batch_.max_size = config.max_batch_size;
+    batch_.dispatch = dispatch_;
+
+    // Messages spread their own work over the same workers.
+    auto messages = context;
+    messages.dispatch = dispatch_;
+    signature_map_ = load_signature_map<libbitcoin::blockchain::block_chain>(messages);
+
     configure_server();
 }
 
@@ -42,74 +126,185 @@ void rpc_server::configure_server() {
 
     server_.resource["^/json$"]["POST"] = [this](std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request) {
         //TODO: validate json parameters
-        if (rpc_allowed_ips_.find(request->remote_endpoint_address) != rpc_allowed_ips_.end()){
-            try {
-                auto json_str = request->content.string();
-                if (json_str.size() > 0 && json_str.back() == '\n') {
-                    json_str.pop_back();
-                }
-                nlohmann::json json_object = nlohmann::json::parse(json_str);
-
-                auto result = bitprim::process_data(json_object, use_testnet_rules_, node_, signature_map_);
-                result = result + "\u000a";
-
-                *response << "HTTP/1.1 200 OK\r\n"
-                            << "Content-Type: application/json\r\n"
-                            << "Content-Length: " << result.length() << "\r\n\r\n"
-                            << result;
-
-            } catch(std::exception const& e) {
-                *response << "HTTP/1.1 400 Bad Request\r\nContent-Length: " << strlen(e.what()) << "\r\n\r\n" << e.what();
-            }
-        }else {
-            std::string e = "HTTP_FORBIDDEN";
-            *response << "HTTP/1.1 403 Forbidden\r\nContent-Length: " << e.length() << "\r\n\r\n" << e;
-        }
+        process_request(std::move(response), std::move(request));
     };
 
     server_.default_resource["POST"] = [this](std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request) {
         //TODO: validate if request is application/json
+        process_request(std::move(response), std::move(request));
+    };
 
-        if (rpc_allowed_ips_.find(request->remote_endpoint_address) != rpc_allowed_ips_.end()){
-            try {
-    //            nlohmann::json json_object = nlohmann::json::parse(request->content.string());
+    server_.default_resource["GET"] = [](std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request) {
+        //TODO: check error description
+        std::string error = "This server only accepts json requests";
+        *response << "HTTP/1.1 400 Bad Request\r\n" << connection_header(*request) << "Content-Length: " << error.length() << "\r\n\r\n" << error;
+    };
+}
 
-                auto json_str = request->content.string();
+void rpc_server::process_request(std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request) {
+    if (rpc_allowed_ips_.find(request->remote_endpoint_address) == rpc_allowed_ips_.end()) {
+        std::string e = "HTTP_FORBIDDEN";
+        *response << "HTTP/1.1 403 Forbidden\r\n" << connection_header(*request) << "Content-Length: " << e.length() << "\r\n\r\n" << e;
+        return;
+    }
 
-                if (json_str.size() > 0 && json_str.back() == '\n') {
-                    json_str.pop_back();
-                }
+    // Parsing, dispatch and serialization run on the worker pool,
+    // the io threads only read requests and write responses.
+    auto pending = std::make_shared<std::shared_ptr<HttpServer::Response>>(std::move(response));
+    dispatch_([this, pending, request]() {
+        try {
+            auto json_str = request->content.string();
+            if (json_str.size() > 0 && json_str.back() == '\n') {
+                json_str.pop_back();
+            }
 
-                nlohmann::json json_object = nlohmann::json::parse(json_str);
+            nlohmann::json json_object = nlohmann::json::parse(json_str);
 
-                auto result = bitprim::process_data(json_object, use_testnet_rules_, node_, signature_map_);
-                result = result + "\u000a";
+            auto const coding = compression_level_ == 0 ? content_coding::identity : negotiate_coding(header_value(*request, "Accept-Encoding"));
 
-    //            TODO: add date to response
-    //            << "Date: Wed, 01 Feb 2017 15:03:36 GMT\r\n"
-                *response << "HTTP/1.1 200 OK\r\n"
-                            << "Content-Type: application/json\r\n"
-                            << "Content-Length: " << result.length() << "\r\n\r\n"
-                            << result;
+            // Cacheable responses keep their compressed body without the id,
+            // each hit only appends its own.
+            auto life = response_cache::lifetime::tip;
+            std::string key;
+            std::string ending;
+            if (coding != content_coding::identity && compressed_ && json_object.is_object()) {
+                key = compressed_key(json_object, coding, headers_, life);
+                if (!key.empty()) {
+                    ending = json_object.at("id").dump() + "}\n";
+                    std::string prefix;
+                    if (compressed_->find(key, prefix)) {
+                        reply_json(pending, *request, coding, complete_prefix(prefix, ending, coding));
+                        return;
+                    }
+                }
+            }
+            auto const generation = compressed_ ? compressed_->generation() : 0;
 
-            } catch(std::exception const& e) {
-                *response << "HTTP/1.1 400 Bad Request\r\nContent-Length: " << strlen(e.what()) << "\r\n\r\n" << e.what();
+            // Single requests from HTTP/1.1 clients may stream their response,
+            // sent chunked from the first piece on. Those pieces are compressed
+            // by whoever produces them, to keep them in order.
+            auto const stream = std::make_shared<response_stream>();
+            chunk_handler chunks;
+            if (!json_object.is_array() && request->http_version != "1.0") {
+                auto const level = compression_level_;
+                auto const dispatch = dispatch_;
+                chunks = [pending, request, stream, coding, level, dispatch](std::string chunk, std::function<void()> resume) {
+                    auto const& response = *pending;
+                    if (!response) {
+                        return true;
+                    }
+                    if (coding != content_coding::identity) {
+                        if (!stream->deflater) {
+                            stream->deflater.reset(new compressor(coding, level));
+                        }
+                        chunk = stream->deflater->write(chunk);
+                        if (chunk.empty()) {
+                            return true;
+                        }
+                    }
+                    if (!stream->started) {
+                        stream->started = true;
+                        *response << "HTTP/1.1 200 OK\r\n"
+                                  << connection_header(*request)
+                                  << "Content-Type: application/json\r\n"
+                                  << encoding_header(coding)
+                                  << "Transfer-Encoding: chunked\r\n\r\n";
+                    }
+                    // Resumed from a write completion, the producer goes on
+                    // on the workers rather than on the io thread.
+                    return response->chunk(std::move(chunk), [dispatch, resume]() {
+                        dispatch(resume);
+                    });
+                };
             }
-        }else {
-            std::string e = "HTTP_FORBIDDEN";
-            *response << "HTTP/1.1 403 Forbidden\r\nContent-Length: " << e.length() << "\r\n\r\n" << e;
+
+            bitprim::process_data(json_object, use_testnet_rules_, node_, signature_map_, batch_, response_handler([this, pending, request, stream, coding, key, ending, life, generation](std::string result) {
+                result.push_back('\n');
+                if (stream->deflater) {
+                    result = stream->deflater->finish(result);
+                    if (!stream->started) {
+                        reply_json(pending, *request, coding, std::move(result));
+                        return;
+                    }
+                }
+                if (stream->started) {
+                    reply(pending, "", std::move(result));
+                    return;
+                }
+
+                if (coding == content_coding::identity || result.size() < compression_threshold_) {
+                    reply_json(pending, *request, content_coding::identity, std::move(result));
+                    return;
+                }
+
+                // The completion may run on a chain thread, compression goes
+                // back to the workers.
+                auto const body = std::make_shared<std::string>(std::move(result));
+                dispatch_([this, pending, request, coding, key, ending, life, generation, body]() {
+                    reply_json(pending, *request, coding, compress_response(*body, coding, key, ending, life, generation));
+                });
+            }, std::move(chunks)));
+        } catch(std::exception const& e) {
+            std::ostringstream header;
+            header << "HTTP/1.1 400 Bad Request\r\n" << connection_header(*request) << "Content-Length: " << strlen(e.what()) << "\r\n\r\n";
+            reply(pending, header.str(), e.what());
         }
-    };
+    });
+}
 
-    server_.default_resource["GET"] = [](std::shared_ptr<HttpServer::Response> response, std::shared_ptr<HttpServer::Request> request) {
-        //TODO: check error description
-        std::string error = "This server only accepts json requests";
-        *response << "HTTP/1.1 400 Bad Request\r\nContent-Length: " << error.length() << "\r\n\r\n" << error;
-    };
+std::string rpc_server::compress_response(std::string const& response, content_coding coding, std::string const& key,
+                                          std::string const& ending, response_cache::lifetime life, size_t generation) {
+    // Only successes are kept, as in the response cache.
+    static std::string const success = ",\"error\":null,\"id\":";
+    auto const size = response.size();
+    if (key.empty() || size < ending.size() + success.size() ||
+        response.compare(size - ending.size(), ending.size(), ending) != 0 ||
+        response.compare(size - ending.size() - success.size(), success.size(), success) != 0) {
+        return compress(response, coding, compression_level_);
+    }
+
+    auto prefix = compress_prefix(response.substr(0, size - ending.size()), compression_level_);
+    auto body = complete_prefix(prefix, ending, coding);
+    compressed_->insert(key, std::move(prefix), life, generation);
+    return body;
+}
+
+void rpc_server::reply_json(pending_response const& pending, HttpServer::Request const& request, content_coding coding, std::string body) {
+    //TODO: add date to response
+    //<< "Date: Wed, 01 Feb 2017 15:03:36 GMT\r\n"
+    std::ostringstream header;
+    header << "HTTP/1.1 200 OK\r\n"
+           << connection_header(request)
+           << "Content-Type: application/json\r\n"
+           << encoding_header(coding)
+           << "Content-Length: " << body.length() << "\r\n\r\n";
+    reply(pending, header.str(), std::move(body));
+}
+
+void rpc_server::reply(pending_response const& pending, std::string const& header, std::string content) {
+    auto response = std::move(*pending);
+    if (!response) {
+        return;
+    }
+
+    // The content goes to the socket from its own buffer, only the header
+    // is copied into the response stream.
+    *response << header;
+    response->content(std::move(content));
+
+    // The response is sent when its last reference goes away, let that
+    // happen on an io thread instead of the thread completing the request.
+    server_.io_service->post(std::bind([](std::shared_ptr<HttpServer::Response> const&) {}, std::move(response)));
 }
 
 bool rpc_server::start() {
     stopped_ = false;
+    if (compressed_) {
+        compressed_->start(node_->chain_bitprim());
+    }
+    if (workers_) {
+        workers_->start();
+    }
     server_.start();
     return true;
 }
@@ -117,9 +312,14 @@ bool rpc_server::start() {
 bool rpc_server::stop() {
     stopped_ = true;
     server_.stop();
+    if (workers_) {
+        workers_->stop();
+    }
+    if (compressed_) {
+        compressed_->stop();
+    }
     return true;
 }
-
 bool rpc_server::stopped() const {
     return stopped_;
 }
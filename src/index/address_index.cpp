@@ -0,0 +1,406 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/index/address_index.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace bitprim { namespace rpc {
+
+using unique_lock = boost::unique_lock<boost::shared_mutex>;
+using shared_lock = boost::shared_lock<boost::shared_mutex>;
+
+constexpr size_t address_index::undo_depth;
+
+address_index::address_index(libbitcoin::blockchain::block_chain& chain)
+    : address_index([&chain](libbitcoin::blockchain::safe_chain::reorganize_handler handler) {
+                        chain.subscribe_blockchain(std::move(handler));
+                    },
+                    [&chain](size_t height, libbitcoin::blockchain::safe_chain::block_fetch_handler handler) {
+                        chain.fetch_block(height, false, std::move(handler));
+                    })
+{}
+
+address_index::address_index(subscriber subscribe, block_fetcher fetch_block)
+    : subscribe_(std::move(subscribe))
+    , fetch_block_(std::move(fetch_block))
+    , stopped_(true)
+    , ready_(false)
+    , building_(false)
+    , next_height_(0)
+    , tip_hash_(libbitcoin::null_hash)
+{}
+
+address_index::~address_index() {
+    stop();
+}
+
+void address_index::start() {
+    if (loader_.joinable()) {
+        return;
+    }
+
+    stopped_ = false;
+
+    // Subscribe first, blocks arriving while building are either applied
+    // here (when they extend the index) or fetched later by the loader.
+    subscribe_([this](libbitcoin::code ec, size_t fork_height,
+                                       libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                       libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+        return handle_reorganize(ec, fork_height, incoming, outgoing);
+    });
+
+    {
+        unique_lock lock(mutex_);
+        building_ = true;
+    }
+    loader_ = std::thread([this]() {
+        load();
+    });
+}
+
+void address_index::stop() {
+    stopped_ = true;
+    if (loader_.joinable()) {
+        {
+            unique_lock lock(mutex_);
+        }
+        wake_.notify_all();
+        loader_.join();
+    }
+}
+
+bool address_index::ready() const {
+    return ready_;
+}
+
+// Queries.
+//-----------------------------------------------------------------------------
+
+bool address_index::balance(libbitcoin::short_hash const& address, uint64_t& out_balance, uint64_t& out_received) const {
+    shared_lock lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+
+    out_balance = 0;
+    out_received = 0;
+    auto const it = addresses_.find(address);
+    if (it != addresses_.end()) {
+        out_balance = it->second.balance;
+        out_received = it->second.received;
+    }
+    return true;
+}
+
+bool address_index::unspent(libbitcoin::short_hash const& address, std::vector<utxo>& out_utxos) const {
+    shared_lock lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+
+    auto const it = addresses_.find(address);
+    if (it == addresses_.end()) {
+        return true;
+    }
+
+    out_utxos.reserve(out_utxos.size() + it->second.unspent.size());
+    auto const first = out_utxos.size();
+    for (auto const& point : it->second.unspent) {
+        auto const& output = outputs_.at(point);
+        out_utxos.push_back(utxo{point, output.value, output.height, output.script});
+    }
+
+    std::sort(out_utxos.begin() + first, out_utxos.end(), [](utxo const& a, utxo const& b) {
+        return a.height != b.height ? a.height < b.height : a.point < b.point;
+    });
+    return true;
+}
+
+bool address_index::deltas(libbitcoin::short_hash const& address, size_t start_height, size_t end_height, std::vector<delta>& out_deltas) const {
+    shared_lock lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+
+    auto const it = addresses_.find(address);
+    if (it == addresses_.end()) {
+        return true;
+    }
+
+    // Deltas are appended block by block, so they are sorted by height.
+    auto const& list = it->second.deltas;
+    auto first = std::lower_bound(list.begin(), list.end(), start_height, [](delta const& entry, size_t height) {
+        return entry.height < height;
+    });
+    for (; first != list.end() && first->height <= end_height; ++first) {
+        out_deltas.push_back(*first);
+    }
+    return true;
+}
+
+bool address_index::top(size_t& out_height, libbitcoin::hash_digest& out_hash) const {
+    shared_lock lock(mutex_);
+    if (!ready_ || next_height_ == 0) {
+        return false;
+    }
+
+    out_height = next_height_ - 1;
+    out_hash = tip_hash_;
+    return true;
+}
+
+// Feeding.
+//-----------------------------------------------------------------------------
+
+// Builds the index, and builds it again whenever a reorganization deeper
+// than the undo records resets it.
+void address_index::load() {
+    while (true) {
+        {
+            unique_lock lock(mutex_);
+            wake_.wait(lock, [this]() {
+                return stopped_ || building_;
+            });
+            if (stopped_) {
+                return;
+            }
+        }
+        build();
+    }
+}
+
+void address_index::build() {
+    while (!stopped_) {
+        size_t height;
+        {
+            shared_lock lock(mutex_);
+            height = next_height_;
+        }
+
+        libbitcoin::code ec;
+        libbitcoin::block_const_ptr block;
+        if (!read_block(height, ec, block)) {
+            return;
+        }
+
+        unique_lock lock(mutex_);
+        if (ec) {
+            // Past the top of the chain the index only follows the subscription.
+            ready_ = ec == libbitcoin::error::not_found;
+            building_ = false;
+            return;
+        }
+
+        // A reorganization may have moved the index while the block was read.
+        if (height == next_height_ && (height == 0 || block->header().previous_block_hash() == tip_hash_)) {
+            apply(*block, height);
+        }
+    }
+}
+
+// The fetch may complete inline or on another thread, the loader waits
+// for it either way. Fails when the index is stopped meanwhile.
+bool address_index::read_block(size_t height, libbitcoin::code& out_ec, libbitcoin::block_const_ptr& out_block) const {
+    struct result {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool completed = false;
+        libbitcoin::code ec;
+        libbitcoin::block_const_ptr block;
+    };
+
+    auto const fetched = std::make_shared<result>();
+    fetch_block_(height, [fetched](libbitcoin::code const& ec, libbitcoin::block_const_ptr block, size_t /*height*/) {
+        {
+            std::lock_guard<std::mutex> lock(fetched->mutex);
+            fetched->ec = ec;
+            fetched->block = std::move(block);
+            fetched->completed = true;
+        }
+        fetched->done.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(fetched->mutex);
+    while (!fetched->completed) {
+        if (stopped_) {
+            return false;
+        }
+        fetched->done.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    out_ec = fetched->ec;
+    out_block = fetched->block;
+    return true;
+}
+
+bool address_index::handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                                      libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                      libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+    if (stopped_ || ec == libbitcoin::error::service_stopped) {
+        return false;
+    }
+
+    if (ec || !incoming || incoming->empty()) {
+        return true;
+    }
+
+    auto rebuild = false;
+    {
+        unique_lock lock(mutex_);
+
+        // Drop the blocks of the branch being replaced.
+        while (next_height_ > fork_height + 1) {
+            if (undo_.empty()) {
+                reset();
+                break;
+            }
+            undo();
+        }
+
+        auto height = fork_height + 1;
+        for (auto const& block : *incoming) {
+            if (height == next_height_ && (height == 0 || block->header().previous_block_hash() == tip_hash_)) {
+                apply(*block, height);
+            }
+            ++height;
+        }
+
+        // The loader walks the chain again.
+        if (!ready_ && !building_) {
+            building_ = true;
+            rebuild = true;
+        }
+    }
+
+    if (rebuild) {
+        wake_.notify_all();
+    }
+    return true;
+}
+
+void address_index::apply(libbitcoin::chain::block const& block, size_t height) {
+    block_undo record;
+    record.previous = block.header().previous_block_hash();
+
+    size_t position = 0;
+    for (auto const& tx : block.transactions()) {
+        auto const tx_hash = tx.hash();
+
+        if (!tx.is_coinbase()) {
+            uint32_t input_index = 0;
+            for (auto const& input : tx.inputs()) {
+                auto const it = outputs_.find(input.previous_output());
+                if (it != outputs_.end()) {
+                    auto& address = addresses_[it->second.address];
+                    address.balance -= it->second.value;
+                    address.unspent.erase(it->first);
+                    address.deltas.push_back(delta{tx_hash, input_index, height, position, -static_cast<int64_t>(it->second.value)});
+                    record.touched.push_back(it->second.address);
+                    record.spent.emplace_back(it->first, std::move(it->second));
+                    outputs_.erase(it);
+                }
+                ++input_index;
+            }
+        }
+
+        uint32_t output_index = 0;
+        for (auto const& output : tx.outputs()) {
+            auto const payment_address = output.address();
+            if (payment_address) {
+                libbitcoin::chain::output_point const point(tx_hash, output_index);
+                auto& address = addresses_[payment_address.hash()];
+                address.balance += output.value();
+                address.received += output.value();
+                address.unspent.insert(point);
+                address.deltas.push_back(delta{tx_hash, output_index, height, position, static_cast<int64_t>(output.value())});
+                outputs_[point] = output_record{payment_address.hash(), output.value(), height, output.script().to_data(false)};
+                record.touched.push_back(payment_address.hash());
+                record.created.push_back(point);
+            }
+            ++output_index;
+        }
+        ++position;
+    }
+
+    tip_hash_ = block.hash();
+    next_height_ = height + 1;
+    undo_.push_back(std::move(record));
+    if (undo_.size() > undo_depth) {
+        undo_.pop_front();
+    }
+}
+
+void address_index::undo() {
+    auto& record = undo_.back();
+    auto const height = next_height_ - 1;
+
+    // Restore the spent outputs first, some of them may have been created
+    // by this same block and are removed right after.
+    for (auto it = record.spent.rbegin(); it != record.spent.rend(); ++it) {
+        auto& address = addresses_[it->second.address];
+        address.balance += it->second.value;
+        address.unspent.insert(it->first);
+        outputs_.emplace(it->first, std::move(it->second));
+    }
+
+    for (auto it = record.created.rbegin(); it != record.created.rend(); ++it) {
+        auto const found = outputs_.find(*it);
+        if (found == outputs_.end()) {
+            continue;
+        }
+        auto& address = addresses_[found->second.address];
+        address.balance -= found->second.value;
+        address.received -= found->second.value;
+        address.unspent.erase(*it);
+        outputs_.erase(found);
+    }
+
+    for (auto const& hash : record.touched) {
+        auto const found = addresses_.find(hash);
+        if (found == addresses_.end()) {
+            continue;
+        }
+        auto& deltas = found->second.deltas;
+        while (!deltas.empty() && deltas.back().height == height) {
+            deltas.pop_back();
+        }
+        if (deltas.empty()) {
+            addresses_.erase(found);
+        }
+    }
+
+    tip_hash_ = record.previous;
+    next_height_ = height;
+    undo_.pop_back();
+}
+
+void address_index::reset() {
+    ready_ = false;
+    next_height_ = 0;
+    tip_hash_ = libbitcoin::null_hash;
+    undo_.clear();
+    outputs_.clear();
+    addresses_.clear();
+}
+
+}} // namespace bitprim::rpc
@@ -0,0 +1,256 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/index/header_index.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+namespace bitprim { namespace rpc {
+
+using unique_lock = boost::unique_lock<boost::shared_mutex>;
+using shared_lock = boost::shared_lock<boost::shared_mutex>;
+
+namespace {
+
+// Median time past window. A block is later than the median of the
+// previous window, so once that median passes a time no later block
+// can be earlier.
+constexpr size_t median_window = 11;
+
+libbitcoin::uint256_t to_number(header_index::work const& work) {
+    libbitcoin::uint256_t number;
+    boost::multiprecision::import_bits(number, work.begin(), work.end());
+    return number;
+}
+
+header_index::work to_work(libbitcoin::uint256_t const& number) {
+    std::vector<uint8_t> bytes;
+    boost::multiprecision::export_bits(number, std::back_inserter(bytes), 8);
+    header_index::work work{};
+    std::copy(bytes.begin(), bytes.end(), work.end() - bytes.size());
+    return work;
+}
+
+} // namespace
+
+header_index::header_index(libbitcoin::blockchain::block_chain& chain)
+    : header_index([&chain](libbitcoin::blockchain::safe_chain::reorganize_handler handler) {
+                       chain.subscribe_blockchain(std::move(handler));
+                   },
+                   [&chain](libbitcoin::chain::header& out_header, size_t height) {
+                       return chain.get_header(out_header, height);
+                   })
+{}
+
+header_index::header_index(subscriber subscribe, header_reader read_header)
+    : subscribe_(std::move(subscribe))
+    , read_header_(std::move(read_header))
+    , stopped_(true)
+    , ready_(false)
+{}
+
+header_index::~header_index() {
+    stop();
+}
+
+void header_index::start() {
+    if (loader_.joinable()) {
+        return;
+    }
+
+    stopped_ = false;
+
+    // Subscribe first, blocks arriving while loading are either applied
+    // here (when they extend the index) or read later by the loader.
+    subscribe_([this](libbitcoin::code ec, size_t fork_height,
+                                       libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                       libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+        return handle_reorganize(ec, fork_height, incoming, outgoing);
+    });
+
+    loader_ = std::thread([this]() {
+        load();
+    });
+}
+
+void header_index::stop() {
+    stopped_ = true;
+    if (loader_.joinable()) {
+        loader_.join();
+    }
+}
+
+bool header_index::ready() const {
+    return ready_;
+}
+
+// Queries.
+//-----------------------------------------------------------------------------
+
+bool header_index::blocks(uint32_t low, uint32_t high, std::vector<entry>& out_blocks) const {
+    shared_lock lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+
+    out_blocks.clear();
+
+    // Every block before the first one reaching low is earlier than low.
+    auto const first = std::lower_bound(max_timestamps_.begin(), max_timestamps_.end(), low) - max_timestamps_.begin();
+
+    // Scan until the median of the last blocks is past high: blocks above
+    // high in the window, those before the first height are all below low.
+    size_t later = 0;
+    for (size_t height = first; height < entries_.size(); ++height) {
+        auto const timestamp = entries_[height].timestamp;
+        if (timestamp >= low && timestamp <= high) {
+            out_blocks.push_back(entries_[height]);
+        }
+
+        later += timestamp > high ? 1 : 0;
+        if (height >= first + median_window) {
+            later -= entries_[height - median_window].timestamp > high ? 1 : 0;
+        }
+        if (later > median_window / 2) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool header_index::find(size_t height, libbitcoin::hash_digest const& hash, record& out_record) const {
+    shared_lock lock(mutex_);
+    if (!ready_ || height >= entries_.size() || entries_[height].hash != hash) {
+        return false;
+    }
+
+    out_record.hash = hash;
+    out_record.has_next = height + 1 < entries_.size();
+    out_record.next_hash = out_record.has_next ? entries_[height + 1].hash : libbitcoin::null_hash;
+    out_record.median_time = median_times_[height];
+    out_record.chainwork = chainwork_[height];
+    out_record.top_height = entries_.size() - 1;
+    return true;
+}
+
+bool header_index::top(size_t& out_height, libbitcoin::hash_digest& out_hash) const {
+    shared_lock lock(mutex_);
+    if (!ready_ || entries_.empty()) {
+        return false;
+    }
+
+    out_height = entries_.size() - 1;
+    out_hash = entries_.back().hash;
+    return true;
+}
+
+// Feeding.
+//-----------------------------------------------------------------------------
+
+void header_index::load() {
+    libbitcoin::chain::header header;
+    while (!stopped_) {
+        size_t height;
+        {
+            shared_lock lock(mutex_);
+            height = entries_.size();
+        }
+
+        // Past the top of the chain the index only follows the subscription.
+        if (!read_header_(header, height)) {
+            ready_ = true;
+            return;
+        }
+
+        unique_lock lock(mutex_);
+
+        // The subscription may have moved the index while the header was read.
+        if (entries_.size() != height) {
+            continue;
+        }
+
+        // A reorganization replaced the previous block, read it again.
+        if (!append(header)) {
+            truncate(height - 1);
+        }
+    }
+}
+
+bool header_index::handle_reorganize(libbitcoin::code ec, size_t fork_height,
+                                     libbitcoin::block_const_ptr_list_const_ptr incoming,
+                                     libbitcoin::block_const_ptr_list_const_ptr outgoing) {
+    if (stopped_ || ec == libbitcoin::error::service_stopped) {
+        return false;
+    }
+
+    if (ec || !incoming || incoming->empty()) {
+        return true;
+    }
+
+    unique_lock lock(mutex_);
+
+    // Still loading below the fork, the loader reads these blocks itself.
+    if (entries_.size() <= fork_height) {
+        return true;
+    }
+
+    truncate(fork_height + 1);
+    for (auto const& block : *incoming) {
+        if (!append(block->header())) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool header_index::append(libbitcoin::chain::header const& header) {
+    if (!entries_.empty() && header.previous_block_hash() != entries_.back().hash) {
+        return false;
+    }
+
+    auto const timestamp = header.timestamp();
+    entries_.push_back(entry{timestamp, header.hash()});
+    max_timestamps_.push_back(max_timestamps_.empty() ? timestamp : std::max(max_timestamps_.back(), timestamp));
+
+    // Median of the timestamps of the block and the ones before it.
+    uint32_t window[median_window];
+    auto const count = std::min(entries_.size(), median_window);
+    for (size_t i = 0; i < count; ++i) {
+        window[i] = entries_[entries_.size() - count + i].timestamp;
+    }
+    std::sort(window, window + count);
+    median_times_.push_back(window[count / 2]);
+
+    auto const work = header.proof();
+    chainwork_.push_back(to_work(chainwork_.empty() ? work : to_number(chainwork_.back()) + work));
+    return true;
+}
+
+void header_index::truncate(size_t height) {
+    if (height < entries_.size()) {
+        entries_.resize(height);
+        max_timestamps_.resize(height);
+        median_times_.resize(height);
+        chainwork_.resize(height);
+    }
+}
+
+}} // namespace bitprim::rpc
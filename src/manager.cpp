@@ -22,14 +22,52 @@
 
 namespace bitprim { namespace rpc {
 
+namespace {
+
+message_context make_context(address_index const* addresses, header_index const* headers, response_cache* cache,
+                             output_cache* outputs, admission_control* admission, request_coalescer* coalescer, worker_pool* workers) {
+    message_context context;
+    context.addresses = addresses;
+    context.headers = headers;
+    context.cache = cache;
+    context.outputs = outputs;
+    context.admission = admission;
+    context.coalescer = coalescer;
+    context.dispatch = [workers](std::function<void()> work) {
+        workers->post(std::move(work));
+    };
+    return context;
+}
+
+// No admission control when no class is bounded.
+admission_control* make_admission(settings const& config) {
+    if (config.standard_concurrency == 0 && config.expensive_concurrency == 0) {
+        return nullptr;
+    }
+    return new admission_control({config.standard_concurrency, config.standard_queue_size},
+                                 {config.expensive_concurrency, config.expensive_queue_size});
+}
+
+} // namespace
+
 manager::manager(bool use_testnet_rules
         , std::shared_ptr<libbitcoin::node::full_node> & node
         , uint32_t rpc_port
         , uint32_t subscriber_port
-        , const std::unordered_set<std::string> & rpc_allowed_ips)
+        , const std::unordered_set<std::string> & rpc_allowed_ips
+        , settings const& config)
    : stopped_(false)
-   , zmq_(subscriber_port, node->chain_bitprim())
-   , http_(use_testnet_rules, node, rpc_port, rpc_allowed_ips)
+   , chain_(node->chain_bitprim())
+   , zmq_(subscriber_port, chain_, config)
+   , address_index_(config.address_index ? new address_index(chain_) : nullptr)
+   , header_index_(config.header_index ? new header_index(chain_) : nullptr)
+   , response_cache_(config.response_cache_size != 0 ? new response_cache(size_t(config.response_cache_size) << 20) : nullptr)
+   , output_cache_(config.output_cache_size != 0 ? new output_cache(config.output_cache_size) : nullptr)
+   , admission_(make_admission(config))
+   , coalescer_(config.coalesce_requests ? new request_coalescer() : nullptr)
+   , workers_(config.worker_threads, config.pin_threads)
+   , http_(use_testnet_rules, node, rpc_port, rpc_allowed_ips, config, make_context(address_index_.get(), header_index_.get(), response_cache_.get(), output_cache_.get(), admission_.get(), coalescer_.get(), &workers_))
+   , zmq_rpc_(config.zmq_rpc_endpoint.empty() ? nullptr : new zmq_rpc_server(use_testnet_rules, node, config.zmq_rpc_endpoint, rpc_allowed_ips, config, make_context(address_index_.get(), header_index_.get(), response_cache_.get(), output_cache_.get(), admission_.get(), coalescer_.get(), &workers_)))
 {}
 
 manager::~manager() {
@@ -38,7 +76,24 @@ manager::~manager() {
 
 void manager::start() {
    stopped_ = false;
+   if (address_index_) {
+       address_index_->start();
+   }
+   if (header_index_) {
+       header_index_->start();
+   }
+   if (response_cache_) {
+       response_cache_->start(chain_);
+   }
+   if (coalescer_) {
+       coalescer_->start(chain_);
+   }
    zmq_.start();
+   workers_.start();
+   if (zmq_rpc_) {
+       zmq_rpc_->start();
+   }
+   // Serves on the calling thread until stop(), so it goes last.
    http_.start();
 }
 
@@ -46,6 +101,23 @@ void manager::stop() {
    if (!stopped_) {
        zmq_.close();
        http_.stop();
+       if (zmq_rpc_) {
+           zmq_rpc_->stop();
+       }
+       // Requests still running finish before the indexes and caches stop.
+       workers_.stop();
+       if (address_index_) {
+           address_index_->stop();
+       }
+       if (header_index_) {
+           header_index_->stop();
+       }
+       if (response_cache_) {
+           response_cache_->stop();
+       }
+       if (coalescer_) {
+           coalescer_->stop();
+       }
    }
    stopped_ = true;
 }
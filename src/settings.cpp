@@ -0,0 +1,54 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/settings.hpp>
+
+namespace bitprim { namespace rpc {
+
+settings::settings()
+    : io_threads(1)
+    , http_idle_timeout(30)
+    , http_max_requests(1000)
+    , http_max_pipelined(16)
+    , compression_level(6)
+    , compression_threshold(1024)
+    , compression_cache_size(16)
+    , worker_threads(0)
+    , pin_threads(false)
+    , batch_parallelism(16)
+    , max_batch_size(1000)
+    , expensive_concurrency(4)
+    , expensive_queue_size(64)
+    , standard_concurrency(0)
+    , standard_queue_size(1024)
+    , address_index(false)
+    , header_index(true)
+    , response_cache_size(64)
+    , output_cache_size(65536)
+    , coalesce_requests(true)
+    , zmq_queue_size(4096)
+    , zmq_block_when_full(false)
+    , zmq_pending_size(1000)
+    , zmq_pending_bytes(4 * 1024 * 1024)
+    , zmq_pending_age(60)
+    , zmq_pending_raw(false)
+{}
+
+}} // namespace bitprim::rpc
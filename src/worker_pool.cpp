@@ -0,0 +1,91 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/worker_pool.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace bitprim { namespace rpc {
+
+namespace {
+
+size_t hardware_threads() {
+    auto const count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+} // namespace
+
+worker_pool::worker_pool(size_t threads, bool pin_threads)
+    : size_(threads == 0 ? hardware_threads() : threads)
+    , pin_threads_(pin_threads)
+{}
+
+worker_pool::~worker_pool() {
+    stop();
+}
+
+void worker_pool::start() {
+    if (!threads_.empty()) {
+        return;
+    }
+
+    if (service_.stopped()) {
+        service_.reset();
+    }
+
+    work_.reset(new boost::asio::io_service::work(service_));
+    for (size_t i = 0; i < size_; ++i) {
+        threads_.emplace_back([this]() {
+            service_.run();
+        });
+        if (pin_threads_) {
+            pin(threads_.back(), i);
+        }
+    }
+}
+
+void worker_pool::stop() {
+    work_.reset();
+    service_.stop();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+}
+
+size_t worker_pool::size() const {
+    return size_;
+}
+
+void worker_pool::pin(std::thread& thread, size_t index) const {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(index % hardware_threads(), &cpu_set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpu_set);
+#endif
+}
+
+}} // namespace bitprim::rpc
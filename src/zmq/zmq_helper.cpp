@@ -20,36 +20,146 @@
 
 #include <bitprim/rpc/zmq/zmq_helper.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <set>
+
 namespace bitprim { namespace rpc {
 
-zmq::zmq(uint32_t subscriber_port, libbitcoin::blockchain::block_chain & chain) :
-        nSequence(0),
-        chain_(chain){
-    std::string str_port = "tcp://*:" + std::to_string (subscriber_port);
+namespace {
+
+// Largest queue a fixed size lock-free queue can hold.
+constexpr size_t max_queue_size = 65534;
+
+// How often an idle publisher thread looks for new subscriptions.
+constexpr auto subscription_poll = std::chrono::milliseconds(100);
+
+// Drops the reference a message body holds on its buffer once zmq is done with it.
+void release_chunk(void* /*data*/, void* hint) {
+    delete static_cast<std::shared_ptr<libbitcoin::data_chunk const>*>(hint);
+}
+
+} // namespace
+
+zmq::zmq(uint32_t subscriber_port, libbitcoin::blockchain::block_chain & chain, settings const& config) :
+        chain_(chain),
+        block_when_full_(config.zmq_block_when_full),
+        stopped_(false),
+        queue_(std::max<size_t>(1, std::min<size_t>(config.zmq_queue_size, max_queue_size))),
+        published_(0),
+        dropped_(0),
+        failed_(0) {
+    static char const* const commands[topic_count] = {"hashblock", "hashtx", "rawblock", "rawtx", "blockdisconnect"};
+
+    // Blocks and their transactions only wait for subscribers when asked to.
+    zmq_topic::limits const kept{config.zmq_pending_size, config.zmq_pending_bytes, std::chrono::seconds(config.zmq_pending_age)};
+    zmq_topic::limits const none{0, 0, std::chrono::seconds(0)};
+
+    sockets_.fill(nullptr);
+    topics_.reserve(topic_count);
+    for (size_t id = 0; id < topic_count; ++id) {
+        auto const raw = id == rawblock || id == rawtx;
+        topics_.emplace_back(commands[id], raw && !config.zmq_pending_raw ? none : kept, [this, id](zmq_topic::message const& message, uint32_t sequence) {
+            return transmit(topic_id(id), message, sequence);
+        });
+    }
+
     context_ = zmq_init(1);
     if (context_) {
-        publisher_ =  zmq_socket(context_,ZMQ_PUB);
-        zmq_bind(publisher_, str_port.c_str());
-        // If there is no sleep and a message is sent before 1 second, the publisher will not publish the message
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        bind(config, subscriber_port);
     }
 }
 
+// One socket per distinct endpoint, shared by the topics published there.
+void zmq::bind(settings const& config, uint32_t subscriber_port) {
+    std::string const shared = "tcp://*:" + std::to_string(subscriber_port);
+    std::string const addresses[topic_count] = {
+        config.zmq_hashblock_endpoint,
+        config.zmq_hashtx_endpoint,
+        config.zmq_rawblock_endpoint,
+        config.zmq_rawtx_endpoint,
+        config.zmq_blockdisconnect_endpoint
+    };
+
+    std::vector<std::string> bound;
+    for (size_t id = 0; id < topic_count; ++id) {
+        if (addresses[id] == "none") {
+            continue;
+        }
+
+        auto const address = addresses[id].empty() ? shared : addresses[id];
+        auto const it = std::find(bound.begin(), bound.end(), address);
+        if (it != bound.end()) {
+            sockets_[id] = endpoints_[it - bound.begin()].socket;
+            continue;
+        }
+
+        auto socket = zmq_socket(context_, ZMQ_XPUB);
+        if (socket == nullptr) {
+            continue;
+        }
+        if (zmq_bind(socket, address.c_str()) != 0) {
+            zmq_close(socket);
+            continue;
+        }
+
+        bound.push_back(address);
+        endpoints_.push_back(endpoint{socket, {}});
+        sockets_[id] = socket;
+    }
+}
+
+bool zmq::enabled(topic_id id) const {
+    return sockets_[id] != nullptr;
+}
+
 zmq::~zmq(){
     close();
 }
 
 void zmq::close(){
+    stopped_ = true;
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        queued_.notify_all();
+        dequeued_.notify_all();
+        thread_.join();
+    }
+
+    publication* item;
+    while (queue_.pop(item)) {
+        delete item;
+    }
+
     if (context_) {
         int linger = 0;
-        zmq_setsockopt(publisher_, ZMQ_LINGER, &linger, sizeof(linger));
-        zmq_close(publisher_);
+        for (auto const& endpoint : endpoints_) {
+            zmq_setsockopt(endpoint.socket, ZMQ_LINGER, &linger, sizeof(linger));
+            zmq_close(endpoint.socket);
+        }
+        endpoints_.clear();
+        sockets_.fill(nullptr);
+        for (auto& topic : topics_) {
+            topic.clear();
+        }
         zmq_ctx_destroy(context_);
         context_ = 0;
     }
 }
 
 void zmq::start(){
+    if (!context_ || endpoints_.empty() || thread_.joinable()) {
+        return;
+    }
+
+    // The socket is only used from this thread from now on.
+    thread_ = std::thread([this]() {
+        publish();
+    });
+
     // Only send messages when the chain is not stale
     if (!chain_.is_stale()){
         start_sending_messages();
@@ -72,109 +182,347 @@ void zmq::start_sending_messages(){
     chain_.subscribe_blockchain([&](libbitcoin::code ec, size_t height,
                                     libbitcoin::block_const_ptr_list_const_ptr incoming,
                                     libbitcoin::block_const_ptr_list_const_ptr outgoing) {
-                                    if (context_){
+                                    if (!stopped_){
                                         return send_hash_block_handler(ec, height, incoming, outgoing);
                                     } else {
-                                        // There is no context, the zmq was closed, so it unsubscribes
+                                        // The zmq was closed, so it unsubscribes
                                         return false;
                                     }
                                 }
     );
     chain_.subscribe_transaction([&](libbitcoin::code ec, libbitcoin::transaction_const_ptr tx) {
-        if (context_){
+        if (!stopped_){
             return send_raw_transaction_handler(ec, tx);
         } else {
-            // There is no context, the zmq was closed, so it unsubscribes
+            // The zmq was closed, so it unsubscribes
             return false;
         }
     });
 }
 
-static int zmq_send_multipart(void *sock, const void *data, size_t size, ...) {
-    va_list args;
-    va_start(args, size);
+zmq::counters zmq::statistics() const {
+    return counters{published_, dropped_, failed_};
+}
+
+// Publisher thread.
+//-----------------------------------------------------------------------------
+
+// A full queue either drops the publication or holds the notifying
+// thread (and so the blockchain) until the publisher catches up.
+bool zmq::enqueue(publication* item) {
+    while (!queue_.bounded_push(item)) {
+        if (!block_when_full_ || stopped_) {
+            ++dropped_;
+            delete item;
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        dequeued_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    queued_.notify_one();
+    return true;
+}
 
+void zmq::publish() {
+    publication* item;
     while (true) {
-        zmq_msg_t msg;
+        receive_subscriptions();
 
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0) {
-            return -1;
+        if (queue_.pop(item)) {
+            if (block_when_full_) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                }
+                dequeued_.notify_all();
+            }
+
+            std::unique_ptr<publication> owned(item);
+            publish(*owned);
+            continue;
         }
 
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
+        expire_pending();
 
-        data = va_arg(args, const void *);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        queued_.wait_for(lock, subscription_poll, [this]() {
+            return stopped_ || !queue_.empty();
+        });
+    }
+}
+
+void zmq::publish(publication& item) {
+    if (item.outgoing) {
+        publish_disconnect(item.fork_height, *item.outgoing, item.incoming.get());
+        return;
+    }
+
+    if (item.block) {
+        publish_block(*item.block);
+        return;
+    }
+
+    if (item.transaction) {
+        publish_transaction(*item.transaction);
+        return;
+    }
+
+    auto const size = item.data.size();
+    send(item.topic, std::make_shared<libbitcoin::data_chunk const>(std::move(item.data)), 0, size);
+}
 
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1) {
-            zmq_msg_close(&msg);
-            return -1;
+namespace {
+
+size_t variable_size(uint64_t value) {
+    return value < 0xfd ? 1 : value <= 0xffff ? 3 : value <= 0xffffffff ? 5 : 9;
+}
+
+} // namespace
+
+// The block is serialized once; rawblock sends the whole buffer and every
+// rawtx the slice holding its transaction, all sharing that buffer.
+void zmq::publish_block(libbitcoin::message::block const& block) {
+    auto const& transactions = block.transactions();
+
+    shared_chunk buffer;
+    std::vector<size_t> offsets;
+    if (enabled(rawblock) || enabled(rawtx)) {
+        buffer = std::make_shared<libbitcoin::data_chunk const>(block.to_data(1));
+
+        // Header, transaction count and then the transactions back to back.
+        size_t offset = 80 + variable_size(transactions.size());
+        offsets.reserve(transactions.size() + 1);
+        for (auto const& tx : transactions) {
+            offsets.push_back(offset);
+            offset += tx.serialized_size(true);
         }
+        offsets.push_back(offset);
 
-        zmq_msg_close(&msg);
+        if (offset != buffer->size()) {
+            offsets.clear();
+        }
+    }
 
-        if (!data) break;
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        auto const& tx = transactions[i];
+        if (enabled(hashtx)) {
+            send_hash(hashtx, tx.hash());
+        }
+        if (enabled(rawtx)) {
+            if (!offsets.empty()) {
+                send(rawtx, buffer, offsets[i], offsets[i + 1] - offsets[i]);
+            } else {
+                auto data = std::make_shared<libbitcoin::data_chunk const>(tx.to_data(1));
+                send(rawtx, data, 0, data->size());
+            }
+        }
+    }
 
-        size = va_arg(args, size_t);
+    if (enabled(hashblock)) {
+        send_hash(hashblock, block.hash());
+    }
+    if (enabled(rawblock)) {
+        send(rawblock, buffer, 0, buffer->size());
     }
-    return 0;
 }
 
-bool zmq::send_message(const char *command, const void *data, size_t size) {
+void zmq::publish_transaction(libbitcoin::chain::transaction const& transaction) {
+    if (enabled(hashtx)) {
+        send_hash(hashtx, transaction.hash());
+    }
+    if (enabled(rawtx)) {
+        auto data = std::make_shared<libbitcoin::data_chunk const>(transaction.to_data(1, false));
+        send(rawtx, data, 0, data->size());
+    }
+}
+
+// Outgoing blocks are ordered by height from fork_height + 1. Their
+// transactions that the incoming blocks do not confirm go back to the
+// mempool, coinbases aside, and are announced again.
+void zmq::publish_disconnect(size_t fork_height, libbitcoin::block_const_ptr_list const& outgoing,
+                             libbitcoin::block_const_ptr_list const* incoming) {
+    if (enabled(blockdisconnect)) {
+        for (auto& body : block_disconnect_bodies(fork_height, outgoing)) {
+            auto const size = body.size();
+            send(blockdisconnect, std::make_shared<libbitcoin::data_chunk const>(std::move(body)), 0, size);
+        }
+    }
+
+    if (!enabled(hashtx) && !enabled(rawtx)) {
+        return;
+    }
+
+    std::set<libbitcoin::hash_digest> confirmed;
+    if (incoming) {
+        for (auto const& block : *incoming) {
+            for (auto const& tx : block->transactions()) {
+                confirmed.insert(tx.hash());
+            }
+        }
+    }
+
+    for (auto const& block : outgoing) {
+        for (auto const& tx : block->transactions()) {
+            if (!tx.is_coinbase() && confirmed.count(tx.hash()) == 0) {
+                publish_transaction(tx);
+            }
+        }
+    }
+}
+
+// Hashes go out in display order, as bitcoind sends them.
+bool zmq::send_hash(topic_id id, libbitcoin::hash_digest const& hash) {
+    auto data = std::make_shared<libbitcoin::data_chunk const>(hash.rbegin(), hash.rend());
+    return send(id, data, 0, data->size());
+}
+
+// Until the topic has a subscriber the message waits in its pending list.
+bool zmq::send(topic_id id, shared_chunk const& buffer, size_t offset, size_t size) {
+    if (!enabled(id)) {
+        return false;
+    }
+
+    dropped_ += topics_[id].send(buffer, offset, size);
+    return true;
+}
+
+bool zmq::transmit(topic_id id, zmq_topic::message const& message, uint32_t sequence_number) {
     /* send three parts, command & data & a LE 4byte sequence number */
-    uint8_t msgseq[sizeof(uint32_t)];
-    auto temp_msgseq = libbitcoin::to_little_endian(nSequence);
-    std::copy(temp_msgseq.begin(), temp_msgseq.end(), msgseq);
+    auto const& topic = topics_[id];
+    auto const socket = sockets_[id];
+    auto const sequence = libbitcoin::to_little_endian(sequence_number);
 
-    int rc = zmq_send_multipart(publisher_, command, strlen(command), data, size,
-                                msgseq, (size_t) sizeof(uint32_t), (void *) 0);
-    if (rc == -1) return false;
+    // The command is static and the body stays in the shared buffer, which
+    // zmq releases once written: neither is copied.
+    zmq_msg_t parts[3];
+    zmq_msg_init_data(&parts[0], const_cast<char*>(topic.command()), strlen(topic.command()), nullptr, nullptr);
+    zmq_msg_init_data(&parts[1], const_cast<uint8_t*>(message.buffer->data()) + message.offset, message.size, release_chunk, new shared_chunk(message.buffer));
+    zmq_msg_init_size(&parts[2], sequence.size());
+    std::copy(sequence.begin(), sequence.end(), static_cast<uint8_t*>(zmq_msg_data(&parts[2])));
 
-    /* increment memory only sequence number after sending */
-    nSequence++;
+    size_t sent = 0;
+    for (; sent < 3; ++sent) {
+        if (zmq_msg_send(&parts[sent], socket, sent < 2 ? ZMQ_SNDMORE : 0) == -1) {
+            break;
+        }
+    }
 
+    // Parts not sent still own their data.
+    for (auto part = sent; part < 3; ++part) {
+        zmq_msg_close(&parts[part]);
+    }
+
+    if (sent != 3) {
+        ++failed_;
+        return false;
+    }
+
+    ++published_;
     return true;
 }
 
+// XPUB forwards the first subscription to a prefix (first byte 1) and
+// the unsubscription of its last subscriber (first byte 0). A topic is
+// subscribed while some prefix of its command is; its pending messages
+// are sent as soon as it becomes so.
+void zmq::receive_subscriptions() {
+    for (auto& endpoint : endpoints_) {
+        bool changed = false;
+        zmq_msg_t message;
+        zmq_msg_init(&message);
+        while (zmq_msg_recv(&message, endpoint.socket, ZMQ_DONTWAIT) != -1) {
+            auto const data = static_cast<char const*>(zmq_msg_data(&message));
+            auto const size = zmq_msg_size(&message);
+            if (size == 0 || (data[0] != 0 && data[0] != 1)) {
+                continue;
+            }
+
+            std::string prefix(data + 1, size - 1);
+            auto const it = std::find(endpoint.subscriptions.begin(), endpoint.subscriptions.end(), prefix);
+            if (data[0] == 1 && it == endpoint.subscriptions.end()) {
+                endpoint.subscriptions.push_back(std::move(prefix));
+                changed = true;
+            } else if (data[0] == 0 && it != endpoint.subscriptions.end()) {
+                endpoint.subscriptions.erase(it);
+                changed = true;
+            }
+        }
+        zmq_msg_close(&message);
+
+        if (!changed) {
+            continue;
+        }
+
+        for (size_t id = 0; id < topic_count; ++id) {
+            if (sockets_[id] != endpoint.socket) {
+                continue;
+            }
+
+            auto const command = topics_[id].command();
+            auto const subscribed = std::any_of(endpoint.subscriptions.begin(), endpoint.subscriptions.end(), [command](std::string const& prefix) {
+                return prefix.size() <= strlen(command) && strncmp(command, prefix.data(), prefix.size()) == 0;
+            });
+            dropped_ += topics_[id].subscribe(subscribed);
+        }
+    }
+}
+
+// Old pending messages go even when nothing new is published.
+void zmq::expire_pending() {
+    auto const now = zmq_topic::clock::now();
+    for (size_t id = 0; id < topic_count; ++id) {
+        if (enabled(topic_id(id))) {
+            dropped_ += topics_[id].expire(now);
+        }
+    }
+}
+
+// Notification threads.
+//-----------------------------------------------------------------------------
+
+bool zmq::send_message(const char *command, const void *data, size_t size) {
+    for (size_t id = 0; id < topic_count; ++id) {
+        if (strcmp(command, topics_[id].command()) == 0) {
+            auto const bytes = static_cast<uint8_t const*>(data);
+            return enqueue(new publication{topic_id(id), libbitcoin::data_chunk(bytes, bytes + size), nullptr, nullptr, 0, nullptr, nullptr});
+        }
+    }
+    return false;
+}
+
 bool zmq::send_hash_block_handler(libbitcoin::code ec, size_t height,
                                          libbitcoin::block_const_ptr_list_const_ptr incoming,
                                          libbitcoin::block_const_ptr_list_const_ptr outgoing) {
 
-    bool success = true;
+    if (ec) {
+        return true;
+    }
+
+    // Blocks are only referenced here, the publisher thread serializes them.
+    if (outgoing && !outgoing->empty()) {
+        enqueue(new publication{blockdisconnect, libbitcoin::data_chunk(), nullptr, nullptr, height, outgoing, incoming});
+    }
 
-    const char *MSG_HASHBLOCK = "hashblock";
     if (incoming) {
         for (const auto &block : *incoming) {
-            for (auto const &tx : block->transactions()) {
-                const char *MSG_RAWTX = "rawtx";
-                auto const temp = tx.to_data(1);
-                success = send_message(MSG_RAWTX, &(*temp.begin()), temp.size());
-                if (!success) {
-                    return success;
-                }
-            }
-            auto temp = block->hash();
-            char data[32];
-            for (unsigned int i = 0; i < 32; i++)
-                data[31 - i] = temp.begin()[i];
-            success = send_message(MSG_HASHBLOCK, data, 32);
-            if (!success) {
-                break;
-            }
+            enqueue(new publication{rawblock, libbitcoin::data_chunk(), block, nullptr, 0, nullptr, nullptr});
         }
     }
 
-    return success;
+    return true;
 }
 
 bool zmq::send_raw_transaction_handler(libbitcoin::code ec, libbitcoin::transaction_const_ptr incoming) {
 
     if (incoming) {
-        const char *MSG_RAWTX = "rawtx";
-        auto const temp = incoming->to_data(1, false);
-        return send_message(MSG_RAWTX, &(*temp.begin()), temp.size());
+        enqueue(new publication{rawtx, libbitcoin::data_chunk(), nullptr, incoming, 0, nullptr, nullptr});
     }
 
     return true;
@@ -0,0 +1,282 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/zmq/zmq_rpc_server.hpp>
+
+#include <cerrno>
+#include <sstream>
+#include <utility>
+
+#include <bitprim/rpc/messages/error_codes.hpp>
+
+namespace bitprim { namespace rpc {
+
+namespace {
+
+// Frees a reply body once zmq is done with it.
+void release_string(void* /*data*/, void* hint) {
+    delete static_cast<std::string*>(hint);
+}
+
+} // namespace
+
+zmq_rpc_server::zmq_rpc_server(bool use_testnet_rules
+        , std::shared_ptr<libbitcoin::node::full_node> & node
+        , std::string const& endpoint
+        , const std::unordered_set<std::string> & rpc_allowed_ips
+        , settings const& config
+        , message_context const& context)
+    : use_testnet_rules_(use_testnet_rules)
+    , stopped_(true)
+    , endpoint_(endpoint)
+    , node_(node)
+    , rpc_allowed_ips_(rpc_allowed_ips)
+    , workers_(context.dispatch ? nullptr : new worker_pool(config.worker_threads, config.pin_threads))
+    , dispatch_(context.dispatch)
+    , context_(nullptr)
+    , router_(nullptr)
+    , wakeup_receiver_(nullptr)
+    , wakeup_sender_(nullptr)
+{
+    // The workers of the http server, shared by the manager through the
+    // context; a server used on its own runs a pool of its own.
+    if (!dispatch_) {
+        auto const workers = workers_.get();
+        dispatch_ = [workers](std::function<void()> work) {
+            workers->post(std::move(work));
+        };
+    }
+
+    batch_.parallelism = config.batch_parallelism == 0 ? 1 : config.batch_parallelism;
+    batch_.max_size = config.max_batch_size;
+    batch_.dispatch = dispatch_;
+
+    // Messages spread their own work over the same workers.
+    auto messages = context;
+    messages.dispatch = dispatch_;
+    signature_map_ = load_signature_map<libbitcoin::blockchain::block_chain>(messages);
+}
+
+zmq_rpc_server::~zmq_rpc_server() {
+    stop();
+}
+
+bool zmq_rpc_server::start() {
+    if (!stopped_) {
+        return true;
+    }
+
+    context_ = zmq_ctx_new();
+    if (context_ == nullptr) {
+        return false;
+    }
+
+    std::ostringstream wakeup;
+    wakeup << "inproc://bitprim-rpc-replies-" << static_cast<void const*>(this);
+
+    router_ = zmq_socket(context_, ZMQ_ROUTER);
+    wakeup_receiver_ = zmq_socket(context_, ZMQ_PAIR);
+    wakeup_sender_ = zmq_socket(context_, ZMQ_PAIR);
+    if (router_ == nullptr || wakeup_receiver_ == nullptr || wakeup_sender_ == nullptr
+        || zmq_bind(router_, endpoint_.c_str()) != 0
+        || zmq_bind(wakeup_receiver_, wakeup.str().c_str()) != 0
+        || zmq_connect(wakeup_sender_, wakeup.str().c_str()) != 0) {
+        close_sockets();
+        return false;
+    }
+
+    stopped_ = false;
+    if (workers_) {
+        workers_->start();
+    }
+    thread_ = std::thread([this]() {
+        run();
+    });
+    return true;
+}
+
+bool zmq_rpc_server::stop() {
+    if (stopped_) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        zmq_send(wakeup_sender_, "", 0, ZMQ_DONTWAIT);
+    }
+    thread_.join();
+
+    // Requests still running complete into the closed server and are dropped.
+    if (workers_) {
+        workers_->stop();
+    }
+    close_sockets();
+    return true;
+}
+
+bool zmq_rpc_server::stopped() const {
+    return stopped_;
+}
+
+void zmq_rpc_server::close_sockets() {
+    int linger = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto socket : {&router_, &wakeup_receiver_, &wakeup_sender_}) {
+        if (*socket != nullptr) {
+            zmq_setsockopt(*socket, ZMQ_LINGER, &linger, sizeof(linger));
+            zmq_close(*socket);
+            *socket = nullptr;
+        }
+    }
+    replies_.clear();
+
+    if (context_ != nullptr) {
+        zmq_ctx_term(context_);
+        context_ = nullptr;
+    }
+}
+
+// Server thread.
+//-----------------------------------------------------------------------------
+
+void zmq_rpc_server::run() {
+    zmq_pollitem_t items[] = {
+        {router_, 0, ZMQ_POLLIN, 0},
+        {wakeup_receiver_, 0, ZMQ_POLLIN, 0}
+    };
+
+    while (!stopped_) {
+        if (zmq_poll(items, 2, -1) == -1) {
+            if (zmq_errno() == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        if (items[1].revents & ZMQ_POLLIN) {
+            char signal;
+            while (zmq_recv(wakeup_receiver_, &signal, sizeof(signal), ZMQ_DONTWAIT) != -1) {}
+            send_replies();
+        }
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            receive();
+        }
+    }
+}
+
+// Reads every request waiting on the socket and hands it to the workers.
+void zmq_rpc_server::receive() {
+    while (true) {
+        routing route;
+        std::string content;
+        bool allowed = true;
+
+        zmq_msg_t frame;
+        zmq_msg_init(&frame);
+        if (zmq_msg_recv(&frame, router_, ZMQ_DONTWAIT) == -1) {
+            zmq_msg_close(&frame);
+            return;
+        }
+
+        while (true) {
+            auto const data = static_cast<char const*>(zmq_msg_data(&frame));
+            std::string part(data, data + zmq_msg_size(&frame));
+            if (!zmq_msg_more(&frame)) {
+                // Only tcp peers have an address, local transports are trusted.
+                auto const address = zmq_msg_gets(&frame, "Peer-Address");
+                allowed = address == nullptr || rpc_allowed_ips_.find(address) != rpc_allowed_ips_.end();
+                content = std::move(part);
+                break;
+            }
+
+            route.push_back(std::move(part));
+            if (zmq_msg_recv(&frame, router_, 0) == -1) {
+                zmq_msg_close(&frame);
+                return;
+            }
+        }
+        zmq_msg_close(&frame);
+
+        if (!allowed) {
+            post_reply(std::move(route), serialize_error(nullptr, RPC_INVALID_REQUEST, "Forbidden"));
+            continue;
+        }
+
+        auto request = std::make_shared<std::pair<routing, std::string>>(std::move(route), std::move(content));
+        dispatch_([this, request]() {
+            process_request(std::move(request->first), std::move(request->second));
+        });
+    }
+}
+
+void zmq_rpc_server::send_replies() {
+    std::deque<reply> replies;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        replies.swap(replies_);
+    }
+
+    for (auto& reply : replies) {
+        for (auto const& part : reply.route) {
+            zmq_send(router_, part.data(), part.size(), ZMQ_SNDMORE);
+        }
+
+        // The body goes to the socket from its own buffer.
+        auto content = new std::string(std::move(reply.content));
+        zmq_msg_t body;
+        zmq_msg_init_data(&body, &(*content)[0], content->size(), release_string, content);
+        if (zmq_msg_send(&body, router_, 0) == -1) {
+            zmq_msg_close(&body);
+        }
+    }
+}
+
+// Workers.
+//-----------------------------------------------------------------------------
+
+void zmq_rpc_server::process_request(routing route, std::string content) {
+    auto const destination = std::make_shared<routing>(std::move(route));
+    try {
+        nlohmann::json json_object = nlohmann::json::parse(content);
+        bitprim::process_data(json_object, use_testnet_rules_, node_, signature_map_, batch_, [this, destination](std::string result) {
+            post_reply(std::move(*destination), std::move(result));
+        });
+    } catch(std::exception const& e) {
+        post_reply(std::move(*destination), serialize_error(nullptr, RPC_PARSE_ERROR, e.what()));
+    }
+}
+
+// Queues a reply for the server thread, waking it up when the queue was empty.
+void zmq_rpc_server::post_reply(routing route, std::string content) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_ || wakeup_sender_ == nullptr) {
+        return;
+    }
+
+    auto const idle = replies_.empty();
+    replies_.push_back(reply{std::move(route), std::move(content)});
+    if (idle) {
+        zmq_send(wakeup_sender_, "", 0, ZMQ_DONTWAIT);
+    }
+}
+
+}} // namespace bitprim::rpc
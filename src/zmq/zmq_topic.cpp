@@ -0,0 +1,136 @@
+/**
+* Copyright (c) 2017 Bitprim developers (see AUTHORS)
+*
+* This file is part of bitprim-node.
+*
+* bitprim-node is free software: you can redistribute it and/or
+* modify it under the terms of the GNU Affero General Public License with
+* additional permissions to the one published by the Free Software
+* Foundation, either version 3 of the License, or (at your option)
+* any later version. For more information see LICENSE.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <bitprim/rpc/zmq/zmq_topic.hpp>
+
+#include <utility>
+
+namespace bitprim { namespace rpc {
+
+zmq_topic::zmq_topic(char const* command, limits const& pending, transmitter transmit)
+    : command_(command)
+    , limits_(pending)
+    , transmit_(std::move(transmit))
+    , sequence_(0)
+    , subscribed_(false)
+    , pending_bytes_(0)
+{}
+
+char const* zmq_topic::command() const {
+    return command_;
+}
+
+bool zmq_topic::subscribed() const {
+    return subscribed_;
+}
+
+uint32_t zmq_topic::sequence() const {
+    return sequence_;
+}
+
+size_t zmq_topic::pending() const {
+    return pending_.size();
+}
+
+size_t zmq_topic::pending_bytes() const {
+    return pending_bytes_;
+}
+
+size_t zmq_topic::send(shared_chunk const& buffer, size_t offset, size_t size, clock::time_point now) {
+    if (subscribed_) {
+        if (transmit_(message{buffer, offset, size, now}, sequence_)) {
+            ++sequence_;
+        }
+        return 0;
+    }
+
+    auto dropped = expire(now);
+    if (limits_.messages == 0 || size > limits_.bytes || limits_.age.count() <= 0) {
+        return dropped + 1;
+    }
+
+    while (pending_.size() >= limits_.messages || pending_bytes_ + size > limits_.bytes) {
+        drop_front();
+        ++dropped;
+    }
+
+    // A slice waits in its own buffer, so it does not hold the rest of the
+    // one it was cut from (a rawtx of its block).
+    if (offset != 0 || size != buffer->size()) {
+        auto const first = buffer->begin() + offset;
+        pending_.push_back(message{std::make_shared<libbitcoin::data_chunk const>(first, first + size), 0, size, now});
+    } else {
+        pending_.push_back(message{buffer, offset, size, now});
+    }
+    pending_bytes_ += size;
+    return dropped;
+}
+
+size_t zmq_topic::subscribe(bool subscribed, clock::time_point now) {
+    subscribed_ = subscribed;
+    if (!subscribed_) {
+        return 0;
+    }
+
+    auto const dropped = expire(now);
+    while (!pending_.empty()) {
+        if (transmit_(pending_.front(), sequence_)) {
+            ++sequence_;
+        }
+        drop_front();
+    }
+    return dropped;
+}
+
+size_t zmq_topic::expire(clock::time_point now) {
+    size_t dropped = 0;
+    while (!pending_.empty() && now - pending_.front().time >= limits_.age) {
+        drop_front();
+        ++dropped;
+    }
+    return dropped;
+}
+
+void zmq_topic::clear() {
+    subscribed_ = false;
+    pending_.clear();
+    pending_bytes_ = 0;
+}
+
+void zmq_topic::drop_front() {
+    pending_bytes_ -= pending_.front().size;
+    pending_.pop_front();
+}
+
+std::vector<libbitcoin::data_chunk> block_disconnect_bodies(size_t fork_height, libbitcoin::block_const_ptr_list const& outgoing) {
+    std::vector<libbitcoin::data_chunk> bodies;
+    bodies.reserve(outgoing.size());
+    for (auto index = outgoing.size(); index-- != 0;) {
+        auto const hash = outgoing[index]->hash();
+        auto const height = libbitcoin::to_little_endian(static_cast<uint32_t>(fork_height + 1 + index));
+
+        libbitcoin::data_chunk body(hash.rbegin(), hash.rend());
+        body.insert(body.end(), height.begin(), height.end());
+        bodies.push_back(std::move(body));
+    }
+    return bodies;
+}
+
+}} // namespace bitprim::rpc
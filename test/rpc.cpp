@@ -18,6 +18,22 @@
  */
 
 #include <bitprim/rpc/messages.hpp>
+#include <bitprim/rpc/http/compression.hpp>
+#include <bitprim/rpc/http/server_http.hpp>
+#include <bitprim/rpc/zmq/zmq_rpc_server.hpp>
+#include <bitprim/rpc/zmq/zmq_topic.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <zlib.h>
+#include <zmq.h>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -61,8 +77,10 @@ public:
     //bool get_branch_work(uint256_t& out_work, const uint256_t& maximum,
     //	size_t height) const;
 
-    ///// Get the header of the block at the given height.
-    //bool get_header(chain::header& out_header, size_t height) const;
+    /// Get the header of the block at the given height.
+    bool get_header(libbitcoin::chain::header& out_header, size_t height) const {
+        return true;
+    }
 
     ///// Get the height of the block with the given hash.
     //bool get_height(size_t& out_height, const hash_digest& block_hash) const;
@@ -81,11 +99,13 @@ public:
         return true;
     }
 
-    ///// Get the output that is referenced by the outpoint.
-    //bool get_output(chain::output& out_output, size_t& out_height,
-    //	uint32_t& out_median_time_past, bool& out_coinbase,
-    //	const chain::output_point& outpoint, size_t branch_height,
-    //	bool require_confirmed) const;
+    /// Get the output that is referenced by the outpoint.
+    bool get_output(libbitcoin::chain::output& out_output, size_t& out_height,
+        uint32_t& out_median_time_past, bool& out_coinbase,
+        const libbitcoin::chain::output_point& outpoint, size_t branch_height,
+        bool require_confirmed) const {
+        return false;
+    }
 
     //bool get_output_is_confirmed(chain::output& out_output, size_t& out_height,
     //	bool& out_coinbase, bool& out_is_confirmed, const chain::output_point& outpoint,
@@ -95,9 +115,11 @@ public:
     //bool get_is_unspent_transaction(const hash_digest& hash,
     //	size_t branch_height, bool require_confirmed) const;
 
-    ///// Get position data for a transaction.
-    //bool get_transaction_position(size_t& out_height, size_t& out_position,
-    //	const hash_digest& hash, bool require_confirmed) const;
+    /// Get position data for a transaction.
+    bool get_transaction_position(size_t& out_height, size_t& out_position,
+        const libbitcoin::hash_digest& hash, bool require_confirmed) const {
+        return false;
+    }
 
     ///////// Get the transaction of the given hash and its block height.
     //////transaction_ptr get_transaction(size_t& out_block_height,
@@ -311,6 +333,358 @@ public:
 
 };
 
+// Connects to a server started on another thread, once it listens.
+std::shared_ptr<boost::asio::ip::tcp::socket> connect_loopback(boost::asio::io_service& io_service, unsigned short port) {
+    auto const endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port);
+    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        boost::system::error_code ec;
+        socket->connect(endpoint, ec);
+        if (!ec) {
+            return socket;
+        }
+        socket->close(ec);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return nullptr;
+}
+
+// Headers linked one after the other, one per timestamp.
+std::vector<libbitcoin::chain::header> make_headers(std::vector<uint32_t> const& timestamps,
+    libbitcoin::hash_digest previous = libbitcoin::null_hash, uint32_t nonce = 0) {
+    std::vector<libbitcoin::chain::header> headers;
+    for (auto timestamp : timestamps) {
+        headers.emplace_back(1, previous, libbitcoin::null_hash, timestamp, 0x1d00ffff, nonce++);
+        previous = headers.back().hash();
+    }
+    return headers;
+}
+
+libbitcoin::block_const_ptr_list_const_ptr make_blocks(std::vector<libbitcoin::chain::header> const& headers) {
+    auto blocks = std::make_shared<libbitcoin::block_const_ptr_list>();
+    for (auto const& header : headers) {
+        blocks->push_back(std::make_shared<libbitcoin::message::block const>(libbitcoin::chain::block(header, {})));
+    }
+    return blocks;
+}
+
+// A header index over a vector, with the reorganizations sent by the test.
+class header_chain {
+public:
+    header_chain(std::vector<libbitcoin::chain::header> headers)
+        : headers_(std::move(headers))
+        , index([this](libbitcoin::blockchain::safe_chain::reorganize_handler handler) {
+              notify_ = std::move(handler);
+          }, [this](libbitcoin::chain::header& out_header, size_t height) {
+              if (height >= headers_.size()) {
+                  return false;
+              }
+              out_header = headers_[height];
+              return true;
+          })
+    {
+        index.start();
+        while (!index.ready()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // Replaces the blocks above fork_height.
+    void reorganize(size_t fork_height, std::vector<libbitcoin::chain::header> const& incoming) {
+        std::vector<libbitcoin::chain::header> outgoing(headers_.begin() + fork_height + 1, headers_.end());
+        headers_.resize(fork_height + 1);
+        headers_.insert(headers_.end(), incoming.begin(), incoming.end());
+        notify_(libbitcoin::error::success, fork_height, make_blocks(incoming), make_blocks(outgoing));
+    }
+
+    std::vector<libbitcoin::chain::header> const& headers() const {
+        return headers_;
+    }
+
+private:
+    std::vector<libbitcoin::chain::header> headers_;
+    libbitcoin::blockchain::safe_chain::reorganize_handler notify_;
+
+public:
+    bitprim::rpc::header_index index;
+};
+
+// Outputs paying to addresses made of a single repeated byte.
+libbitcoin::short_hash address_hash(uint8_t id) {
+    libbitcoin::short_hash hash;
+    hash.fill(id);
+    return hash;
+}
+
+libbitcoin::chain::output pay(uint8_t id, uint64_t value) {
+    return libbitcoin::chain::output(value, libbitcoin::chain::script(libbitcoin::chain::script::to_pay_key_hash_pattern(address_hash(id))));
+}
+
+libbitcoin::chain::transaction coinbase(uint32_t tag, uint8_t id, uint64_t value) {
+    libbitcoin::chain::input const input(libbitcoin::chain::output_point(), libbitcoin::chain::script(), 0xffffffff);
+    return libbitcoin::chain::transaction(1, tag, {input}, {pay(id, value)});
+}
+
+libbitcoin::chain::transaction spend(std::vector<libbitcoin::chain::output_point> const& points, libbitcoin::chain::output::list const& outputs) {
+    libbitcoin::chain::input::list inputs;
+    for (auto const& point : points) {
+        inputs.emplace_back(point, libbitcoin::chain::script(), 0xffffffff);
+    }
+    return libbitcoin::chain::transaction(1, 0, inputs, outputs);
+}
+
+// Polls the condition for a few seconds, returns whether it held.
+template <typename Condition>
+bool eventually(Condition condition, std::chrono::seconds limit = std::chrono::seconds(5)) {
+    auto const deadline = std::chrono::steady_clock::now() + limit;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Runs each piece of work on a thread of its own. join() waits for them
+// and for whatever they dispatched in turn.
+class thread_dispatcher {
+public:
+    ~thread_dispatcher() {
+        join();
+    }
+
+    bitprim::work_dispatcher dispatch() {
+        return [this](std::function<void()> work) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            threads_.emplace_back(std::move(work));
+        };
+    }
+
+    void join() {
+        while (true) {
+            std::vector<std::thread> threads;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                threads.swap(threads_);
+            }
+            if (threads.empty()) {
+                return;
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::thread> threads_;
+};
+
+// Store lookups that answer inline, as the store does. Each one records its
+// thread and holds on until another lookup ran at the same time, for up to
+// a second, so lookups issued together are seen overlapping.
+class lookup_overlap {
+public:
+    void enter() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        threads_.insert(std::this_thread::get_id());
+        most_ = std::max(most_, ++active_);
+        changed_.notify_all();
+        changed_.wait_for(lock, std::chrono::seconds(1), [this]() {
+            return most_ > 1;
+        });
+        --active_;
+    }
+
+    size_t most() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return most_;
+    }
+
+    bool ran_on(std::thread::id thread) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return threads_.count(thread) != 0;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    mutable std::condition_variable changed_;
+    mutable std::set<std::thread::id> threads_;
+    mutable size_t active_ = 0;
+    mutable size_t most_ = 0;
+};
+
+// An address index over a chain of blocks mined by the test. Fetches
+// read the block when the index asks for it, on the index thread, and
+// either complete right there, as the chain does, or when the test runs
+// them.
+class address_chain {
+public:
+    explicit address_chain(bool inline_fetches = false)
+        : inline_fetches_(inline_fetches)
+        , index([this](libbitcoin::blockchain::safe_chain::reorganize_handler handler) {
+              notify_ = std::move(handler);
+          }, [this](size_t height, libbitcoin::blockchain::safe_chain::block_fetch_handler handler) {
+              std::unique_lock<std::mutex> lock(mutex_);
+              auto const block = height < blocks_.size() ? blocks_[height] : nullptr;
+              auto complete = [block, height, handler]() {
+                  handler(block ? libbitcoin::error::success : libbitcoin::error::not_found, block, height);
+              };
+              if (inline_fetches_) {
+                  lock.unlock();
+                  complete();
+                  return;
+              }
+              fetches_.push_back(pending_fetch{std::move(complete), !block});
+          })
+    {}
+
+    libbitcoin::block_const_ptr mine(libbitcoin::chain::transaction::list const& transactions) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return append(transactions);
+    }
+
+    // Replaces the blocks above fork_height with a branch of these blocks.
+    void reorganize(size_t fork_height, std::vector<libbitcoin::chain::transaction::list> const& branch) {
+        auto incoming = std::make_shared<libbitcoin::block_const_ptr_list>();
+        libbitcoin::block_const_ptr_list_const_ptr outgoing;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            outgoing = std::make_shared<libbitcoin::block_const_ptr_list>(blocks_.begin() + fork_height + 1, blocks_.end());
+            blocks_.resize(fork_height + 1);
+            for (auto const& transactions : branch) {
+                incoming->push_back(append(transactions));
+            }
+        }
+        notify_(libbitcoin::error::success, fork_height, incoming, outgoing);
+    }
+
+    // Completes the fetches in order as the index asks for them, with the
+    // ones they lead to. Returns once the index asked for the next block,
+    // or once it is ready after a fetch past the top.
+    void fetch(size_t count = libbitcoin::max_size_t) {
+        for (; count != 0; --count) {
+            pending_fetch next;
+            CHECK(eventually([this, &next]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (fetches_.empty()) {
+                    return false;
+                }
+                next = std::move(fetches_.front());
+                fetches_.pop_front();
+                return true;
+            }));
+            if (!next.complete) {
+                return;
+            }
+            next.complete();
+            if (next.past_top) {
+                CHECK(eventually([this]() {
+                    return index.ready();
+                }));
+                return;
+            }
+        }
+
+        CHECK(eventually([this]() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return !fetches_.empty() || index.ready();
+        }));
+    }
+
+    uint64_t balance(uint8_t id) const {
+        uint64_t balance = 0;
+        uint64_t received = 0;
+        CHECK(index.balance(address_hash(id), balance, received));
+        return balance;
+    }
+
+    std::vector<int64_t> deltas(uint8_t id) const {
+        std::vector<bitprim::rpc::address_index::delta> deltas;
+        CHECK(index.deltas(address_hash(id), 0, libbitcoin::max_size_t, deltas));
+        std::vector<int64_t> satoshis;
+        for (auto const& delta : deltas) {
+            satoshis.push_back(delta.satoshis);
+        }
+        return satoshis;
+    }
+
+    std::vector<libbitcoin::block_const_ptr> const& blocks() const {
+        return blocks_;
+    }
+
+private:
+    struct pending_fetch {
+        std::function<void()> complete;
+        bool past_top;
+    };
+
+    // Requires the lock.
+    libbitcoin::block_const_ptr append(libbitcoin::chain::transaction::list const& transactions) {
+        auto const previous = blocks_.empty() ? libbitcoin::null_hash : blocks_.back()->hash();
+        libbitcoin::chain::header const header(1, previous, libbitcoin::null_hash, 1000 + 600 * uint32_t(blocks_.size()), 0x1d00ffff, nonce_++);
+        blocks_.push_back(std::make_shared<libbitcoin::message::block const>(libbitcoin::chain::block(header, transactions)));
+        return blocks_.back();
+    }
+
+    bool const inline_fetches_;
+    std::mutex mutex_;
+    std::vector<libbitcoin::block_const_ptr> blocks_;
+    std::deque<pending_fetch> fetches_;
+    libbitcoin::blockchain::safe_chain::reorganize_handler notify_;
+    uint32_t nonce_ = 0;
+
+public:
+    bitprim::rpc::address_index index;
+};
+
+// Reads one response from a connection, returns its body.
+std::string read_response(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buffer) {
+    boost::system::error_code ec;
+    auto const header_size = boost::asio::read_until(socket, buffer, "\r\n\r\n", ec);
+    if (ec) {
+        return "closed";
+    }
+    std::string header(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + header_size);
+    buffer.consume(header_size);
+
+    // Chunked bodies are returned whole.
+    if (header.find("Transfer-Encoding: chunked") != std::string::npos) {
+        std::string body;
+        for (;;) {
+            auto const line_size = boost::asio::read_until(socket, buffer, "\r\n", ec);
+            if (ec) {
+                return "closed";
+            }
+            std::string const line(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + line_size);
+            buffer.consume(line_size);
+            auto const size = std::stoul(line, nullptr, 16);
+            if (buffer.size() < size + 2) {
+                boost::asio::read(socket, buffer, boost::asio::transfer_exactly(size + 2 - buffer.size()), ec);
+            }
+            body.append(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + size);
+            buffer.consume(size + 2);
+            if (size == 0) {
+                return body;
+            }
+        }
+    }
+
+    auto const length = header.find("Content-Length: ");
+    if (length == std::string::npos) {
+        return "no length";
+    }
+    auto const size = std::stoul(header.substr(length + 16));
+    if (buffer.size() < size) {
+        boost::asio::read(socket, buffer, boost::asio::transfer_exactly(size - buffer.size()), ec);
+    }
+    std::string body(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + size);
+    buffer.consume(size);
+    return body;
+}
+
 class full_node_dummy {
 public:
     block_chain_dummy blockchain_;
@@ -405,6 +779,83 @@ TEST_CASE("[process_data] getrawtransaction error invalid params") {
 
 
 
+TEST_CASE("[json_in_getblock] verbosity as a bool or a number") {
+    std::string hash;
+    int verbosity;
+
+    auto const parse = [&](nlohmann::json params) {
+        nlohmann::json input;
+        input["params"] = std::move(params);
+        return bitprim::json_in_getblock(input, hash, verbosity);
+    };
+
+    CHECK(parse({"00"}));
+    CHECK(verbosity == 1);
+    CHECK(parse({"00", false}));
+    CHECK(verbosity == 0);
+    CHECK(parse({"00", 2}));
+    CHECK(verbosity == 2);
+    CHECK_FALSE(parse({"00", 3}));
+    CHECK_FALSE(parse({"00", "2"}));
+}
+
+TEST_CASE("[getblock] verbosity 2 keeps the block order of jobs completed in reverse") {
+
+    struct block_store : block_chain_dummy {
+        libbitcoin::block_const_ptr block;
+
+        void fetch_block(libbitcoin::hash_digest const&, bool, libbitcoin::blockchain::safe_chain::block_fetch_handler handler) const {
+            handler(libbitcoin::error::success, block, 5);
+        }
+    };
+
+    // Three jobs, the last one partly filled.
+    auto const count = 2 * bitprim::block_transactions_per_job + 10;
+    libbitcoin::chain::transaction::list transactions;
+    for (size_t n = 0; n < count; ++n) {
+        transactions.push_back(coinbase(uint32_t(n), uint8_t(n), 1000 + n));
+    }
+    libbitcoin::chain::header const header(1, libbitcoin::null_hash, libbitcoin::null_hash, 1500000000, 0x1d00ffff, 0);
+    block_store store;
+    store.block = std::make_shared<libbitcoin::message::block const>(libbitcoin::chain::block(header, transactions));
+
+    std::vector<std::function<void()>> jobs;
+    bitprim::work_dispatcher const dispatch = [&jobs](std::function<void()> job) {
+        jobs.push_back(std::move(job));
+    };
+
+    nlohmann::json input;
+    input["method"] = "getblock";
+    input["id"] = 7;
+    input["params"] = {bitprim::rpc::encode_hash(header.hash()), 2};
+    std::string response;
+    bitprim::process_getblock(input, store, false, nullptr, dispatch, [&response](std::string result) {
+        response = std::move(result);
+    });
+
+    REQUIRE(jobs.size() == 3);
+    CHECK(response.empty());
+    for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+        (*it)();
+    }
+
+    auto const parsed = nlohmann::json::parse(response);
+    CHECK(parsed["id"] == 7);
+    CHECK(parsed["error"].is_null());
+    CHECK(parsed["result"]["hash"] == bitprim::rpc::encode_hash(header.hash()));
+    CHECK(parsed["result"]["height"] == 5);
+
+    auto const& txs = parsed["result"]["tx"];
+    REQUIRE(txs.size() == count);
+    size_t ordered = 0;
+    for (size_t n = 0; n < count; ++n) {
+        if (txs[n]["txid"] == bitprim::rpc::encode_hash(transactions[n].hash()) && txs[n]["vout"][0]["valueSat"] == 1000 + n) {
+            ++ordered;
+        }
+    }
+    CHECK(ordered == count);
+}
+
 TEST_CASE("[process_data] submitblock ") {
 
     using blk_t = block_chain_dummy;
@@ -429,6 +880,1464 @@ TEST_CASE("[process_data] submitblock ") {
     CHECK((int)output["error"]["code"] == bitprim::RPC_MISC_ERROR);
 }
 
+TEST_CASE("[process_data] batch elements complete out of order") {
+
+    using blk_t = block_chain_dummy;
+
+    auto map = bitprim::load_signature_map<blk_t>();
+    std::shared_ptr<full_node_dummy> node;
+
+    nlohmann::json input = nlohmann::json::array();
+    for (int i = 0; i < 6; ++i) {
+        nlohmann::json element;
+        element["method"] = "getrawtransaction";
+        element["id"] = i;
+        element["params"] = nullptr;
+        input.push_back(element);
+    }
+
+    // Queued elements run last in first out.
+    std::vector<bitprim::batch_policy::work> queue;
+    bitprim::batch_policy batch;
+    batch.parallelism = 4;
+    batch.max_size = 6;
+    batch.dispatch = [&queue](bitprim::batch_policy::work element) {
+        queue.push_back(std::move(element));
+    };
+
+    std::string ret;
+    bitprim::process_data(input, false, node, map, batch, [&ret](std::string result) {
+        ret = std::move(result);
+    });
+
+    CHECK(queue.size() == 4);
+    while (!queue.empty()) {
+        auto element = std::move(queue.back());
+        queue.pop_back();
+        element();
+    }
+
+    nlohmann::json output = nlohmann::json::parse(ret);
+    REQUIRE(output.size() == 6);
+    for (int i = 0; i < 6; ++i) {
+        CHECK(output[i]["id"] == i);
+    }
+
+    input.push_back(input[0]);
+    bitprim::process_data(input, false, node, map, batch, [&ret](std::string result) {
+        ret = std::move(result);
+    });
+
+    output = nlohmann::json::parse(ret);
+    CHECK(queue.empty());
+    CHECK((int)output["error"]["code"] == bitprim::RPC_INVALID_REQUEST);
+}
+
+TEST_CASE("[response_cache] hits keep their own id") {
+
+    using blk_t = block_chain_dummy;
+    using lifetime = bitprim::rpc::response_cache::lifetime;
+
+    bitprim::rpc::response_cache cache(1 << 20);
+
+    size_t calls = 0;
+    bitprim::message_signature<blk_t> count = [&calls](nlohmann::json const& json_in, blk_t const&, bool, bitprim::response_handler handler) {
+        ++calls;
+        handler(bitprim::serialize_result(json_in["id"], [](bitprim::json_writer& writer) {
+            writer.number(42);
+        }));
+    };
+    auto const cached = bitprim::cached_message<blk_t>(cache, "getblockcount", count);
+
+    blk_t chain;
+    std::string ret;
+    auto const store = [&ret](std::string result) {
+        ret = std::move(result);
+    };
+
+    nlohmann::json input;
+    input["method"] = "getblockcount";
+    input["id"] = 1;
+    cached(input, chain, false, store);
+    input["id"] = "second";
+    cached(input, chain, false, store);
+
+    CHECK(calls == 1);
+    CHECK(ret == "{\"result\":42,\"error\":null,\"id\":\"second\"}");
+
+    // A new tip drops the entry, a response built before it is not stored.
+    auto const generation = cache.generation();
+    cache.invalidate_tip();
+    cached(input, chain, false, store);
+    CHECK(calls == 2);
+    cache.insert("getblock stale", "{\"result\":1,\"error\":null,\"id\":", lifetime::tip, generation);
+    CHECK_FALSE(cache.find("getblock stale", ret));
+
+    // Least recently used entries go first once over capacity.
+    bitprim::rpc::response_cache small(2 * (bitprim::rpc::response_cache::entry_overhead + 2 + 10));
+    small.insert("a", std::string(10, 'a'), lifetime::immutable, 0);
+    small.insert("b", std::string(10, 'b'), lifetime::immutable, 0);
+    CHECK(small.find("a", ret));
+    small.insert("c", std::string(10, 'c'), lifetime::immutable, 0);
+    CHECK(small.find("a", ret));
+    CHECK_FALSE(small.find("b", ret));
+    CHECK(small.find("c", ret));
+    small.invalidate_tip();
+    CHECK(small.find("a", ret));
+}
+
+TEST_CASE("[request_coalescer] identical requests in flight share the response") {
+
+    using blk_t = block_chain_dummy;
+
+    bitprim::rpc::request_coalescer coalescer;
+
+    // Completes only when the test says so, as a chain query would.
+    std::vector<std::function<void()>> pending;
+    bitprim::message_signature<blk_t> slow = [&pending](nlohmann::json const& json_in, blk_t const&, bool, bitprim::response_handler handler) {
+        auto const id = json_in["id"];
+        pending.push_back([id, handler]() {
+            handler(bitprim::serialize_result(id, [](bitprim::json_writer& writer) {
+                writer.string("0000000000000000000000000000000000000000000000000000000000000000");
+            }));
+        });
+    };
+    auto const coalesced = bitprim::coalesced_message<blk_t>(coalescer, "getbestblockhash", slow);
+
+    blk_t chain;
+    std::vector<std::string> responses;
+    auto const store = [&responses](std::string result) {
+        responses.push_back(std::move(result));
+    };
+
+    nlohmann::json input;
+    input["method"] = "getbestblockhash";
+    input["id"] = 1;
+    coalesced(input, chain, false, store);
+    input["id"] = "second";
+    coalesced(input, chain, false, store);
+    input["params"] = nlohmann::json::array({1});
+    coalesced(input, chain, false, store);
+
+    CHECK(pending.size() == 2);
+    CHECK(coalescer.size() == 2);
+    pending[0]();
+    REQUIRE(responses.size() == 2);
+    CHECK(responses[0] == "{\"result\":\"0000000000000000000000000000000000000000000000000000000000000000\",\"error\":null,\"id\":\"second\"}");
+    CHECK(responses[1] == "{\"result\":\"0000000000000000000000000000000000000000000000000000000000000000\",\"error\":null,\"id\":1}");
+    CHECK(coalescer.size() == 1);
+
+    // Once done, the same request computes again.
+    input.erase("params");
+    coalesced(input, chain, false, store);
+    CHECK(pending.size() == 3);
+}
+
+TEST_CASE("[json_writer] streamed and DOM responses") {
+
+    bitprim::json_writer writer;
+    writer.begin_object();
+    writer.key("text");
+    writer.string("a\"b\n");
+    writer.key("list");
+    writer.begin_array();
+    writer.number(-1);
+    writer.number(2u);
+    writer.hex_reversed(std::vector<uint8_t>{0x01, 0xab});
+    writer.end_array();
+    writer.end_object();
+
+    CHECK(writer.release() == "{\"text\":\"a\\\"b\\n\",\"list\":[-1,2,\"ab01\"]}");
+
+    nlohmann::json container;
+    container["id"] = 7;
+    container["result"] = "x";
+    container["error"];
+
+    auto const streamed = bitprim::serialize_result(container["id"], [](bitprim::json_writer& writer) {
+        writer.string("x");
+    });
+
+    CHECK(bitprim::serialize_response(container) == streamed);
+    CHECK(streamed == "{\"result\":\"x\",\"error\":null,\"id\":7}");
+
+    // Written an item at a time and handed over in pieces, long hex strings
+    // and hex written in parts included, the response is the same.
+    std::vector<uint8_t> data(3 * bitprim::response_chunk_size + 5);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 7);
+    }
+    auto const whole = bitprim::serialize_result(container["id"], [&data](bitprim::json_writer& writer) {
+        writer.begin_array();
+        writer.begin_array();
+        writer.hex(data);
+        writer.hex_reversed(data);
+        writer.end_array();
+        writer.begin_hex();
+        writer.hex_part(data.data(), 10);
+        writer.hex_part(data.data() + 10, data.size() - 10);
+        writer.end_hex();
+        writer.end_array();
+    });
+    auto const write_item = [&data](bitprim::json_writer& writer, size_t item) {
+        switch (item) {
+            case 0: writer.begin_array(); writer.begin_array(); writer.hex(data); break;
+            case 1: writer.hex_reversed(data); break;
+            case 2: writer.end_array(); writer.begin_hex(); break;
+            case 3: writer.hex_part(data.data(), 10); break;
+            case 4: writer.hex_part(data.data() + 10, data.size() - 10); break;
+            default: writer.end_hex(); writer.end_array(); break;
+        }
+    };
+
+    size_t chunks = 0;
+    std::string pieces;
+    std::string tail;
+    bitprim::streamed_result::run(container["id"], 6, write_item, 0, bitprim::response_handler([&](std::string rest) {
+        tail = std::move(rest);
+    }, [&](std::string chunk, std::function<void()>) {
+        CHECK(chunk.size() <= bitprim::response_chunk_size + 2);
+        ++chunks;
+        pieces += chunk;
+        return true;
+    }));
+
+    CHECK(chunks > 8);
+    CHECK(pieces + tail == whole);
+
+    // Without room at the transport no item is written until it resumes.
+    std::deque<std::function<void()>> waiting;
+    size_t items = 0;
+    bool done = false;
+    pieces.clear();
+    bitprim::streamed_result::run(container["id"], 6, [&](bitprim::json_writer& writer, size_t item) {
+        ++items;
+        write_item(writer, item);
+    }, 0, bitprim::response_handler([&](std::string rest) {
+        tail = std::move(rest);
+        done = true;
+    }, [&](std::string chunk, std::function<void()> resume) {
+        pieces += chunk;
+        waiting.push_back(std::move(resume));
+        return false;
+    }));
+
+    CHECK(items == 1);
+    REQUIRE(waiting.size() > 1);
+    auto const first = waiting.size();
+    for (size_t i = 0; i + 1 < first; ++i) {
+        waiting.front()();
+        waiting.pop_front();
+    }
+    CHECK(items == 1);
+    CHECK(!done);
+
+    while (!waiting.empty()) {
+        auto const resume = std::move(waiting.front());
+        waiting.pop_front();
+        resume();
+    }
+    CHECK(items == 6);
+    CHECK(done);
+    CHECK(pieces + tail == whole);
+}
+
+TEST_CASE("[hex] every kernel matches the scalar one") {
+
+    using bitprim::rpc::hex_kernel;
+
+    // Sizes around the 16 and 32 byte blocks, so every tail path runs.
+    std::vector<uint8_t> data(131);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+
+    for (auto kernel : {hex_kernel::sse2, hex_kernel::avx2}) {
+        for (size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 64, 131}) {
+            std::string expected(2 * size, '\0');
+            std::string encoded(2 * size, '\0');
+            bitprim::rpc::hex_encode(data.data(), size, &expected[0], hex_kernel::scalar);
+            bitprim::rpc::hex_encode(data.data(), size, &encoded[0], kernel);
+            CHECK(encoded == expected);
+
+            bitprim::rpc::hex_encode_reversed(data.data(), size, &expected[0], hex_kernel::scalar);
+            bitprim::rpc::hex_encode_reversed(data.data(), size, &encoded[0], kernel);
+            CHECK(encoded == expected);
+
+            std::vector<uint8_t> decoded(size);
+            CHECK(bitprim::rpc::hex_decode(expected.data(), expected.size(), decoded.data(), kernel));
+            CHECK(std::equal(decoded.begin(), decoded.end(), data.rbegin() + (data.size() - size)));
+
+            if (size != 0) {
+                expected[size] = 'g';
+                CHECK_FALSE(bitprim::rpc::hex_decode(expected.data(), expected.size(), decoded.data(), kernel));
+            }
+        }
+    }
+
+    libbitcoin::hash_digest hash;
+    CHECK(bitprim::rpc::decode_hash(hash, "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f"));
+    CHECK(bitprim::rpc::encode_hash(hash) == "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
+    CHECK(hash[31] == 0x00);
+    CHECK(hash[0] == 0x6f);
+
+    libbitcoin::data_chunk chunk;
+    CHECK(bitprim::rpc::decode_base16(chunk, "0aFf"));
+    CHECK(bitprim::rpc::encode_base16(chunk) == "0aff");
+    CHECK_FALSE(bitprim::rpc::decode_base16(chunk, "0af"));
+}
+
+
+TEST_CASE("[admission_control] expensive requests wait for mining ones") {
+
+    using bitprim::rpc::admission_control;
+    using cost_class = admission_control::cost_class;
+
+    CHECK(admission_control::classify("getaddressdeltas") == cost_class::expensive);
+    CHECK(admission_control::classify("getblocktemplate") == cost_class::mining);
+    CHECK(admission_control::classify("getblock") == cost_class::standard);
+
+    admission_control admission({0, 0}, {1, 1});
+    std::vector<std::string> started;
+    auto const start = [&started](std::string name) {
+        return [&started, name]() {
+            started.push_back(name);
+        };
+    };
+
+    CHECK(admission.admit(cost_class::expensive, start("first")));
+    CHECK(admission.admit(cost_class::expensive, start("second")));
+    CHECK_FALSE(admission.admit(cost_class::expensive, start("rejected")));
+    CHECK(admission.admit(cost_class::mining, start("mining")));
+    CHECK(admission.admit(cost_class::standard, start("standard")));
+    CHECK(started == std::vector<std::string>{"first", "mining", "standard"});
+
+    // The freed slot stays empty while a mining request runs.
+    admission.release(cost_class::expensive);
+    CHECK(admission.running(cost_class::expensive) == 0);
+    CHECK(admission.queued(cost_class::expensive) == 1);
+
+    admission.release(cost_class::mining);
+    CHECK(started.back() == "second");
+    CHECK(admission.running(cost_class::expensive) == 1);
+    CHECK(admission.queued(cost_class::expensive) == 0);
+}
+
+TEST_CASE("[compression] spliced bodies inflate to the whole response") {
+
+    using bitprim::rpc::content_coding;
+
+    auto const inflated = [](std::string const& body) {
+        // Window bits above 32 detect the gzip and zlib formats.
+        z_stream stream = z_stream();
+        inflateInit2(&stream, 15 + 32);
+        std::string out(1 << 20, '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+        stream.avail_in = static_cast<uInt>(body.size());
+        stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        stream.avail_out = static_cast<uInt>(out.size());
+        auto const status = inflate(&stream, Z_FINISH);
+        out.resize(out.size() - stream.avail_out);
+        inflateEnd(&stream);
+        return status == Z_STREAM_END ? out : std::string("corrupt");
+    };
+
+    std::string prefix = "{\"result\":[";
+    for (int i = 0; i < 2000; ++i) {
+        prefix += "{\"txid\":\"4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b\",\"index\":" + std::to_string(i) + "},";
+    }
+    prefix += "{}],\"error\":null,\"id\":";
+
+    auto const compressed_prefix = bitprim::rpc::compress_prefix(prefix, 6);
+    for (auto coding : {content_coding::gzip, content_coding::deflate}) {
+        auto const whole = bitprim::rpc::compress(prefix + "1}\n", coding, 6);
+        CHECK(whole.size() < prefix.size() / 5);
+        CHECK(inflated(whole) == prefix + "1}\n");
+
+        for (auto const& id : {std::string("1"), std::string("\"abc\""), std::string(70000, '7')}) {
+            CHECK(inflated(bitprim::rpc::complete_prefix(compressed_prefix, id + "}\n", coding)) == prefix + id + "}\n");
+        }
+
+        bitprim::rpc::compressor pieces(coding, 6);
+        auto streamed = pieces.write(prefix.substr(0, 1000));
+        streamed += pieces.write(prefix.substr(1000));
+        streamed += pieces.finish("2}\n");
+        CHECK(inflated(streamed) == prefix + "2}\n");
+    }
+
+    CHECK(bitprim::rpc::negotiate_coding("gzip, deflate, br") == content_coding::gzip);
+    CHECK(bitprim::rpc::negotiate_coding("gzip;q=0.5, deflate") == content_coding::deflate);
+    CHECK(bitprim::rpc::negotiate_coding("gzip;q=0, *;q=0.1") == content_coding::deflate);
+    CHECK(bitprim::rpc::negotiate_coding("identity") == content_coding::identity);
+    CHECK(bitprim::rpc::negotiate_coding("") == content_coding::identity);
+}
+
+TEST_CASE("[header_index] timestamp ranges over unordered timestamps") {
+
+    // Timestamps going back and forth, but always later than the median
+    // of the previous eleven as the consensus rules require.
+    std::vector<uint32_t> timestamps;
+    for (uint32_t i = 0; i < 60; ++i) {
+        timestamps.push_back(1000 + 10 * i + (i * 37) % 51 - 25);
+    }
+    header_chain chain(make_headers(timestamps));
+
+    auto const expected = [&chain](uint32_t low, uint32_t high) {
+        std::vector<libbitcoin::hash_digest> hashes;
+        for (auto const& header : chain.headers()) {
+            if (header.timestamp() >= low && header.timestamp() <= high) {
+                hashes.push_back(header.hash());
+            }
+        }
+        return hashes;
+    };
+
+    auto const found = [&chain](uint32_t low, uint32_t high) {
+        std::vector<bitprim::rpc::header_index::entry> blocks;
+        CHECK(chain.index.blocks(low, high, blocks));
+        std::vector<libbitcoin::hash_digest> hashes;
+        for (auto const& block : blocks) {
+            hashes.push_back(block.hash);
+        }
+        return hashes;
+    };
+
+    for (uint32_t low = 950; low < 1650; low += 23) {
+        for (uint32_t width : {0, 1, 9, 40, 133, 1000}) {
+            CHECK(found(low, low + width) == expected(low, low + width));
+        }
+    }
+
+    // Once truncated, the running maximum comes from the new blocks only.
+    chain.reorganize(49, make_headers({2000, 1510, 1520}, chain.headers()[49].hash(), 100));
+    CHECK(found(1500, 1525) == expected(1500, 1525));
+    CHECK(found(1900, 2100) == expected(1900, 2100));
+    CHECK(found(1900, 2100).size() == 1);
+
+    chain.reorganize(49, make_headers({1515, 1530}, chain.headers()[49].hash(), 200));
+    CHECK(found(1500, 1540) == expected(1500, 1540));
+    CHECK(found(1900, 2100).empty());
+    CHECK(found(1510, 1510).empty());
+}
+
+TEST_CASE("[response_cache] getblockhashes is kept once the header index answers") {
+
+    using blk_t = block_chain_dummy;
+
+    bitprim::rpc::response_cache cache(1 << 20);
+    size_t calls = 0;
+    bitprim::message_signature<blk_t> hashes = [&calls](nlohmann::json const& json_in, blk_t const&, bool, bitprim::response_handler handler) {
+        ++calls;
+        handler(bitprim::serialize_result(json_in["id"], [](bitprim::json_writer& writer) {
+            writer.begin_array();
+            writer.end_array();
+        }));
+    };
+
+    blk_t chain;
+    nlohmann::json input;
+    input["method"] = "getblockhashes";
+    input["id"] = 1;
+    input["params"] = {1200, 1100};
+    auto const ignore = [](std::string) {};
+
+    // Still loading, the answer comes from the chain headers every time.
+    bitprim::rpc::header_index loading([](libbitcoin::blockchain::safe_chain::reorganize_handler) {},
+        [](libbitcoin::chain::header&, size_t) {
+            return false;
+        });
+    auto const before = bitprim::cached_message<blk_t>(cache, "getblockhashes", hashes, &loading);
+    before(input, chain, false, ignore);
+    before(input, chain, false, ignore);
+    CHECK(calls == 2);
+
+    header_chain loaded(make_headers({1000, 1100, 1200}));
+    auto const after = bitprim::cached_message<blk_t>(cache, "getblockhashes", hashes, &loaded.index);
+    after(input, chain, false, ignore);
+    after(input, chain, false, ignore);
+    CHECK(calls == 3);
+}
+
+TEST_CASE("[header_index] records and verbose header fields") {
+
+    std::vector<uint32_t> timestamps{100, 300, 200, 500, 400, 700, 600, 900, 800, 1100, 1000, 1300, 1200, 1500, 1400};
+    header_chain chain(make_headers(timestamps));
+
+    // Median of the block and the ten before it.
+    auto const median = [](std::vector<uint32_t> window) {
+        std::sort(window.begin(), window.end());
+        return window[window.size() / 2];
+    };
+
+    // Each 1d00ffff block adds 0x0100010001 to the chainwork.
+    auto const chainwork = [](uint64_t blocks) {
+        std::ostringstream out;
+        out << std::hex << std::setfill('0') << std::setw(64) << blocks * 0x0100010001ull;
+        return out.str();
+    };
+
+    bitprim::rpc::header_index::record record;
+    for (size_t height = 0; height < timestamps.size(); ++height) {
+        REQUIRE(chain.index.find(height, chain.headers()[height].hash(), record));
+        auto const first = timestamps.begin() + (height < 10 ? 0 : height - 10);
+        CHECK(record.median_time == median(std::vector<uint32_t>(first, timestamps.begin() + height + 1)));
+        CHECK(bitprim::rpc::encode_base16(record.chainwork) == chainwork(height + 1));
+        CHECK(record.top_height == timestamps.size() - 1);
+        CHECK(record.has_next == (height + 1 < timestamps.size()));
+        if (record.has_next) {
+            CHECK(record.next_hash == chain.headers()[height + 1].hash());
+        }
+    }
+    CHECK_FALSE(chain.index.find(3, chain.headers()[4].hash(), record));
+    CHECK_FALSE(chain.index.find(timestamps.size(), chain.headers()[4].hash(), record));
+
+    // A shorter branch replaces the top blocks, their records go with them.
+    auto const replaced = chain.headers()[12].hash();
+    chain.reorganize(10, make_headers({5000, 1250}, chain.headers()[10].hash(), 100));
+    CHECK_FALSE(chain.index.find(12, replaced, record));
+    CHECK_FALSE(chain.index.find(13, chain.headers()[12].hash(), record));
+    REQUIRE(chain.index.find(10, chain.headers()[10].hash(), record));
+    CHECK(record.next_hash == chain.headers()[11].hash());
+    REQUIRE(chain.index.find(12, chain.headers()[12].hash(), record));
+    CHECK(record.median_time == median({200, 500, 400, 700, 600, 900, 800, 1100, 1000, 5000, 1250}));
+    CHECK(bitprim::rpc::encode_base16(record.chainwork) == chainwork(13));
+    CHECK(record.top_height == 12);
+    CHECK_FALSE(record.has_next);
+
+    size_t height;
+    libbitcoin::hash_digest hash;
+    CHECK(chain.index.top(height, hash));
+    CHECK(height == 12);
+    CHECK(hash == chain.headers()[12].hash());
+
+    // The genesis block fields, with the version and bits in hex.
+    libbitcoin::hash_digest merkle;
+    bitprim::rpc::decode_hash(merkle, "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    libbitcoin::chain::header const genesis(0x20000000, libbitcoin::null_hash, merkle, 1231006505, 0x1d00ffff, 2083236893);
+    header_chain genesis_chain({genesis});
+    REQUIRE(genesis_chain.index.find(0, genesis.hash(), record));
+
+    bitprim::json_writer writer;
+    uint64_t const size = 285;
+    writer.begin_object();
+    bitprim::write_header_head(writer, genesis, 0, record, &size);
+    bitprim::write_header_tail(writer, genesis, record);
+    writer.end_object();
+
+    auto const fields = nlohmann::json::parse(writer.release());
+    CHECK(fields["hash"] == bitprim::rpc::encode_hash(genesis.hash()));
+    CHECK(fields["confirmations"] == 1);
+    CHECK(fields["size"] == 285);
+    CHECK(fields["height"] == 0);
+    CHECK(fields["version"] == 0x20000000);
+    CHECK(fields["versionHex"] == "20000000");
+    CHECK(fields["merkleroot"] == "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    CHECK(fields["time"] == 1231006505);
+    CHECK(fields["mediantime"] == 1231006505);
+    CHECK(fields["nonce"] == 2083236893u);
+    CHECK(fields["bits"] == "1d00ffff");
+    CHECK(fields["difficulty"] == 1.0);
+    CHECK(fields["chainwork"] == "0000000000000000000000000000000000000000000000000000000100010001");
+    CHECK(fields["previousblockhash"] == "0000000000000000000000000000000000000000000000000000000000000000");
+    CHECK(fields["nextblockhash"].is_null());
+
+    // Without a block size there is no "size".
+    writer.begin_object();
+    bitprim::write_header_head(writer, genesis, 0, record);
+    writer.end_object();
+    CHECK(nlohmann::json::parse(writer.release()).count("size") == 0);
+
+    // getblockheader reads the block size along with the header.
+    struct header_store : block_chain_dummy {
+        libbitcoin::chain::header header;
+        void fetch_block_header_txs_size(libbitcoin::hash_digest const&, libbitcoin::blockchain::safe_chain::block_header_txs_size_fetch_handler handler) const {
+            handler(libbitcoin::error::success, std::make_shared<libbitcoin::message::header const>(header), 0, std::make_shared<libbitcoin::hash_list>(), 285);
+        }
+    };
+    header_store store;
+    store.header = genesis;
+    std::string response;
+    bitprim::rpc_getblockheader(bitprim::rpc::encode_hash(genesis.hash()), true, store, &genesis_chain.index, 1, [&response](std::string result) {
+        response = std::move(result);
+    });
+    CHECK(nlohmann::json::parse(response)["result"] == fields);
+}
+
+TEST_CASE("[address_index] reorganizations undo the replaced blocks") {
+
+    using libbitcoin::chain::output_point;
+
+    // An output created and spent in the same block leaves only deltas.
+    address_chain chain;
+    auto const genesis = chain.mine({coinbase(0, 1, 50)});
+    auto const paid = spend({output_point(genesis->transactions()[0].hash(), 0)}, {pay(2, 30), pay(1, 20)});
+    auto const forwarded = spend({output_point(paid.hash(), 0)}, {pay(3, 30)});
+    chain.mine({coinbase(1, 4, 50), paid, forwarded});
+    chain.index.start();
+    chain.fetch();
+    REQUIRE(chain.index.ready());
+
+    CHECK(chain.balance(1) == 20);
+    CHECK(chain.balance(2) == 0);
+    CHECK(chain.balance(3) == 30);
+    CHECK(chain.deltas(2) == std::vector<int64_t>{30, -30});
+    std::vector<bitprim::rpc::address_index::utxo> utxos;
+    CHECK(chain.index.unspent(address_hash(2), utxos));
+    CHECK(utxos.empty());
+
+    chain.reorganize(0, {{coinbase(2, 5, 50)}});
+    CHECK(chain.balance(1) == 50);
+    CHECK(chain.deltas(1) == std::vector<int64_t>{50});
+    CHECK(chain.balance(2) == 0);
+    CHECK(chain.deltas(2).empty());
+    CHECK(chain.balance(3) == 0);
+    CHECK(chain.balance(4) == 0);
+    CHECK(chain.balance(5) == 50);
+    CHECK(chain.index.unspent(address_hash(1), utxos));
+    REQUIRE(utxos.size() == 1);
+    CHECK(utxos[0].point == output_point(genesis->transactions()[0].hash(), 0));
+    CHECK(utxos[0].height == 0);
+
+    size_t height;
+    libbitcoin::hash_digest hash;
+    CHECK(chain.index.top(height, hash));
+    CHECK(height == 1);
+    CHECK(hash == chain.blocks()[1]->hash());
+}
+
+TEST_CASE("[address_index] reorganizations deeper than the undo records rebuild") {
+
+    address_chain chain;
+    auto const depth = bitprim::rpc::address_index::undo_depth;
+    for (uint32_t height = 0; height < depth + 3; ++height) {
+        chain.mine({coinbase(height, height % 3, 50)});
+    }
+    chain.index.start();
+    chain.fetch();
+    REQUIRE(chain.index.ready());
+    CHECK(chain.balance(1) == 34 * 50);
+
+    // Not enough undo records to go back to the fork, the index starts over.
+    chain.reorganize(0, {{coinbase(1000, 9, 50)}, {coinbase(1001, 9, 50)}});
+    CHECK_FALSE(chain.index.ready());
+    uint64_t balance;
+    uint64_t received;
+    CHECK_FALSE(chain.index.balance(address_hash(9), balance, received));
+
+    chain.fetch();
+    REQUIRE(chain.index.ready());
+    CHECK(chain.balance(0) == 50);
+    CHECK(chain.balance(1) == 0);
+    CHECK(chain.balance(2) == 0);
+    CHECK(chain.balance(9) == 100);
+
+    size_t height;
+    libbitcoin::hash_digest hash;
+    CHECK(chain.index.top(height, hash));
+    CHECK(height == 2);
+    CHECK(hash == chain.blocks()[2]->hash());
+}
+
+TEST_CASE("[address_index] reorganizations while building") {
+
+    address_chain chain;
+    for (uint32_t height = 0; height < 5; ++height) {
+        chain.mine({coinbase(height, 1, 50)});
+    }
+
+    // Blocks 0 to 2 applied, block 3 read but not delivered yet.
+    chain.index.start();
+    chain.fetch(3);
+    CHECK_FALSE(chain.index.ready());
+
+    // The new branch extends the index past the block being read.
+    chain.reorganize(1, {{coinbase(100, 7, 50)}, {coinbase(101, 7, 50)}});
+    chain.fetch();
+    REQUIRE(chain.index.ready());
+    CHECK(chain.deltas(1) == std::vector<int64_t>{50, 50});
+    CHECK(chain.balance(7) == 100);
+
+    size_t height;
+    libbitcoin::hash_digest hash;
+    CHECK(chain.index.top(height, hash));
+    CHECK(height == 3);
+    CHECK(hash == chain.blocks()[3]->hash());
+
+    // A branch below a height still being built is left to the builder.
+    address_chain fresh;
+    for (uint32_t height = 0; height < 4; ++height) {
+        fresh.mine({coinbase(height, 1, 50)});
+    }
+    fresh.index.start();
+    fresh.fetch(1);
+    fresh.reorganize(2, {{coinbase(200, 8, 50)}});
+    fresh.fetch();
+    REQUIRE(fresh.index.ready());
+    CHECK(fresh.balance(1) == 150);
+    CHECK(fresh.balance(8) == 50);
+}
+
+TEST_CASE("[address_index] builds long chains read inline on its own thread") {
+
+    // The chain completes block fetches on the calling thread; building
+    // block after block must not nest them.
+    address_chain chain(true);
+    size_t const count = 20000;
+    for (uint32_t height = 0; height < count; ++height) {
+        chain.mine({coinbase(height, height % 4, 50)});
+    }
+
+    chain.index.start();
+    REQUIRE(eventually([&chain]() {
+        return chain.index.ready();
+    }, std::chrono::seconds(120)));
+    CHECK(chain.balance(0) == count / 4 * 50);
+    CHECK(chain.balance(3) == count / 4 * 50);
+
+    size_t height;
+    libbitcoin::hash_digest hash;
+    CHECK(chain.index.top(height, hash));
+    CHECK(height == count - 1);
+
+    // A reorganization too deep to undo only wakes the loader up.
+    chain.reorganize(0, {{coinbase(100000, 9, 50)}});
+    REQUIRE(eventually([&chain]() {
+        return chain.index.ready();
+    }));
+    CHECK(chain.balance(9) == 50);
+    CHECK(chain.balance(1) == 0);
+}
+
+TEST_CASE("[getaddressbalance] spend lookups run together on the workers") {
+
+    using libbitcoin::chain::history_compact;
+    using libbitcoin::chain::output_point;
+
+    struct history_store : block_chain_dummy {
+        history_compact::list history;
+        std::set<output_point> spent;
+        lookup_overlap lookups;
+
+        void fetch_history(libbitcoin::short_hash const&, size_t, size_t, libbitcoin::blockchain::safe_chain::history_fetch_handler handler) const {
+            handler(libbitcoin::error::success, history);
+        }
+
+        void fetch_spend(output_point const& point, libbitcoin::blockchain::safe_chain::spend_fetch_handler handler) const {
+            lookups.enter();
+            auto const found = spent.count(point) != 0;
+            handler(found ? libbitcoin::error::success : libbitcoin::error::not_found, libbitcoin::chain::input_point());
+        }
+    };
+
+    // Ten outputs, the odd ones spent.
+    history_store store;
+    for (uint32_t n = 0; n < 10; ++n) {
+        history_compact row;
+        row.kind = libbitcoin::chain::point_kind::output;
+        row.point = output_point(libbitcoin::null_hash, n);
+        row.height = 1;
+        row.value = 100 * (n + 1);
+        store.history.push_back(row);
+        if (n % 2 == 1) {
+            store.spent.insert(row.point);
+        }
+    }
+
+    nlohmann::json input;
+    input["method"] = "getaddressbalance";
+    input["id"] = 1;
+    input["params"] = {"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2"};
+
+    std::mutex mutex;
+    nlohmann::json response;
+    thread_dispatcher workers;
+    bitprim::process_getaddressbalance(input, store, false, nullptr, workers.dispatch(), [&mutex, &response](nlohmann::json result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        response = std::move(result);
+    });
+    workers.join();
+
+    CHECK(store.lookups.most() > 1);
+    CHECK_FALSE(store.lookups.ran_on(std::this_thread::get_id()));
+    CHECK(response["result"]["balance"] == 100 + 300 + 500 + 700 + 900);
+    CHECK(response["result"]["received"] == 5500);
+}
+
+TEST_CASE("[getaddressutxos] unspent outputs from the history") {
+
+    using libbitcoin::chain::history_compact;
+    using libbitcoin::chain::output_point;
+    using libbitcoin::chain::point_kind;
+
+    // History, spends and outputs of the store, spend checks counted.
+    struct history_store : block_chain_dummy {
+        std::map<libbitcoin::short_hash, history_compact::list> history;
+        std::map<output_point, libbitcoin::chain::output> outputs;
+        std::set<output_point> spent;
+        mutable std::atomic<size_t> spend_checks{0};
+        bool threaded = false;
+        lookup_overlap lookups;
+
+        void fetch_history(libbitcoin::short_hash const& address_hash, size_t, size_t, libbitcoin::blockchain::safe_chain::history_fetch_handler handler) const {
+            auto const it = history.find(address_hash);
+            handler(libbitcoin::error::success, it == history.end() ? history_compact::list() : it->second);
+        }
+
+        void fetch_spend(output_point const& point, libbitcoin::blockchain::safe_chain::spend_fetch_handler handler) const {
+            ++spend_checks;
+            if (threaded) {
+                lookups.enter();
+            }
+            auto const found = spent.count(point) != 0;
+            handler(found ? libbitcoin::error::success : libbitcoin::error::not_found, libbitcoin::chain::input_point());
+        }
+
+        bool get_output(libbitcoin::chain::output& out_output, size_t& out_height, uint32_t& out_median_time_past, bool& out_coinbase,
+            output_point const& point, size_t, bool) const {
+            auto const it = outputs.find(point);
+            if (it == outputs.end()) {
+                return false;
+            }
+            out_output = it->second;
+            return true;
+        }
+
+        bool get_last_height(size_t& out_height) const {
+            out_height = 7;
+            return true;
+        }
+
+        bool get_block_hash(libbitcoin::hash_digest& out_hash, size_t height) const {
+            out_hash.fill(0x77);
+            return true;
+        }
+    };
+
+    std::string const owner = "1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2";
+    libbitcoin::wallet::payment_address const address(owner);
+    REQUIRE(address);
+
+    // Two outputs with the same checksum, only one of them spent.
+    libbitcoin::hash_digest first;
+    first.fill(0x11);
+    auto second = first;
+    second[31] = 0x22;
+    libbitcoin::hash_digest third;
+    third.fill(0x33);
+    libbitcoin::hash_digest fourth;
+    fourth.fill(0x44);
+    output_point const kept(first, 0);
+    output_point const collided(second, 0);
+    output_point const spent(third, 1);
+    output_point const unspent(fourth, 2);
+    REQUIRE(kept.checksum() == collided.checksum());
+
+    auto const output_row = [](output_point const& point, uint32_t height, uint64_t value) {
+        history_compact row;
+        row.kind = point_kind::output;
+        row.point = point;
+        row.height = height;
+        row.value = value;
+        return row;
+    };
+    auto const spend_row = [](output_point const& point, uint32_t height) {
+        history_compact row;
+        row.kind = point_kind::spend;
+        row.point = output_point(libbitcoin::null_hash, 0);
+        row.height = height;
+        row.previous_checksum = point.checksum();
+        return row;
+    };
+
+    history_store store;
+    store.history[address.hash()] = {
+        output_row(kept, 1, 1000), output_row(collided, 2, 2000), output_row(spent, 3, 3000),
+        output_row(unspent, 4, 4000), spend_row(collided, 5), spend_row(spent, 6)
+    };
+    store.spent = {collided, spent};
+    for (auto const& point : {kept, unspent}) {
+        store.outputs[point] = pay(0x55, 1);
+    }
+
+    nlohmann::json response;
+    auto const request = [&store, &response](nlohmann::json params, bitprim::rpc::address_index const* index, bitprim::work_dispatcher dispatch = nullptr) {
+        nlohmann::json input;
+        input["method"] = "getaddressutxos";
+        input["id"] = 1;
+        input["params"] = params;
+        bitprim::process_getaddressutxos(input, store, false, index, nullptr, nullptr, dispatch, [&response](nlohmann::json result) {
+            response = std::move(result);
+        });
+    };
+
+    request({owner}, nullptr);
+    auto const& utxos = response["result"];
+    REQUIRE(utxos.size() == 2);
+    CHECK(utxos[0]["address"] == owner);
+    CHECK(utxos[0]["txid"] == bitprim::rpc::encode_hash(first));
+    CHECK(utxos[0]["outputIndex"] == 0);
+    CHECK(utxos[0]["satoshis"] == 1000);
+    CHECK(utxos[0]["height"] == 1);
+    CHECK(utxos[0]["script"] == bitprim::rpc::encode_base16(pay(0x55, 1).script().to_data(false)));
+    CHECK(utxos[1]["txid"] == bitprim::rpc::encode_hash(fourth));
+    CHECK(utxos[1]["outputIndex"] == 2);
+    CHECK(utxos[1]["satoshis"] == 4000);
+
+    // Only the output with a checksum of its own is left out unchecked.
+    CHECK(store.spend_checks == 3);
+
+    // The spend checks the store answers inline run together on the workers.
+    auto const sequential = response;
+    store.threaded = true;
+    thread_dispatcher workers;
+    request({owner}, nullptr, workers.dispatch());
+    workers.join();
+    store.threaded = false;
+    CHECK(store.lookups.most() > 1);
+    CHECK_FALSE(store.lookups.ran_on(std::this_thread::get_id()));
+    CHECK(response == sequential);
+
+    // No outputs is an empty list, from the history or from the index.
+    nlohmann::json params;
+    params["addresses"] = {"1111111111111111111114oLvT2"};
+    request(nlohmann::json::array({params}), nullptr);
+    CHECK(response["result"] == nlohmann::json::array());
+
+    params["chainInfo"] = true;
+    request(nlohmann::json::array({params}), nullptr);
+    CHECK(response["result"]["utxos"] == nlohmann::json::array());
+    CHECK(response["result"]["height"] == 7);
+    CHECK(response["result"]["hash"] == std::string(64, '7'));
+
+    address_chain indexed;
+    indexed.mine({coinbase(0, 1, 50)});
+    indexed.index.start();
+    indexed.fetch();
+    REQUIRE(indexed.index.ready());
+    request({owner}, &indexed.index);
+    CHECK(response["result"] == nlohmann::json::array());
+}
+
+TEST_CASE("[getrawtransaction] verbose inputs and outputs") {
+
+    using libbitcoin::chain::output_point;
+
+    // Spend checks complete when the test runs them, in any order, or
+    // inline as the store answers them.
+    struct transaction_store : block_chain_dummy {
+        libbitcoin::transaction_const_ptr transaction;
+        std::map<output_point, libbitcoin::chain::output> outputs;
+        std::set<output_point> spent;
+        bool deferred = true;
+        mutable std::vector<std::function<void()>> spend_checks;
+        lookup_overlap lookups;
+
+        void fetch_transaction(libbitcoin::hash_digest const&, bool, bool, libbitcoin::blockchain::safe_chain::transaction_fetch_handler handler) const {
+            handler(libbitcoin::error::success, transaction, 3, 10);
+        }
+
+        void fetch_spend(output_point const& point, libbitcoin::blockchain::safe_chain::spend_fetch_handler handler) const {
+            auto const found = spent.count(point) != 0;
+            auto check = [found, handler]() {
+                handler(found ? libbitcoin::error::success : libbitcoin::error::not_found, libbitcoin::chain::input_point());
+            };
+            if (deferred) {
+                spend_checks.push_back(check);
+                return;
+            }
+            lookups.enter();
+            check();
+        }
+
+        bool get_output(libbitcoin::chain::output& out_output, size_t& out_height, uint32_t& out_median_time_past, bool& out_coinbase,
+            output_point const& point, size_t, bool) const {
+            if (!deferred) {
+                lookups.enter();
+            }
+            auto const it = outputs.find(point);
+            if (it == outputs.end()) {
+                return false;
+            }
+            out_output = it->second;
+            return true;
+        }
+
+        bool get_header(libbitcoin::chain::header& out_header, size_t height) const {
+            out_header = libbitcoin::chain::header(1, libbitcoin::null_hash, libbitcoin::null_hash, 1500000000 + uint32_t(height), 0x1d00ffff, 0);
+            return true;
+        }
+
+        bool get_last_height(size_t& out_height) const {
+            out_height = 14;
+            return true;
+        }
+    };
+
+    libbitcoin::hash_digest funding;
+    funding.fill(0xab);
+    output_point const known(funding, 1);
+    output_point const missing(funding, 2);
+
+    transaction_store store;
+    store.outputs[known] = pay(1, 150000000);
+    libbitcoin::chain::output const data(0, libbitcoin::chain::script());
+    auto const tx = spend({known, missing}, {pay(2, 500), pay(3, 300), data});
+    store.transaction = std::make_shared<libbitcoin::message::transaction const>(tx);
+    store.spent = {output_point(tx.hash(), 1)};
+
+    nlohmann::json input;
+    input["method"] = "getrawtransaction";
+    input["id"] = 1;
+    input["params"] = {bitprim::rpc::encode_hash(tx.hash()), true};
+    nlohmann::json response;
+    bitprim::process_getrawtransaction(input, store, false, nullptr, nullptr, [&response](nlohmann::json result) {
+        response = std::move(result);
+    });
+
+    // Nothing is answered before every spend is known, whatever their order.
+    REQUIRE(store.spend_checks.size() == 3);
+    CHECK(response.is_null());
+    for (auto it = store.spend_checks.rbegin(); it != store.spend_checks.rend(); ++it) {
+        (*it)();
+    }
+
+    auto const& result = response["result"];
+    CHECK(result["txid"] == bitprim::rpc::encode_hash(tx.hash()));
+    CHECK(result["hex"] == bitprim::rpc::encode_base16(tx.to_data(0)));
+
+    REQUIRE(result["vin"].size() == 2);
+    CHECK(result["vin"][0]["txid"] == bitprim::rpc::encode_hash(funding));
+    CHECK(result["vin"][0]["vout"] == 1);
+    CHECK(result["vin"][0]["valueSat"] == 150000000);
+    CHECK(result["vin"][0]["value"] == 1.5);
+    CHECK(result["vin"][0]["address"] == pay(1, 0).address().encoded());
+    CHECK(result["vin"][0]["sequence"] == 0xffffffff);
+    CHECK(result["vin"][1]["vout"] == 2);
+    CHECK(result["vin"][1].count("valueSat") == 0);
+
+    REQUIRE(result["vout"].size() == 3);
+    for (size_t n = 0; n < 3; ++n) {
+        CHECK(result["vout"][n]["n"] == n);
+        CHECK(result["vout"][n]["valueSat"] == tx.outputs()[n].value());
+    }
+    CHECK(result["vout"][0]["scriptPubKey"]["type"] == "pay_key_hash");
+    CHECK(result["vout"][0]["scriptPubKey"]["addresses"][0] == pay(2, 0).address().encoded());
+    CHECK(result["vout"][2]["scriptPubKey"]["type"] == "non_standard");
+    CHECK(result["vout"][0].count("spentTxId") == 1);
+    CHECK(result["vout"][0]["spentTxId"].is_null());
+    CHECK(result["vout"][1].count("spentTxId") == 0);
+    CHECK(result["vout"][2]["spentHeight"].is_null());
+
+    CHECK(result["height"] == 10);
+    CHECK(result["confirmations"] == 5);
+    CHECK(result["time"] == 1500000010);
+
+    // Answered inline, the prevout reads and spend checks run on the workers.
+    store.deferred = false;
+    nlohmann::json threaded;
+    thread_dispatcher workers;
+    bitprim::process_getrawtransaction(input, store, false, nullptr, workers.dispatch(), [&threaded](nlohmann::json result) {
+        threaded = std::move(result);
+    });
+    workers.join();
+    CHECK(store.lookups.most() > 1);
+    CHECK_FALSE(store.lookups.ran_on(std::this_thread::get_id()));
+    CHECK(threaded == response);
+}
+
+TEST_CASE("[server_http] header ends split across reads") {
+
+    // Fed as async_read_until does: each search resumes where the previous
+    // one stopped. Returns the length of the header, 0 when not complete.
+    auto const header_length = [](std::vector<std::string> const& reads) -> size_t {
+        SimpleWeb::match_header_end const match;
+        std::string buffer;
+        size_t from = 0;
+        for (auto const& read : reads) {
+            buffer += read;
+            auto const found = match(buffer.cbegin() + from, buffer.cend());
+            if (found.second) {
+                return found.first - buffer.cbegin();
+            }
+            from = found.first - buffer.cbegin();
+        }
+        return 0;
+    };
+
+    std::string const crlf = "POST / HTTP/1.1\r\nHost: a\r\n";
+    auto const crlf_end = crlf.size() + 2;
+    CHECK(header_length({crlf + "\r\n{}"}) == crlf_end);
+    CHECK(header_length({crlf + "\r", "\n{}"}) == crlf_end);
+    CHECK(header_length({crlf, "\r\n{}"}) == crlf_end);
+    CHECK(header_length({crlf.substr(0, crlf.size() - 1), "\n\r\n{}"}) == crlf_end);
+    CHECK(header_length({crlf + "\r", "", "\n"}) == crlf_end);
+
+    // Bare newlines, as CKPool sends them, and a mix of both.
+    std::string const lf = "POST / HTTP/1.1\nHost: a\n";
+    CHECK(header_length({lf + "\n{}"}) == lf.size() + 1);
+    CHECK(header_length({lf, "\n{}"}) == lf.size() + 1);
+    CHECK(header_length({lf + "\r\n{}"}) == lf.size() + 2);
+    CHECK(header_length({lf + "\r", "\n{}"}) == lf.size() + 2);
+
+    // No empty line yet.
+    CHECK(header_length({crlf}) == 0);
+    CHECK(header_length({crlf + "\r"}) == 0);
+    CHECK(header_length({"POST / HTTP/1.1\n\r\rHost: a\r\n"}) == 0);
+}
+
+TEST_CASE("[server_http] resource paths compared as literals or regexes") {
+
+    using http_server = SimpleWeb::Server<SimpleWeb::HTTP>;
+    using path = decltype(http_server::resource)::key_type;
+
+    REGEX_NS::smatch match;
+
+    path const json("^/json$");
+    CHECK(json.type() == path::kind::exact);
+    CHECK(json.match("/json", match));
+    CHECK_FALSE(json.match("/json/", match));
+    CHECK_FALSE(json.match("/jso", match));
+
+    path const root("/");
+    CHECK(root.type() == path::kind::exact);
+    CHECK(root.match("/", match));
+    CHECK_FALSE(root.match("/json", match));
+
+    path const files("^/static/.*$");
+    CHECK(files.type() == path::kind::prefix);
+    CHECK(files.match("/static/", match));
+    CHECK(files.match("/static/a/b", match));
+    CHECK_FALSE(files.match("/stat", match));
+
+    path const block("^/block/([0-9a-f]+)$");
+    CHECK(block.type() == path::kind::regex);
+    REQUIRE(block.match("/block/00ff", match));
+    CHECK(match[1] == "00ff");
+    CHECK_FALSE(block.match("/block/xyz", match));
+
+    // An escaped dollar is part of the path, not an anchor.
+    path const price("^/price\\$");
+    CHECK(price.type() == path::kind::regex);
+    CHECK(price.match("/price$", match));
+}
+
+TEST_CASE("[server_http] pipelined responses keep the request order") {
+
+    using http_server = SimpleWeb::Server<SimpleWeb::HTTP>;
+
+    // Responses complete when the test drops them, the body echoed back.
+    std::mutex mutex;
+    std::condition_variable received;
+    std::vector<std::shared_ptr<http_server::Response>> responses;
+
+    http_server server;
+    server.config.address = "127.0.0.1";
+    server.config.port = 18537;
+    server.config.timeout_idle = 1;
+    server.resource["^/echo$"]["POST"] = [&](std::shared_ptr<http_server::Response> response, std::shared_ptr<http_server::Request> request) {
+        auto const body = request->content.string();
+        *response << "HTTP/1.1 200 OK\r\nContent-Length: " << body.size() << "\r\n\r\n" << body;
+        std::lock_guard<std::mutex> lock(mutex);
+        responses.push_back(std::move(response));
+        received.notify_all();
+    };
+    std::thread serving([&server]() {
+        server.start();
+    });
+
+    auto const complete = [&](size_t count) {
+        std::vector<std::shared_ptr<http_server::Response>> ready;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            CHECK(received.wait_for(lock, std::chrono::seconds(5), [&]() {
+                return responses.size() == count;
+            }));
+            ready.swap(responses);
+        }
+        // In reverse order, and after the idle timeout has passed.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        while (!ready.empty()) {
+            ready.pop_back();
+        }
+    };
+
+    boost::asio::io_service io_service;
+    auto const connection = connect_loopback(io_service, server.config.port);
+    REQUIRE(connection);
+    boost::asio::streambuf buffer;
+
+    std::string pipelined;
+    for (auto const body : {"first", "second", "third"}) {
+        pipelined += "POST /echo HTTP/1.1\r\nContent-Length: " + std::to_string(std::strlen(body)) + "\r\n\r\n" + body;
+    }
+    boost::asio::write(*connection, boost::asio::buffer(pipelined));
+    complete(3);
+    CHECK(read_response(*connection, buffer) == "first");
+    CHECK(read_response(*connection, buffer) == "second");
+    CHECK(read_response(*connection, buffer) == "third");
+
+    // The connection stays open for the next request.
+    std::string const next = "POST /echo HTTP/1.1\r\nContent-Length: 6\r\n\r\nfourth";
+    boost::asio::write(*connection, boost::asio::buffer(next));
+    complete(1);
+    CHECK(read_response(*connection, buffer) == "fourth");
+
+    // With nothing pending, an idle connection is closed.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    CHECK(read_response(*connection, buffer) == "closed");
+
+    server.stop();
+    serving.join();
+}
+
+TEST_CASE("[server_http] streamed chunks resume their producer once written") {
+
+    using http_server = SimpleWeb::Server<SimpleWeb::HTTP>;
+
+    // Produces its pieces from the io thread itself: were chunk() to wait
+    // for the socket it would never return.
+    struct producer : std::enable_shared_from_this<producer> {
+        std::shared_ptr<http_server::Response> response;
+        size_t sent = 0;
+        size_t held = 0;
+
+        void next() {
+            while (sent != 3) {
+                auto self = shared_from_this();
+                if (!response->chunk("piece" + std::to_string(sent++), [self]() { self->next(); })) {
+                    ++held;
+                    return;
+                }
+            }
+            response.reset();
+        }
+    };
+
+    std::shared_ptr<producer> last;
+    http_server server;
+    server.config.address = "127.0.0.1";
+    server.config.port = 18538;
+    server.config.stream_window = 1;
+    server.resource["^/stream$"]["GET"] = [&](std::shared_ptr<http_server::Response> response, std::shared_ptr<http_server::Request>) {
+        *response << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+        last = std::make_shared<producer>();
+        last->response = std::move(response);
+        last->next();
+    };
+    std::thread serving([&server]() {
+        server.start();
+    });
+
+    boost::asio::io_service io_service;
+    auto const connection = connect_loopback(io_service, server.config.port);
+    REQUIRE(connection);
+    boost::asio::streambuf buffer;
+
+    std::string const request = "GET /stream HTTP/1.1\r\n\r\n";
+    boost::asio::write(*connection, boost::asio::buffer(request));
+    CHECK(read_response(*connection, buffer) == "piece0piece1piece2");
+
+    // Every piece went over the window and was resumed by its write.
+    server.stop();
+    serving.join();
+    CHECK(last->held == 3);
+    CHECK(!last->response);
+}
+
+TEST_CASE("[zmq_rpc_server] answers while the http server runs") {
+
+    // Started as the manager does: the workers it owns are handed over by
+    // the context, the http server serves on its own thread.
+    bitprim::rpc::worker_pool workers(2);
+    workers.start();
+    std::atomic<size_t> dispatched{0};
+    bitprim::message_context messages;
+    messages.dispatch = [&workers, &dispatched](std::function<void()> work) {
+        ++dispatched;
+        workers.post(std::move(work));
+    };
+
+    std::shared_ptr<libbitcoin::node::full_node> node;
+    bitprim::rpc::zmq_rpc_server zmq_rpc(false, node, "tcp://127.0.0.1:18535", {"127.0.0.1"}, bitprim::rpc::settings(), messages);
+    REQUIRE(zmq_rpc.start());
+
+    SimpleWeb::Server<SimpleWeb::HTTP> http;
+    http.config.address = "127.0.0.1";
+    http.config.port = 18536;
+    std::thread serving([&http]() {
+        http.start();
+    });
+
+    boost::asio::io_service io_service;
+    auto const connection = connect_loopback(io_service, http.config.port);
+    CHECK(connection);
+
+    auto const context = zmq_ctx_new();
+    auto const client = zmq_socket(context, ZMQ_REQ);
+    int const timeout = 5000;
+    zmq_setsockopt(client, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_connect(client, "tcp://127.0.0.1:18535");
+
+    std::string const request = "{\"method\":";
+    CHECK(zmq_send(client, request.data(), request.size(), 0) == int(request.size()));
+    std::string reply(4096, '\0');
+    auto const size = zmq_recv(client, &reply[0], reply.size(), 0);
+    REQUIRE(size > 0);
+    reply.resize(std::min(size_t(size), reply.size()));
+    CHECK((int)nlohmann::json::parse(reply)["error"]["code"] == bitprim::RPC_PARSE_ERROR);
+    CHECK(dispatched == 1);
+
+    int const linger = 0;
+    zmq_setsockopt(client, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(client);
+    zmq_ctx_term(context);
+
+    http.stop();
+    serving.join();
+    zmq_rpc.stop();
+    workers.stop();
+}
+
+TEST_CASE("[zmq_topic] sequence numbers count each topic's sent messages") {
+
+    using bitprim::rpc::zmq_topic;
+
+    // The socket refuses whatever the test says.
+    bool refuse = false;
+    std::vector<std::pair<std::string, uint32_t>> sent;
+    auto const transmitter = [&](char const* command) {
+        return [&, command](zmq_topic::message const&, uint32_t sequence) {
+            if (refuse) {
+                return false;
+            }
+            sent.emplace_back(command, sequence);
+            return true;
+        };
+    };
+    auto const body = std::make_shared<libbitcoin::data_chunk const>(32, 0);
+    zmq_topic::limits const limits{10, 1000, std::chrono::seconds(60)};
+
+    zmq_topic hashblock("hashblock", limits, transmitter("hashblock"));
+    zmq_topic hashtx("hashtx", limits, transmitter("hashtx"));
+    hashblock.subscribe(true);
+
+    // Each topic numbers its own messages from zero.
+    hashblock.send(body, 0, 32);
+    hashblock.send(body, 0, 32);
+    hashtx.send(body, 0, 32);
+    CHECK(sent == (std::vector<std::pair<std::string, uint32_t>>{{"hashblock", 0}, {"hashblock", 1}}));
+    CHECK(hashtx.sequence() == 0);
+
+    // A pending message gets its number when it goes out.
+    hashtx.subscribe(true);
+    hashtx.send(body, 0, 32);
+    CHECK(sent.size() == 4);
+    CHECK(sent[2] == std::make_pair(std::string("hashtx"), uint32_t(0)));
+    CHECK(sent[3] == std::make_pair(std::string("hashtx"), uint32_t(1)));
+
+    // A refused message does not use up a number.
+    refuse = true;
+    hashblock.send(body, 0, 32);
+    refuse = false;
+    hashblock.send(body, 0, 32);
+    CHECK(sent.back() == std::make_pair(std::string("hashblock"), uint32_t(2)));
+    CHECK(hashblock.sequence() == 3);
+
+    // Nor does one dropped while nobody is subscribed.
+    zmq_topic::limits const none{0, 0, std::chrono::seconds(0)};
+    zmq_topic rawtx("rawtx", none, transmitter("rawtx"));
+    CHECK(rawtx.send(body, 0, 32) == 1);
+    rawtx.subscribe(true);
+    rawtx.send(body, 0, 32);
+    CHECK(sent.back() == std::make_pair(std::string("rawtx"), uint32_t(0)));
+}
+
+TEST_CASE("[zmq_topic] blockdisconnect bodies from the old tip down") {
+
+    // Blocks 11 to 13 replaced above a fork at height 10.
+    auto const outgoing = make_blocks(make_headers({1000, 1010, 1020}));
+    auto const bodies = bitprim::rpc::block_disconnect_bodies(10, *outgoing);
+
+    REQUIRE(bodies.size() == 3);
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        auto const& block = (*outgoing)[outgoing->size() - 1 - i];
+        auto const height = static_cast<uint32_t>(13 - i);
+
+        auto const hash = block->hash();
+        libbitcoin::data_chunk expected(hash.rbegin(), hash.rend());
+        expected.push_back(static_cast<uint8_t>(height));
+        expected.insert(expected.end(), 3, 0);
+        CHECK(bodies[i] == expected);
+    }
+
+    CHECK(bitprim::rpc::block_disconnect_bodies(10, libbitcoin::block_const_ptr_list()).empty());
+}
+
+TEST_CASE("[zmq_topic] pending messages are bounded in count, bytes and age") {
+
+    using bitprim::rpc::zmq_topic;
+
+    std::vector<std::string> sent;
+    auto const transmit = [&sent](zmq_topic::message const& message, uint32_t) {
+        auto const first = message.buffer->begin() + message.offset;
+        sent.emplace_back(first, first + message.size);
+        return true;
+    };
+    auto const chunk = [](std::string const& text) {
+        return std::make_shared<libbitcoin::data_chunk const>(text.begin(), text.end());
+    };
+    auto const start = zmq_topic::clock::now();
+    auto const at = [start](int seconds) {
+        return start + std::chrono::seconds(seconds);
+    };
+
+    // Beyond the count the oldest go first.
+    zmq_topic counted("hashtx", {3, 1000, std::chrono::seconds(60)}, transmit);
+    size_t dropped = 0;
+    for (auto const body : {"a", "b", "c", "d", "e"}) {
+        dropped += counted.send(chunk(body), 0, 1, at(0));
+    }
+    CHECK(dropped == 2);
+    CHECK(counted.pending() == 3);
+    CHECK(counted.subscribe(true, at(1)) == 0);
+    CHECK(sent == std::vector<std::string>{"c", "d", "e"});
+    CHECK(counted.pending() == 0);
+
+    // So they do beyond the bytes, and a message larger than them alone is
+    // not kept at all.
+    zmq_topic sized("rawblock", {100, 10, std::chrono::seconds(60)}, transmit);
+    CHECK(sized.send(chunk("1234"), 0, 4, at(0)) == 0);
+    CHECK(sized.send(chunk("5678"), 0, 4, at(0)) == 0);
+    CHECK(sized.send(chunk("9abc"), 0, 4, at(0)) == 1);
+    CHECK(sized.pending_bytes() == 8);
+    CHECK(sized.send(chunk("0123456789a"), 0, 11, at(0)) == 1);
+    CHECK(sized.pending() == 2);
+
+    // A slice does not keep the buffer it was cut from.
+    auto const block = chunk("headtxtail");
+    CHECK(sized.send(block, 4, 2, at(0)) == 0);
+    CHECK(block.use_count() == 1);
+    CHECK(sized.pending_bytes() == 10);
+    sent.clear();
+    sized.subscribe(true, at(0));
+    CHECK(sent == std::vector<std::string>{"5678", "9abc", "tx"});
+
+    // Old messages expire, also the ones a new subscriber would get.
+    zmq_topic aged("hashblock", {100, 1000, std::chrono::seconds(10)}, transmit);
+    aged.send(chunk("x"), 0, 1, at(0));
+    aged.send(chunk("y"), 0, 1, at(5));
+    CHECK(aged.expire(at(9)) == 0);
+    CHECK(aged.expire(at(10)) == 1);
+    sent.clear();
+    CHECK(aged.subscribe(true, at(15)) == 1);
+    CHECK(sent.empty());
+
+    // Zero limits keep nothing, as rawblock and rawtx by default.
+    CHECK(!bitprim::rpc::settings().zmq_pending_raw);
+    zmq_topic none("rawtx", {0, 0, std::chrono::seconds(0)}, transmit);
+    CHECK(none.send(chunk("t"), 0, 1, at(0)) == 1);
+    CHECK(none.pending() == 0);
+}
 
 
 #endif /*DOCTEST_LIBRARY_INCLUDED*/